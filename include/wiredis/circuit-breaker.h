@@ -0,0 +1,134 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+#include <chrono>
+#include <mutex>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Fails fast while the server is unavailable.
+         *
+         * CLOSED: everything goes through. After failure_threshold failures in a row it opens.
+         * OPEN: everything is rejected for open_duration, then it becomes half-open.
+         * HALF_OPEN: only trial_requests requests go through at a time. A success closes it,
+         *     a failure opens it again.
+         *
+         * Failures are the requests without reply (timeout, disconnection), an error reply
+         * of the server is a success: the server is there.
+         */
+        class circuit_breaker
+        {
+        public:
+
+            enum class state
+            {
+                CLOSED,
+                OPEN,
+                HALF_OPEN
+            };
+
+
+            circuit_breaker(unsigned failure_threshold = 5,
+                            std::chrono::milliseconds open_duration = std::chrono::milliseconds(1000),
+                            unsigned trial_requests = 1):
+                _failure_threshold(failure_threshold),
+                _open_duration(open_duration),
+                _trial_requests(trial_requests),
+                _state(state::CLOSED),
+                _failures(0),
+                _trials(0)
+            {
+            }
+
+
+            // True if the request can be sent. Its result has to be reported then.
+            bool allow()
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                if (state::OPEN == _state)
+                {
+                    if (std::chrono::steady_clock::now() - _opened_at < _open_duration)
+                    {
+                        return false;
+                    }
+                    _state = state::HALF_OPEN;
+                    _trials = 0;
+                }
+                if (state::HALF_OPEN == _state)
+                {
+                    if (_trials >= _trial_requests)
+                    {
+                        return false;
+                    }
+                    ++_trials;
+                }
+                return true;
+            }
+
+
+            void on_success()
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _failures = 0;
+                if (state::HALF_OPEN == _state)
+                {
+                    _state = state::CLOSED;
+                }
+            }
+
+
+            void on_failure()
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                if (state::HALF_OPEN == _state || (state::CLOSED == _state && ++_failures >= _failure_threshold))
+                {
+                    _state = state::OPEN;
+                    _opened_at = std::chrono::steady_clock::now();
+                    _failures = 0;
+                }
+            }
+
+
+            // The request has been given up without result (e.g. cancelled).
+            void on_abandoned()
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                if (state::HALF_OPEN == _state && 0 < _trials)
+                {
+                    --_trials;
+                }
+            }
+
+
+            state current() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                if (state::OPEN == _state && std::chrono::steady_clock::now() - _opened_at >= _open_duration)
+                {
+                    return state::HALF_OPEN;
+                }
+                return _state;
+            }
+
+
+        private:
+
+            mutable std::mutex _mutex;
+            unsigned const _failure_threshold;
+            std::chrono::milliseconds const _open_duration;
+            unsigned const _trial_requests;
+            state _state;
+            unsigned _failures;
+            unsigned _trials;
+            std::chrono::steady_clock::time_point _opened_at;
+        };
+
+    }
+}
@@ -0,0 +1,391 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Key positions and flags of a redis command, following the definition of the COMMAND command.
+         * See: https://redis.io/commands/command
+         */
+        struct command_info
+        {
+            enum flag
+            {
+                KEYS_AFTER_STREAMS = 1,   // XREAD, XREADGROUP: keys are the first half of the arguments after STREAMS
+                READONLY = 2,             // doesn't modify data, can be served by replicas
+                BLOCKING = 4,             // may hold the connection until its timeout (XREAD, XREADGROUP: with BLOCK only)
+                CACHEABLE = 8             // read of stored values only: the same reply until the keys are modified
+            };
+
+            int first_key;   // index of the first key, 0 if there's no fixed key position
+            int last_key;    // index of the last key, negative values are counted from the end (-1: last argument)
+            int key_step;    // distance of two keys (e.g. 2 in case of MSET)
+            int numkeys;     // index of the argument holding the number of keys, they follow right after it (0: not used)
+            unsigned flags;
+        };
+
+
+        /*
+         * Returns nullptr for unknown commands and for keyless commands which aren't read-only.
+         */
+        inline command_info const * find_command(std::string const & name)
+        {
+            static std::map<std::string, command_info> const commands =
+                {
+                    // keyless
+                    {"SCAN",              {0, 0, 0, 0, command_info::READONLY}},
+                    {"KEYS",              {0, 0, 0, 0, command_info::READONLY}},
+                    {"DBSIZE",            {0, 0, 0, 0, command_info::READONLY}},
+                    {"RANDOMKEY",         {0, 0, 0, 0, command_info::READONLY}},
+                    // keys
+                    {"DEL",               {1, -1, 1, 0, 0}},
+                    {"UNLINK",            {1, -1, 1, 0, 0}},
+                    {"EXISTS",            {1, -1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"TOUCH",             {1, -1, 1, 0, 0}},
+                    {"WATCH",             {1, -1, 1, 0, 0}},
+                    {"TYPE",              {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"DUMP",              {1, 1, 1, 0, command_info::READONLY}},
+                    {"RESTORE",           {1, 1, 1, 0, 0}},
+                    {"EXPIRE",            {1, 1, 1, 0, 0}},
+                    {"PEXPIRE",           {1, 1, 1, 0, 0}},
+                    {"EXPIREAT",          {1, 1, 1, 0, 0}},
+                    {"PEXPIREAT",         {1, 1, 1, 0, 0}},
+                    {"EXPIRETIME",        {1, 1, 1, 0, command_info::READONLY}},
+                    {"PEXPIRETIME",       {1, 1, 1, 0, command_info::READONLY}},
+                    {"TTL",               {1, 1, 1, 0, command_info::READONLY}},
+                    {"PTTL",              {1, 1, 1, 0, command_info::READONLY}},
+                    {"PERSIST",           {1, 1, 1, 0, 0}},
+                    {"RENAME",            {1, 2, 1, 0, 0}},
+                    {"RENAMENX",          {1, 2, 1, 0, 0}},
+                    {"COPY",              {1, 2, 1, 0, 0}},
+                    {"OBJECT",            {2, 2, 1, 0, command_info::READONLY}},
+                    {"SORT",              {1, 1, 1, 0, 0}},
+                    {"SORT_RO",           {1, 1, 1, 0, command_info::READONLY}},
+                    // strings
+                    {"GET",               {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"SET",               {1, 1, 1, 0, 0}},
+                    {"SETNX",             {1, 1, 1, 0, 0}},
+                    {"SETEX",             {1, 1, 1, 0, 0}},
+                    {"PSETEX",            {1, 1, 1, 0, 0}},
+                    {"GETSET",            {1, 1, 1, 0, 0}},
+                    {"GETDEL",            {1, 1, 1, 0, 0}},
+                    {"GETEX",             {1, 1, 1, 0, 0}},
+                    {"APPEND",            {1, 1, 1, 0, 0}},
+                    {"STRLEN",            {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"INCR",              {1, 1, 1, 0, 0}},
+                    {"DECR",              {1, 1, 1, 0, 0}},
+                    {"INCRBY",            {1, 1, 1, 0, 0}},
+                    {"DECRBY",            {1, 1, 1, 0, 0}},
+                    {"INCRBYFLOAT",       {1, 1, 1, 0, 0}},
+                    {"GETRANGE",          {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"SETRANGE",          {1, 1, 1, 0, 0}},
+                    {"SUBSTR",            {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"GETBIT",            {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"SETBIT",            {1, 1, 1, 0, 0}},
+                    {"BITCOUNT",          {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"BITPOS",            {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"BITFIELD",          {1, 1, 1, 0, 0}},
+                    {"BITFIELD_RO",       {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"BITOP",             {2, -1, 1, 0, 0}},
+                    {"MGET",              {1, -1, 1, 0, command_info::READONLY}},
+                    {"MSET",              {1, -1, 2, 0, 0}},
+                    {"MSETNX",            {1, -1, 2, 0, 0}},
+                    // hashes
+                    {"HGET",              {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"HSET",              {1, 1, 1, 0, 0}},
+                    {"HSETNX",            {1, 1, 1, 0, 0}},
+                    {"HMSET",             {1, 1, 1, 0, 0}},
+                    {"HMGET",             {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"HDEL",              {1, 1, 1, 0, 0}},
+                    {"HLEN",              {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"HSTRLEN",           {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"HEXISTS",           {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"HKEYS",             {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"HVALS",             {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"HGETALL",           {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"HINCRBY",           {1, 1, 1, 0, 0}},
+                    {"HINCRBYFLOAT",      {1, 1, 1, 0, 0}},
+                    {"HSCAN",             {1, 1, 1, 0, command_info::READONLY}},
+                    {"HRANDFIELD",        {1, 1, 1, 0, command_info::READONLY}},
+                    // lists
+                    {"LPUSH",             {1, 1, 1, 0, 0}},
+                    {"RPUSH",             {1, 1, 1, 0, 0}},
+                    {"LPUSHX",            {1, 1, 1, 0, 0}},
+                    {"RPUSHX",            {1, 1, 1, 0, 0}},
+                    {"LPOP",              {1, 1, 1, 0, 0}},
+                    {"RPOP",              {1, 1, 1, 0, 0}},
+                    {"LLEN",              {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"LRANGE",            {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"LINDEX",            {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"LSET",              {1, 1, 1, 0, 0}},
+                    {"LINSERT",           {1, 1, 1, 0, 0}},
+                    {"LREM",              {1, 1, 1, 0, 0}},
+                    {"LTRIM",             {1, 1, 1, 0, 0}},
+                    {"LPOS",              {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"RPOPLPUSH",         {1, 2, 1, 0, 0}},
+                    {"LMOVE",             {1, 2, 1, 0, 0}},
+                    {"LMPOP",             {0, 0, 1, 1, 0}},
+                    {"BLPOP",             {1, -2, 1, 0, command_info::BLOCKING}},
+                    {"BRPOP",             {1, -2, 1, 0, command_info::BLOCKING}},
+                    {"BRPOPLPUSH",        {1, 2, 1, 0, command_info::BLOCKING}},
+                    {"BLMOVE",            {1, 2, 1, 0, command_info::BLOCKING}},
+                    {"BLMPOP",            {0, 0, 1, 2, command_info::BLOCKING}},
+                    // sets
+                    {"SADD",              {1, 1, 1, 0, 0}},
+                    {"SREM",              {1, 1, 1, 0, 0}},
+                    {"SCARD",             {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"SISMEMBER",         {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"SMISMEMBER",        {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"SMEMBERS",          {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"SPOP",              {1, 1, 1, 0, 0}},
+                    {"SRANDMEMBER",       {1, 1, 1, 0, command_info::READONLY}},
+                    {"SSCAN",             {1, 1, 1, 0, command_info::READONLY}},
+                    {"SMOVE",             {1, 2, 1, 0, 0}},
+                    {"SINTER",            {1, -1, 1, 0, command_info::READONLY}},
+                    {"SUNION",            {1, -1, 1, 0, command_info::READONLY}},
+                    {"SDIFF",             {1, -1, 1, 0, command_info::READONLY}},
+                    {"SINTERSTORE",       {1, -1, 1, 0, 0}},
+                    {"SUNIONSTORE",       {1, -1, 1, 0, 0}},
+                    {"SDIFFSTORE",        {1, -1, 1, 0, 0}},
+                    {"SINTERCARD",        {0, 0, 1, 1, command_info::READONLY}},
+                    // sorted sets
+                    {"ZADD",              {1, 1, 1, 0, 0}},
+                    {"ZREM",              {1, 1, 1, 0, 0}},
+                    {"ZCARD",             {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"ZSCORE",            {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"ZMSCORE",           {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"ZINCRBY",           {1, 1, 1, 0, 0}},
+                    {"ZRANK",             {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"ZREVRANK",          {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"ZRANGE",            {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"ZREVRANGE",         {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"ZRANGEBYSCORE",     {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"ZREVRANGEBYSCORE",  {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"ZRANGEBYLEX",       {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"ZREVRANGEBYLEX",    {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"ZCOUNT",            {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"ZLEXCOUNT",         {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"ZREMRANGEBYRANK",   {1, 1, 1, 0, 0}},
+                    {"ZREMRANGEBYSCORE",  {1, 1, 1, 0, 0}},
+                    {"ZREMRANGEBYLEX",    {1, 1, 1, 0, 0}},
+                    {"ZPOPMIN",           {1, 1, 1, 0, 0}},
+                    {"ZPOPMAX",           {1, 1, 1, 0, 0}},
+                    {"ZSCAN",             {1, 1, 1, 0, command_info::READONLY}},
+                    {"ZRANDMEMBER",       {1, 1, 1, 0, command_info::READONLY}},
+                    {"ZRANGESTORE",       {1, 2, 1, 0, 0}},
+                    {"BZPOPMIN",          {1, -2, 1, 0, command_info::BLOCKING}},
+                    {"BZPOPMAX",          {1, -2, 1, 0, command_info::BLOCKING}},
+                    {"ZUNIONSTORE",       {1, 1, 1, 2, 0}},
+                    {"ZINTERSTORE",       {1, 1, 1, 2, 0}},
+                    {"ZDIFFSTORE",        {1, 1, 1, 2, 0}},
+                    {"ZUNION",            {0, 0, 1, 1, command_info::READONLY}},
+                    {"ZINTER",            {0, 0, 1, 1, command_info::READONLY}},
+                    {"ZDIFF",             {0, 0, 1, 1, command_info::READONLY}},
+                    {"ZINTERCARD",        {0, 0, 1, 1, command_info::READONLY}},
+                    {"ZMPOP",             {0, 0, 1, 1, 0}},
+                    {"BZMPOP",            {0, 0, 1, 2, command_info::BLOCKING}},
+                    // hyperloglog
+                    {"PFADD",             {1, 1, 1, 0, 0}},
+                    {"PFCOUNT",           {1, -1, 1, 0, command_info::READONLY}},
+                    {"PFMERGE",           {1, -1, 1, 0, 0}},
+                    // geo
+                    {"GEOADD",            {1, 1, 1, 0, 0}},
+                    {"GEODIST",           {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"GEOHASH",           {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"GEOPOS",            {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"GEORADIUS",         {1, 1, 1, 0, 0}},
+                    {"GEORADIUS_RO",      {1, 1, 1, 0, command_info::READONLY}},
+                    {"GEORADIUSBYMEMBER", {1, 1, 1, 0, 0}},
+                    {"GEORADIUSBYMEMBER_RO", {1, 1, 1, 0, command_info::READONLY}},
+                    {"GEOSEARCH",         {1, 1, 1, 0, command_info::READONLY}},
+                    {"GEOSEARCHSTORE",    {1, 2, 1, 0, 0}},
+                    // streams
+                    {"XADD",              {1, 1, 1, 0, 0}},
+                    {"XLEN",              {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"XRANGE",            {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"XREVRANGE",         {1, 1, 1, 0, command_info::READONLY | command_info::CACHEABLE}},
+                    {"XDEL",              {1, 1, 1, 0, 0}},
+                    {"XTRIM",             {1, 1, 1, 0, 0}},
+                    {"XACK",              {1, 1, 1, 0, 0}},
+                    {"XPENDING",          {1, 1, 1, 0, command_info::READONLY}},
+                    {"XCLAIM",            {1, 1, 1, 0, 0}},
+                    {"XAUTOCLAIM",        {1, 1, 1, 0, 0}},
+                    {"XSETID",            {1, 1, 1, 0, 0}},
+                    {"XGROUP",            {2, 2, 1, 0, 0}},
+                    {"XINFO",             {2, 2, 1, 0, command_info::READONLY}},
+                    {"XREAD",             {0, 0, 1, 0, command_info::KEYS_AFTER_STREAMS | command_info::READONLY | command_info::BLOCKING}},
+                    {"XREADGROUP",        {0, 0, 1, 0, command_info::KEYS_AFTER_STREAMS | command_info::BLOCKING}},
+                    // scripting
+                    {"EVAL",              {0, 0, 1, 2, 0}},
+                    {"EVALSHA",           {0, 0, 1, 2, 0}},
+                    {"EVAL_RO",           {0, 0, 1, 2, command_info::READONLY}},
+                    {"EVALSHA_RO",        {0, 0, 1, 2, command_info::READONLY}},
+                    {"FCALL",             {0, 0, 1, 2, 0}},
+                    {"FCALL_RO",          {0, 0, 1, 2, command_info::READONLY}},
+                };
+
+            std::string upper_name = name;
+            std::transform(upper_name.begin(), upper_name.end(), upper_name.begin(), ::toupper);
+            auto it = commands.find(upper_name);
+            if (commands.end() == it)
+            {
+                return nullptr;
+            }
+            return &it->second;
+        }
+
+
+        /*
+         * Returns the indexes of the key arguments of the command (command[0] is the command name itself).
+         */
+        inline std::vector<std::size_t> key_indexes(std::vector<std::string> const & command)
+        {
+            std::vector<std::size_t> indexes;
+            if (command.empty())
+            {
+                return indexes;
+            }
+            command_info const * info = find_command(command[0]);
+            if (nullptr == info)
+            {
+                return indexes;
+            }
+            int const size = static_cast<int>(command.size());
+            if (0 < info->first_key)
+            {
+                int const last_key = (info->last_key < 0) ? size + info->last_key : info->last_key;
+                for (int i = info->first_key; i <= last_key && i < size; i += info->key_step)
+                {
+                    indexes.push_back(i);
+                }
+            }
+            if (0 < info->numkeys && info->numkeys < size)
+            {
+                int const numkeys = std::atoi(command[info->numkeys].c_str());
+                for (int i = info->numkeys + 1; i <= info->numkeys + numkeys && i < size; ++i)
+                {
+                    indexes.push_back(i);
+                }
+            }
+            if (info->flags & command_info::KEYS_AFTER_STREAMS)
+            {
+                for (int i = 1; i < size; ++i)
+                {
+                    std::string argument = command[i];
+                    std::transform(argument.begin(), argument.end(), argument.begin(), ::toupper);
+                    if ("STREAMS" == argument)
+                    {
+                        int const numkeys = (size - i - 1) / 2;
+                        for (int j = i + 1; j <= i + numkeys; ++j)
+                        {
+                            indexes.push_back(j);
+                        }
+                        break;
+                    }
+                }
+            }
+            return indexes;
+        }
+
+
+        /*
+         * True if the command doesn't modify data, so it can be sent to a replica.
+         */
+        inline bool is_readonly(std::vector<std::string> const & command)
+        {
+            if (command.empty())
+            {
+                return false;
+            }
+            command_info const * info = find_command(command[0]);
+            return (nullptr != info) && (info->flags & command_info::READONLY);
+        }
+
+
+        /*
+         * True if the reply depends on the stored values only, so it can be cached until the keys are
+         * modified. Not set for random (SRANDMEMBER, HRANDFIELD) and time dependent (TTL, PTTL) reads.
+         */
+        inline bool is_cacheable(std::vector<std::string> const & command)
+        {
+            if (command.empty())
+            {
+                return false;
+            }
+            command_info const * info = find_command(command[0]);
+            return (nullptr != info) && (info->flags & command_info::CACHEABLE);
+        }
+
+
+        /*
+         * True if the command may block the connection until it's served or its timeout expires: BLPOP,
+         * BRPOP, BLMOVE, BZPOPMIN, ... and XREAD, XREADGROUP with BLOCK. WAIT isn't counted, it refers to
+         * the writes of its own connection.
+         */
+        inline bool is_blocking(std::vector<std::string> const & command)
+        {
+            if (command.empty())
+            {
+                return false;
+            }
+            command_info const * info = find_command(command[0]);
+            if ((nullptr == info) || !(info->flags & command_info::BLOCKING))
+            {
+                return false;
+            }
+            if (!(info->flags & command_info::KEYS_AFTER_STREAMS))
+            {
+                return true;
+            }
+            for (std::size_t i = 1; i < command.size(); ++i)
+            {
+                std::string argument = command[i];
+                std::transform(argument.begin(), argument.end(), argument.begin(), ::toupper);
+                if ("BLOCK" == argument)
+                {
+                    return true;
+                }
+                if ("STREAMS" == argument)
+                {
+                    break;
+                }
+            }
+            return false;
+        }
+
+
+        /*
+         * Returns the index of the first key argument, 0 if the command doesn't have any.
+         */
+        inline std::size_t first_key_index(std::vector<std::string> const & command)
+        {
+            if (command.empty())
+            {
+                return 0;
+            }
+            command_info const * info = find_command(command[0]);
+            if (nullptr == info)
+            {
+                return 0;
+            }
+            if (0 < info->first_key)
+            {
+                return (static_cast<std::size_t>(info->first_key) < command.size()) ? info->first_key : 0;
+            }
+            std::vector<std::size_t> const indexes = key_indexes(command);
+            return indexes.empty() ? 0 : indexes.front();
+        }
+    }
+}
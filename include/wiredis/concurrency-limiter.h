@@ -0,0 +1,121 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Adaptive limit of the requests waiting for reply (AIMD, driven by latency).
+         *
+         * The limit grows by one per limit replies while the latency stays close to its long-term
+         * average (and the limit is actually used). It's cut by 10% when a reply is slower than
+         * tolerance * average or the request fails, at most once per average round-trip, so a
+         * burst of slow replies counts once. Requests over the limit are rejected, so a slow
+         * server gets less work instead of a longer queue.
+         */
+        class concurrency_limiter
+        {
+        public:
+
+            concurrency_limiter(std::size_t initial_limit = 20,
+                                std::size_t min_limit = 1,
+                                std::size_t max_limit = 1000,
+                                double tolerance = 2.0):
+                _limit(static_cast<double>(initial_limit)),
+                _min_limit(min_limit),
+                _max_limit(max_limit),
+                _tolerance(tolerance),
+                _in_flight(0),
+                _baseline(0)
+            {
+            }
+
+
+            // True if the request can be sent, release() has to be called for it then.
+            bool try_acquire()
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                if (_in_flight >= static_cast<std::size_t>(_limit))
+                {
+                    return false;
+                }
+                ++_in_flight;
+                return true;
+            }
+
+
+            /*
+             * latency: from sending to reply
+             * failed: no reply (timeout, disconnection)
+             */
+            void release(std::chrono::microseconds latency, bool failed)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                std::size_t const in_flight = _in_flight--;
+                auto const now = std::chrono::steady_clock::now();
+                if (failed || (0 != _baseline.count() && latency.count() > _tolerance * _baseline.count()))
+                {
+                    if (now - _decreased_at >= _baseline)
+                    {
+                        _decreased_at = now;
+                        _limit = std::max(static_cast<double>(_min_limit), _limit * 0.9);
+                    }
+                }
+                else if (2 * in_flight >= _limit)
+                {
+                    // Only if the limit is used, an idle client would grow it without any evidence.
+                    _limit = std::min(static_cast<double>(_max_limit), _limit + 1 / _limit);
+                }
+                if (!failed)
+                {
+                    _baseline = (0 == _baseline.count()) ? latency : _baseline + (latency - _baseline) / 64;
+                }
+            }
+
+
+            // The request has been given up without result (e.g. cancelled).
+            void release()
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                --_in_flight;
+            }
+
+
+            std::size_t limit() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return static_cast<std::size_t>(_limit);
+            }
+
+
+            std::size_t in_flight() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _in_flight;
+            }
+
+
+        private:
+
+            mutable std::mutex _mutex;
+            double _limit;
+            std::size_t const _min_limit;
+            std::size_t const _max_limit;
+            double const _tolerance;
+            std::size_t _in_flight;
+            std::chrono::microseconds _baseline;        // long-term average latency
+            std::chrono::steady_clock::time_point _decreased_at;
+        };
+
+    }
+}
@@ -0,0 +1,301 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/asio/steady_timer.hpp>
+
+#include <wiredis/redis-connection.h>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Connects a set of clients in parallel and calls back once, when all of them are ready
+         * or the timeout has expired, with the status of every member. Meant for startup:
+         * a single readiness signal instead of polling connected() of every connection.
+         *
+         * The members keep running after the completion (reconnect, handshake), the group
+         * doesn't own them.
+         */
+        class connection_group
+        {
+        public:
+
+            struct member_status
+            {
+                std::string name;
+                bool ready;
+                std::string error;                  // the last error if not ready (connect or handshake)
+                std::chrono::milliseconds elapsed;  // from start() until ready
+            };
+
+
+            /*
+             * Called by a member with empty error when it's ready, with the error otherwise.
+             * A member may report several errors (e.g. while reconnecting) before it's ready.
+             */
+            typedef std::function<void (std::string const & error)> report_callback;
+
+
+            connection_group(boost::asio::io_service & io_service):
+                _io_service(io_service),
+                _state(std::make_shared<state>(io_service))
+            {
+            }
+
+
+            /*
+             * Generic member, e.g. a pool or a cluster.
+             * start: initiates the connecting, it has to call the report callback when the member is ready.
+             */
+            void add(std::string const & name, std::function<void (report_callback)> start)
+            {
+                std::unique_lock<std::mutex> guard(_state->mutex);
+                _state->members.push_back(member_status{name, false, "not started", std::chrono::milliseconds(0)});
+                _starts.push_back(start);
+            }
+
+
+            /*
+             * Connects the connection, then executes the handshake commands (e.g. AUTH, SELECT, CLIENT SETNAME).
+             * The member is ready when every command has succeeded. The commands are executed again
+             * after every reconnect.
+             * The connected/disconnected callbacks are the same as of redis_connection::connect().
+             */
+            void add(std::string const & name,
+                     redis_connection & connection,
+                     std::string const & ip,
+                     uint16_t port,
+                     std::vector<std::vector<std::string>> const & handshake = {},
+                     std::function<void (boost::system::error_code const &)> connected_callback = nullptr,
+                     std::function<void (boost::system::error_code const &)> disconnected_callback = nullptr)
+            {
+                add(name,
+                    [&connection, ip, port, handshake, connected_callback, disconnected_callback] (report_callback report)
+                    {
+                        connection.connect(ip,
+                                           port,
+                                           [&connection, handshake, connected_callback, report] (boost::system::error_code const & error)
+                                           {
+                                               if (error)
+                                               {
+                                                   report(error.message());
+                                               }
+                                               else
+                                               {
+                                                   execute_handshake(connection, handshake, report);
+                                               }
+                                               if (connected_callback)
+                                               {
+                                                   connected_callback(error);
+                                               }
+                                           },
+                                           disconnected_callback);
+                    });
+            }
+
+
+            /*
+             * Starts every member at once. The callback is called once in the io_service thread
+             * with all_ready == true when every member has become ready, or when the timeout has
+             * expired with the members not ready yet.
+             */
+            void start(std::chrono::milliseconds timeout,
+                       std::function<void (bool all_ready, std::vector<member_status> const & members)> callback)
+            {
+                std::vector<std::function<void (report_callback)>> starts;
+                std::shared_ptr<state> shared_state = _state;
+                {
+                    std::unique_lock<std::mutex> guard(_state->mutex);
+                    _state->callback = callback;
+                    _state->started_at = std::chrono::steady_clock::now();
+                    _state->remaining = _state->members.size();
+                    for (auto & member: _state->members)
+                    {
+                        member.error = "timeout";
+                    }
+                    starts.swap(_starts);
+                }
+                if (starts.empty())
+                {
+                    _io_service.post([shared_state] ()
+                                     {
+                                         shared_state->complete();
+                                     });
+                    return;
+                }
+                _state->timer.expires_from_now(timeout);
+                _state->timer.async_wait([shared_state] (boost::system::error_code const & error)
+                                         {
+                                             if (::boost::asio::error::operation_aborted == error)
+                                             {
+                                                 return;
+                                             }
+                                             shared_state->complete();
+                                         });
+                std::weak_ptr<state> weak_state = _state;
+                for (std::size_t index = 0; index < starts.size(); ++index)
+                {
+                    starts[index]([weak_state, index] (std::string const & error)
+                                  {
+                                      // The group may be gone, the member keeps running
+                                      if (auto locked = weak_state.lock())
+                                      {
+                                          locked->report(index, error);
+                                      }
+                                  });
+                }
+            }
+
+
+            // Blocking version of start(). Do not call from io_service thread!
+            std::vector<member_status> wait(std::chrono::milliseconds timeout, bool * all_ready = nullptr)
+            {
+                std::mutex mutex;
+                std::unique_lock<std::mutex> guard(mutex);
+                std::condition_variable cv;
+                bool done{false};
+                std::vector<member_status> result;
+
+                start(timeout,
+                      [&] (bool ready, std::vector<member_status> const & members)
+                      {
+                          std::unique_lock<std::mutex> guard(mutex);
+                          result = members;
+                          if (all_ready)
+                          {
+                              *all_ready = ready;
+                          }
+                          done = true;
+                          cv.notify_one();
+                      });
+                cv.wait(guard, [&] () { return done; });
+                return result;
+            }
+
+
+        protected:
+
+            struct state
+            {
+                state(boost::asio::io_service & io_service):
+                    timer(io_service),
+                    remaining(0),
+                    completed(false)
+                {
+                }
+
+
+                void report(std::size_t index, std::string const & error)
+                {
+                    {
+                        std::unique_lock<std::mutex> guard(mutex);
+                        if (completed || members[index].ready)
+                        {
+                            return;
+                        }
+                        if (!error.empty())
+                        {
+                            members[index].error = error;
+                            return;
+                        }
+                        members[index].ready = true;
+                        members[index].error.clear();
+                        members[index].elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started_at);
+                        if (0 != --remaining)
+                        {
+                            return;
+                        }
+                    }
+                    timer.cancel();
+                    complete();
+                }
+
+
+                void complete()
+                {
+                    std::function<void (bool, std::vector<member_status> const &)> cb;
+                    std::vector<member_status> result;
+                    {
+                        std::unique_lock<std::mutex> guard(mutex);
+                        if (completed)
+                        {
+                            return;
+                        }
+                        completed = true;
+                        cb.swap(callback);
+                        result = members;
+                    }
+                    if (cb)
+                    {
+                        cb(0 == remaining, result);
+                    }
+                }
+
+
+                boost::asio::steady_timer timer;
+                std::mutex mutex;
+                std::vector<member_status> members;
+                std::function<void (bool, std::vector<member_status> const &)> callback;
+                std::chrono::steady_clock::time_point started_at;
+                std::size_t remaining;
+                bool completed;
+            };
+
+
+            // The commands are pipelined, the first error reply is reported.
+            static void execute_handshake(redis_connection & connection,
+                                          std::vector<std::vector<std::string>> const & handshake,
+                                          report_callback report)
+            {
+                if (handshake.empty())
+                {
+                    report("");
+                    return;
+                }
+                auto remaining = std::make_shared<std::atomic<std::size_t>>(handshake.size());
+                auto failed = std::make_shared<std::atomic<bool>>(false);
+                for (auto const & command: handshake)
+                {
+                    connection.execute_command([remaining, failed, report] (::nokia::net::proto::redis::reply && reply)
+                                               {
+                                                   if (::nokia::net::proto::redis::reply::ERROR == reply.type)
+                                                   {
+                                                       if (!failed->exchange(true))
+                                                       {
+                                                           report(reply.str);
+                                                       }
+                                                   }
+                                                   if (0 == --(*remaining) && !*failed)
+                                                   {
+                                                       report("");
+                                                   }
+                                               },
+                                               command);
+                }
+            }
+
+
+        private:
+
+            boost::asio::io_service & _io_service;
+            std::shared_ptr<state> _state;
+            std::vector<std::function<void (report_callback)>> _starts;
+        };
+
+    }
+}
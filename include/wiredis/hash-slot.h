@@ -0,0 +1,89 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        uint16_t const CLUSTER_SLOTS = 16384;
+
+
+        /*
+         * CRC16-CCITT (XMODEM) as redis cluster uses it for key hashing.
+         */
+        inline uint16_t crc16(char const * buffer, std::size_t size)
+        {
+            static std::array<uint16_t, 256> const table = [] ()
+                {
+                    std::array<uint16_t, 256> table;
+                    for (uint32_t i = 0; i < 256; ++i)
+                    {
+                        uint16_t crc = static_cast<uint16_t>(i << 8);
+                        for (int bit = 0; bit < 8; ++bit)
+                        {
+                            crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+                        }
+                        table[i] = crc;
+                    }
+                    return table;
+                }();
+
+            uint16_t crc{0};
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                crc = static_cast<uint16_t>((crc << 8) ^ table[((crc >> 8) ^ static_cast<uint8_t>(buffer[i])) & 0xff]);
+            }
+            return crc;
+        }
+
+
+        /*
+         * Finds the part of the key used for hashing: the content of the first non-empty {...}
+         * section, or the whole key if there's no such section.
+         * E.g. "{user1000}.following" and "{user1000}.followers" are hashed the same way.
+         */
+        inline void hash_tag(std::string const & key, std::size_t & start, std::size_t & length)
+        {
+            start = 0;
+            length = key.size();
+            std::size_t const open = key.find('{');
+            if (std::string::npos == open)
+            {
+                return;
+            }
+            std::size_t const close = key.find('}', open + 1);
+            if (std::string::npos == close || close == open + 1)
+            {
+                return;
+            }
+            start = open + 1;
+            length = close - open - 1;
+        }
+
+
+        inline std::string hash_tag(std::string const & key)
+        {
+            std::size_t start{0};
+            std::size_t length{0};
+            hash_tag(key, start, length);
+            return key.substr(start, length);
+        }
+
+
+        inline uint16_t hash_slot(std::string const & key)
+        {
+            std::size_t start{0};
+            std::size_t length{0};
+            hash_tag(key, start, length);
+            return crc16(key.data() + start, length) % CLUSTER_SLOTS;
+        }
+    }
+}
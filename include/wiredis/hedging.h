@@ -0,0 +1,105 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <wiredis/proto/redis.h>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * One idempotent request which may be sent on two connections.
+         *
+         * Every copy gets its own callback slot on its connection (see reply_handler()), so the
+         * replies are still matched in order there. The first reply is passed to the callback,
+         * the late one is dropped when it arrives.
+         */
+        class hedged_request: public std::enable_shared_from_this<hedged_request>
+        {
+        public:
+
+            /*
+             * io_service: runs the hedge timer.
+             */
+            hedged_request(boost::asio::io_service & io_service, std::function<void (::nokia::net::proto::redis::reply &&)> callback):
+                _io_service(io_service),
+                _timer(io_service),
+                _callback(std::move(callback)),
+                _done{false}
+            {
+            }
+
+
+            // Callback for one copy of the request
+            std::function<void (::nokia::net::proto::redis::reply &&)> reply_handler()
+            {
+                auto self = shared_from_this();
+                return [self] (::nokia::net::proto::redis::reply && reply)
+                    {
+                        if (self->_done.exchange(true))
+                        {
+                            // The other copy has already been replied.
+                            return;
+                        }
+                        auto callback = std::move(self->_callback);
+                        callback(std::move(reply));
+                    };
+            }
+
+
+            /*
+             * Calls resend() after the delay if there's no reply yet. resend() is called in the io_service thread
+             * and is expected to send the request again with a new reply_handler().
+             */
+            void hedge_after(std::chrono::microseconds delay, std::function<void ()> resend)
+            {
+                auto self = shared_from_this();
+                _io_service.dispatch([self, delay, resend] ()
+                                     {
+                                         if (self->_done)
+                                         {
+                                             return;
+                                         }
+                                         // Not cancelled on reply (it may come in another thread), the delay is short anyway.
+                                         self->_timer.expires_from_now(delay);
+                                         self->_timer.async_wait([self, resend] (boost::system::error_code const & error)
+                                                                 {
+                                                                     if (::boost::asio::error::operation_aborted == error || self->_done)
+                                                                     {
+                                                                         return;
+                                                                     }
+                                                                     resend();
+                                                                 });
+                                     });
+            }
+
+
+            bool done() const
+            {
+                return _done;
+            }
+
+
+        private:
+
+            boost::asio::io_service & _io_service;
+            boost::asio::steady_timer _timer;
+            std::function<void (::nokia::net::proto::redis::reply &&)> _callback;
+            std::atomic<bool> _done;
+        };
+
+    }
+}
@@ -0,0 +1,153 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Smoothed round-trip time of a connection (exponentially weighted moving average,
+         * the same way TCP estimates RTT: SRTT = 7/8 * SRTT + 1/8 * sample) and its variation
+         * (RTTVAR = 3/4 * RTTVAR + 1/4 * |SRTT - sample|).
+         *
+         * Percentiles are estimated from a log-linear histogram (4 buckets per doubling, so the error
+         * is below 25%). The counters are halved regularly, so the percentiles follow the recent samples.
+         */
+        class latency_tracker
+        {
+        public:
+
+            static std::size_t const BUCKETS = 128;
+            static uint64_t const DECAY_AFTER = 4096;   // halve the histogram after so many samples
+
+
+            latency_tracker():
+                _samples(0),
+                _average(0),
+                _deviation(0),
+                _histogram{},
+                _histogram_total(0)
+            {
+            }
+
+
+            void add(std::chrono::microseconds sample)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                ++_histogram[bucket(sample.count())];
+                if (++_histogram_total >= DECAY_AFTER)
+                {
+                    _histogram_total = 0;
+                    for (auto & counter: _histogram)
+                    {
+                        counter /= 2;
+                        _histogram_total += counter;
+                    }
+                }
+                if (0 == _samples++)
+                {
+                    _average = sample;
+                    _deviation = sample / 2;
+                    return;
+                }
+                std::chrono::microseconds const error = sample - _average;
+                _deviation += ((error.count() < 0 ? -error : error) - _deviation) / 4;
+                _average += error / 8;
+            }
+
+
+            /*
+             * E.g. percentile(0.95) is the running p95 (upper bound of its bucket).
+             * 0 if there's no sample yet.
+             */
+            std::chrono::microseconds percentile(double p) const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                if (0 == _histogram_total)
+                {
+                    return std::chrono::microseconds(0);
+                }
+                uint64_t const target = static_cast<uint64_t>(std::ceil(p * _histogram_total));
+                uint64_t count{0};
+                for (std::size_t i = 0; i < BUCKETS; ++i)
+                {
+                    count += _histogram[i];
+                    if (count >= target && 0 != count)
+                    {
+                        return std::chrono::microseconds(upper_bound(i));
+                    }
+                }
+                return std::chrono::microseconds(upper_bound(BUCKETS - 1));
+            }
+
+
+            // 0 if there's no sample yet
+            std::chrono::microseconds average() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _average;
+            }
+
+
+            // Mean deviation, 0 if there's no sample yet
+            std::chrono::microseconds deviation() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _deviation;
+            }
+
+
+            uint64_t samples() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _samples;
+            }
+
+
+        private:
+
+            // Values below 4 have their own buckets, above them the 2 bits after the highest set bit select the bucket.
+            static std::size_t bucket(int64_t value)
+            {
+                if (value < 4)
+                {
+                    return (value < 0) ? 0 : static_cast<std::size_t>(value);
+                }
+                int const msb = 63 - __builtin_clzll(static_cast<uint64_t>(value));
+                std::size_t const index = msb * 4 + ((value >> (msb - 2)) & 3);
+                return (index < BUCKETS) ? index : BUCKETS - 1;
+            }
+
+
+            static int64_t upper_bound(std::size_t index)
+            {
+                if (index < 8)
+                {
+                    return static_cast<int64_t>(index) + 1;
+                }
+                std::size_t const msb = index / 4;
+                std::size_t const sub = index % 4;
+                return static_cast<int64_t>(5 + sub) << (msb - 2);
+            }
+
+
+            mutable std::mutex _mutex;
+            uint64_t _samples;
+            std::chrono::microseconds _average;
+            std::chrono::microseconds _deviation;
+            std::array<uint64_t, BUCKETS> _histogram;
+            uint64_t _histogram_total;
+        };
+
+    }
+}
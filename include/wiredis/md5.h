@@ -0,0 +1,121 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * MD5 digest (RFC 1321). Used for key distribution only, not for security.
+         */
+        inline std::array<uint8_t, 16> md5(char const * buffer, std::size_t size)
+        {
+            static uint32_t const k[64] =
+                {
+                    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+                    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+                    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+                    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+                    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+                    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+                    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+                    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+                };
+            static unsigned const r[64] =
+                {
+                    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+                    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+                    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+                    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+                };
+
+            uint32_t h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+
+            // Message + 0x80 + zero padding + length in bits (little endian), multiple of 64 bytes
+            std::string message(buffer, size);
+            message += static_cast<char>(0x80);
+            while (56 != message.size() % 64)
+            {
+                message += '\0';
+            }
+            uint64_t const bits = static_cast<uint64_t>(size) * 8;
+            for (int i = 0; i < 8; ++i)
+            {
+                message += static_cast<char>((bits >> (8 * i)) & 0xff);
+            }
+
+            for (std::size_t offset = 0; offset < message.size(); offset += 64)
+            {
+                uint32_t w[16];
+                for (int i = 0; i < 16; ++i)
+                {
+                    uint8_t const * p = reinterpret_cast<uint8_t const *>(message.data() + offset + i * 4);
+                    w[i] = static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+                        (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+                }
+                uint32_t a = h[0];
+                uint32_t b = h[1];
+                uint32_t c = h[2];
+                uint32_t d = h[3];
+                for (unsigned i = 0; i < 64; ++i)
+                {
+                    uint32_t f;
+                    unsigned g;
+                    if (i < 16)
+                    {
+                        f = (b & c) | (~b & d);
+                        g = i;
+                    }
+                    else if (i < 32)
+                    {
+                        f = (d & b) | (~d & c);
+                        g = (5 * i + 1) % 16;
+                    }
+                    else if (i < 48)
+                    {
+                        f = b ^ c ^ d;
+                        g = (3 * i + 5) % 16;
+                    }
+                    else
+                    {
+                        f = c ^ (b | ~d);
+                        g = (7 * i) % 16;
+                    }
+                    uint32_t const rotated = a + f + k[i] + w[g];
+                    a = d;
+                    d = c;
+                    c = b;
+                    b = b + ((rotated << r[i]) | (rotated >> (32 - r[i])));
+                }
+                h[0] += a;
+                h[1] += b;
+                h[2] += c;
+                h[3] += d;
+            }
+
+            std::array<uint8_t, 16> digest;
+            for (int i = 0; i < 4; ++i)
+            {
+                for (int j = 0; j < 4; ++j)
+                {
+                    digest[i * 4 + j] = static_cast<uint8_t>((h[i] >> (8 * j)) & 0xff);
+                }
+            }
+            return digest;
+        }
+
+
+        inline std::array<uint8_t, 16> md5(std::string const & input)
+        {
+            return md5(input.data(), input.size());
+        }
+    }
+}
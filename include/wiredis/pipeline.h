@@ -0,0 +1,125 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Batch of commands encoded into one buffer, see redis_connection::execute_pipeline().
+         *
+         * The commands are encoded as they are added. clear() keeps the capacity, so a pipeline
+         * reused for the batches of similar size doesn't allocate.
+         *
+         * pipeline batch(64 * 1024);
+         * for (auto const & key: keys)
+         * {
+         *     batch.add("GET", key);
+         * }
+         */
+        class pipeline
+        {
+        public:
+
+            // reserved_bytes: capacity of the encode buffer
+            explicit pipeline(std::size_t reserved_bytes = 0):
+                _size(0)
+            {
+                _buffer.reserve(reserved_bytes);
+            }
+
+
+            template <typename... Ts>
+            pipeline & add(Ts &&... ts)
+            {
+                append_header('*', sizeof...(ts));
+                append_bulk_strings(ts...);
+                ++_size;
+                return *this;
+            }
+
+
+            pipeline & add_command(std::vector<std::string> const & command)
+            {
+                append_header('*', command.size());
+                for (auto const & argument: command)
+                {
+                    append_bulk_strings(argument);
+                }
+                ++_size;
+                return *this;
+            }
+
+
+            // Removes the commands, keeps the capacity.
+            void clear()
+            {
+                _buffer.clear();
+                _size = 0;
+            }
+
+
+            void reserve(std::size_t bytes)
+            {
+                _buffer.reserve(bytes);
+            }
+
+
+            // Number of commands
+            std::size_t size() const
+            {
+                return _size;
+            }
+
+
+            bool empty() const
+            {
+                return 0 == _size;
+            }
+
+
+            // The encoded commands
+            std::string const & buffer() const
+            {
+                return _buffer;
+            }
+
+
+        private:
+
+            void append_header(char type, std::size_t length)
+            {
+                _buffer += type;
+                _buffer += std::to_string(length);
+                _buffer += "\r\n";
+            }
+
+
+            void append_bulk_strings()
+            {
+            }
+
+
+            template <typename... Ts>
+            void append_bulk_strings(std::string const & t, Ts &&... ts)
+            {
+                append_header('$', t.size());
+                _buffer += t;
+                _buffer += "\r\n";
+                append_bulk_strings(ts...);
+            }
+
+
+            std::string _buffer;
+            std::size_t _size;
+        };
+
+    }
+}
@@ -4,6 +4,9 @@
  */
 #pragma once
 
+#include <cassert>
+#include <cstring>
+
 namespace nokia
 {
     namespace net
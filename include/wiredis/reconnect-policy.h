@@ -0,0 +1,102 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Delays of automatic reconnect.
+         *
+         * The first attempt after losing the connection is immediate (a restarted server is often
+         * back in milliseconds), then exponential backoff with decorrelated jitter:
+         * delay = min(cap, random(base, 3 * previous delay)). The jitter keeps the clients of
+         * the same server from retrying in lockstep.
+         */
+        class reconnect_policy
+        {
+        public:
+
+            reconnect_policy(std::chrono::milliseconds base = std::chrono::milliseconds(100),
+                             std::chrono::milliseconds cap = std::chrono::milliseconds(2000),
+                             bool immediate_first_attempt = true):
+                _base(std::max(base, std::chrono::milliseconds(1))),
+                _cap(std::max(cap, _base)),
+                _immediate_first_attempt(immediate_first_attempt),
+                _attempts(0),
+                _previous(0)
+            {
+                reset();
+            }
+
+
+            // Same delay every time, as it was before reconnect_policy
+            static reconnect_policy fixed(std::chrono::milliseconds delay)
+            {
+                return reconnect_policy(delay, delay, false);
+            }
+
+
+            // Restarts the backoff. Copies of a policy get different jitter after reset().
+            void reset()
+            {
+                _attempts = 0;
+                _previous = std::chrono::milliseconds(0);
+                _random.seed(std::random_device()());
+            }
+
+
+            // Delay before the next attempt
+            std::chrono::milliseconds next_delay()
+            {
+                ++_attempts;
+                if (1 == _attempts && _immediate_first_attempt)
+                {
+                    return std::chrono::milliseconds(0);
+                }
+                auto const upper = std::max(_base, std::min(_cap, _previous * 3));
+                std::uniform_int_distribution<int64_t> distribution(_base.count(), upper.count());
+                _previous = std::chrono::milliseconds(distribution(_random));
+                return _previous;
+            }
+
+
+            // Attempts since the last reset()
+            unsigned attempts() const
+            {
+                return _attempts;
+            }
+
+
+            std::chrono::milliseconds base() const
+            {
+                return _base;
+            }
+
+
+            std::chrono::milliseconds cap() const
+            {
+                return _cap;
+            }
+
+
+        private:
+
+            std::chrono::milliseconds _base;
+            std::chrono::milliseconds _cap;
+            bool _immediate_first_attempt;
+            unsigned _attempts;
+            std::chrono::milliseconds _previous;
+            std::minstd_rand _random;
+        };
+
+    }
+}
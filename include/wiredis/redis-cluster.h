@@ -0,0 +1,900 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <wiredis/commands.h>
+#include <wiredis/hash-slot.h>
+#include <wiredis/redis-connection.h>
+#include <wiredis/scatter.h>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Client of a redis cluster.
+         *
+         * The slot table is loaded by CLUSTER SLOTS (or CLUSTER SHARDS if the former isn't supported)
+         * and every command is sent to the primary serving the hash slot of its first key on
+         * a pipelined redis_connection. MOVED and ASK redirections are followed transparently.
+         *
+         * The topology is refreshed in the background (after MOVED, lost node connection or periodically),
+         * the new slot table replaces the old one at once, requests in flight are not affected.
+         */
+        class redis_cluster
+        {
+        public:
+
+            std::string const ERROR_CLUSTER_NOT_READY;
+            std::string const ERROR_TOO_MANY_REDIRECTIONS;
+
+            unsigned const MAX_REDIRECTIONS = 5;
+
+
+            redis_cluster(boost::asio::io_service & io_service):
+                ERROR_CLUSTER_NOT_READY{"CLUSTER NOT READY"},
+                ERROR_TOO_MANY_REDIRECTIONS{"TOO MANY REDIRECTIONS"},
+                _io_service(io_service),
+                _refresh_timer(io_service),
+                _refresh_interval(30000),
+                _retry_interval(1000),
+                _keepalive_enabled(true),
+                _running(false),
+                _ready(false),
+                _refreshing(false),
+                _next{0},
+                _retiring{0}
+            {
+            }
+
+
+            ~redis_cluster()
+            {
+            }
+
+
+            void set_log_callback(std::function<void (std::string const &)> cb)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _log_callback = cb;
+                for (auto & item: _nodes)
+                {
+                    item.second->connection->set_log_callback(cb);
+                }
+            }
+
+
+            // Every node loads the scripts on connect, see redis_connection::set_scripts().
+            void set_scripts(std::shared_ptr<script_registry> scripts)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _scripts = scripts;
+                for (auto & item: _nodes)
+                {
+                    item.second->connection->set_scripts(scripts);
+                }
+            }
+
+
+            /*
+             * interval: the topology is reloaded periodically even if there was no redirection (default: 30 seconds).
+             */
+            void set_refresh_interval(std::chrono::milliseconds interval)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _refresh_interval = interval;
+            }
+
+
+            /*
+             * seeds: ip/port of some cluster nodes, the topology is loaded from the first reachable one.
+             *
+             * connected_callback: called once the slot table is loaded.
+             *
+             * disconnected_callback: called if the connection of a node is lost. The node is reconnected
+             *     and the topology is reloaded automatically.
+             */
+            void connect(std::vector<std::pair<std::string, uint16_t>> const & seeds,
+                         std::function<void (boost::system::error_code const &)> connected_callback,
+                         std::function<void (boost::system::error_code const &)> disconnected_callback,
+                         bool keepalive_enabled = true)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _connected_callback = connected_callback;
+                _disconnected_callback = disconnected_callback;
+                _keepalive_enabled = keepalive_enabled;
+                _running = true;
+                for (auto const & seed: seeds)
+                {
+                    _seeds.push_back(get_node(seed.first, seed.second)->address);
+                }
+            }
+
+
+            void disconnect()
+            {
+                std::vector<std::shared_ptr<node>> nodes;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _running = false;
+                    _ready = false;
+                    _slots.clear();
+                    _primaries.clear();
+                    for (auto & item: _nodes)
+                    {
+                        nodes.push_back(item.second);
+                    }
+                }
+                _io_service.dispatch([this] ()
+                                     {
+                                         _refresh_timer.cancel();
+                                     });
+                for (auto & node: nodes)
+                {
+                    node->connection->disconnect();
+                    flush_waiting(node, false);
+                }
+            }
+
+
+            // True if the slot table is loaded
+            bool connected() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _ready;
+            }
+
+
+            // Connection of every primary, e.g. for scan_parallel(). Empty until the slot table is loaded.
+            std::vector<std::shared_ptr<redis_connection>> connections() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                std::vector<std::shared_ptr<redis_connection>> result;
+                for (auto const & primary: _primaries)
+                {
+                    result.push_back(primary->connection);
+                }
+                return result;
+            }
+
+
+            void join(std::function<void ()> cb)
+            {
+                std::vector<std::shared_ptr<node>> nodes;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    for (auto & item: _nodes)
+                    {
+                        nodes.push_back(item.second);
+                    }
+                }
+                if (nodes.empty())
+                {
+                    wait_for_retired(cb);
+                    return;
+                }
+                auto remaining = std::make_shared<std::atomic<std::size_t>>(nodes.size());
+                for (auto & node: nodes)
+                {
+                    node->connection->join([this, remaining, cb] ()
+                                           {
+                                               if (0 == --(*remaining))
+                                               {
+                                                   wait_for_retired(cb);
+                                               }
+                                           });
+                }
+            }
+
+
+            void sync_join()
+            {
+                // Blocking join. Do not call from io_service thread!
+                std::mutex mutex;
+                std::unique_lock<std::mutex> guard(mutex);
+                std::condition_variable cv;
+                bool done{false};
+
+                join([&] ()
+                     {
+                         std::unique_lock<std::mutex> guard(mutex);
+                         done = true;
+                         cv.notify_one();
+                     });
+                cv.wait(guard, [&] () { return done; });
+            }
+
+
+            template <typename... Ts>
+            void execute(std::function<void (::nokia::net::proto::redis::reply &&)> callback, Ts &&... ts)
+            {
+                execute_command(std::move(callback), std::vector<std::string>{std::forward<Ts>(ts)...});
+            }
+
+
+            /*
+             * The command is sent to the primary of the hash slot of its first key.
+             * Commands without key are sent to any of the primaries.
+             *
+             * MGET, MSET, DEL, UNLINK, EXISTS and TOUCH with keys of several hash slots are split by slot,
+             * the parts are sent in parallel and the callback gets the merged reply (in the original key order).
+             */
+            void execute_command(std::function<void (::nokia::net::proto::redis::reply &&)> callback, std::vector<std::string> command)
+            {
+                // Redis refuses keys of different slots even if they are served by the same node,
+                // so the command is split by slot.
+                std::vector<std::vector<std::string>> commands;
+                std::vector<uint16_t> slots;
+                auto scattered = scatter<uint16_t>(command, callback, hash_slot, commands, slots);
+                if (!scattered)
+                {
+                    send_command(std::move(callback), std::move(command));
+                    return;
+                }
+                for (std::size_t part = 0; part < commands.size(); ++part)
+                {
+                    send_command([scattered, part] (::nokia::net::proto::redis::reply && reply)
+                                 {
+                                     scattered->on_reply(part, std::move(reply));
+                                 },
+                                 std::move(commands[part]));
+                }
+            }
+
+
+            /*
+             * Reload the topology in the background.
+             */
+            void refresh()
+            {
+                std::shared_ptr<node> source;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if (!_running || _refreshing)
+                    {
+                        return;
+                    }
+                    source = pick_connected_node();
+                    if (!source)
+                    {
+                        // Triggered again once a node is connected.
+                        return;
+                    }
+                    _refreshing = true;
+                }
+                source->connection->execute([this, source] (::nokia::net::proto::redis::reply && reply)
+                                            {
+                                                on_topology(source, std::move(reply), false);
+                                            },
+                                            "CLUSTER", "SLOTS");
+            }
+
+
+        protected:
+
+            struct node
+            {
+                std::string address;
+                std::string ip;
+                uint16_t port;
+                std::shared_ptr<redis_connection> connection;
+                bool connected;
+                // Requests waiting for the connection to be established. Parameter: connected or failed.
+                std::vector<std::function<void (bool)>> waiting;
+            };
+
+
+            struct cluster_request
+            {
+                std::vector<std::string> command;
+                std::function<void (::nokia::net::proto::redis::reply &&)> callback;
+                unsigned redirections{0};
+            };
+
+
+            struct slot_range
+            {
+                uint16_t first;
+                uint16_t last;
+                std::string ip;
+                uint16_t port;
+            };
+
+
+            void send_command(std::function<void (::nokia::net::proto::redis::reply &&)> callback, std::vector<std::string> command)
+            {
+                std::shared_ptr<node> target = route(command);
+                if (!target)
+                {
+                    ::nokia::net::proto::redis::reply error_reply;
+                    error_reply.type = ::nokia::net::proto::redis::reply::ERROR;
+                    error_reply.str = ERROR_CLUSTER_NOT_READY;
+                    callback(std::move(error_reply));
+                    return;
+                }
+                auto request = std::make_shared<cluster_request>();
+                request->command = std::move(command);
+                request->callback = std::move(callback);
+                send(request, target, false);
+            }
+
+
+            // Must be called under lock
+            std::shared_ptr<node> get_node(std::string const & ip, uint16_t port)
+            {
+                std::string const address = ip + ":" + std::to_string(port);
+                auto it = _nodes.find(address);
+                if (_nodes.end() != it)
+                {
+                    return it->second;
+                }
+                auto new_node = std::make_shared<node>();
+                new_node->address = address;
+                new_node->ip = ip;
+                new_node->port = port;
+                new_node->connection = std::make_shared<redis_connection>(_io_service);
+                new_node->connected = false;
+                if (_log_callback)
+                {
+                    new_node->connection->set_log_callback(_log_callback);
+                }
+                new_node->connection->set_scripts(_scripts);
+                _nodes[address] = new_node;
+
+                std::weak_ptr<node> weak_node = new_node;
+                new_node->connection->connect(ip,
+                                              port,
+                                              [this, weak_node] (boost::system::error_code const & error)
+                                              {
+                                                  if (auto node = weak_node.lock())
+                                                  {
+                                                      on_node_connected(node, error);
+                                                  }
+                                              },
+                                              [this, weak_node] (boost::system::error_code const & error)
+                                              {
+                                                  if (auto node = weak_node.lock())
+                                                  {
+                                                      on_node_disconnected(node, error);
+                                                  }
+                                              },
+                                              true,
+                                              _keepalive_enabled);
+                return new_node;
+            }
+
+
+            // Must be called under lock
+            std::shared_ptr<node> pick_connected_node()
+            {
+                if (_nodes.empty())
+                {
+                    return nullptr;
+                }
+                // Start from a different node every time, so a broken node doesn't block the refresh.
+                std::size_t const start = _next++ % _nodes.size();
+                auto it = _nodes.begin();
+                std::advance(it, start);
+                for (std::size_t i = 0; i < _nodes.size(); ++i, ++it)
+                {
+                    if (_nodes.end() == it)
+                    {
+                        it = _nodes.begin();
+                    }
+                    if (it->second->connected)
+                    {
+                        return it->second;
+                    }
+                }
+                return nullptr;
+            }
+
+
+            std::shared_ptr<node> route(std::vector<std::string> const & command)
+            {
+                std::size_t const key_index = first_key_index(command);
+                std::unique_lock<std::mutex> guard(_mutex);
+                if (!_ready)
+                {
+                    return nullptr;
+                }
+                if (0 == key_index)
+                {
+                    return _primaries[_next++ % _primaries.size()];
+                }
+                return _slots[hash_slot(command[key_index])];
+            }
+
+
+            void send(std::shared_ptr<cluster_request> request, std::shared_ptr<node> target, bool asking)
+            {
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if (!target->connected)
+                    {
+                        target->waiting.emplace_back([this, request, target, asking] (bool connected)
+                                                     {
+                                                         if (!connected)
+                                                         {
+                                                             ::nokia::net::proto::redis::reply error_reply;
+                                                             error_reply.type = ::nokia::net::proto::redis::reply::ERROR;
+                                                             error_reply.str = target->connection->ERROR_TCP_CANNOT_SEND_MESSAGE;
+                                                             request->callback(std::move(error_reply));
+                                                             return;
+                                                         }
+                                                         send(request, target, asking);
+                                                     });
+                        return;
+                    }
+                }
+                auto callback = [this, request, target] (::nokia::net::proto::redis::reply && reply)
+                    {
+                        on_reply(request, target, std::move(reply));
+                    };
+                if (asking)
+                {
+                    target->connection->execute_asking(callback, request->command);
+                }
+                else
+                {
+                    target->connection->execute_command(callback, request->command);
+                }
+            }
+
+
+            void on_reply(std::shared_ptr<cluster_request> request, std::shared_ptr<node> source, ::nokia::net::proto::redis::reply && reply)
+            {
+                if (::nokia::net::proto::redis::reply::ERROR == reply.type)
+                {
+                    // -MOVED 3999 127.0.0.1:6381
+                    // -ASK 3999 127.0.0.1:6381
+                    bool const moved = (0 == reply.str.compare(0, 6, "MOVED "));
+                    bool const ask = (0 == reply.str.compare(0, 4, "ASK "));
+                    if (moved || ask)
+                    {
+                        redirect(request, source, reply, moved);
+                        return;
+                    }
+                }
+                request->callback(std::move(reply));
+            }
+
+
+            void redirect(std::shared_ptr<cluster_request> request, std::shared_ptr<node> source, ::nokia::net::proto::redis::reply & reply, bool moved)
+            {
+                std::size_t const slot_start = reply.str.find(' ') + 1;
+                std::size_t const address_start = reply.str.find(' ', slot_start);
+                std::size_t const port_start = reply.str.rfind(':');
+                if (std::string::npos == address_start || std::string::npos == port_start || port_start < address_start)
+                {
+                    ferror("redis-cluster error: invalid redirection. reply=%1%", reply.str);
+                    request->callback(std::move(reply));
+                    return;
+                }
+                if (++request->redirections > MAX_REDIRECTIONS)
+                {
+                    reply.str = ERROR_TOO_MANY_REDIRECTIONS;
+                    request->callback(std::move(reply));
+                    return;
+                }
+                uint16_t const slot = static_cast<uint16_t>(std::atoi(reply.str.c_str() + slot_start));
+                std::string ip = reply.str.substr(address_start + 1, port_start - address_start - 1);
+                uint16_t const port = static_cast<uint16_t>(std::atoi(reply.str.c_str() + port_start + 1));
+                if (ip.empty())
+                {
+                    // Unknown endpoint: same host as the node sent the redirection
+                    ip = source->ip;
+                }
+
+                std::shared_ptr<node> target;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if (!_running)
+                    {
+                        guard.unlock();
+                        reply.str = ERROR_CLUSTER_NOT_READY;
+                        request->callback(std::move(reply));
+                        return;
+                    }
+                    target = get_node(ip, port);
+                    if (moved && _ready && slot < _slots.size())
+                    {
+                        // Fix the slot now, the full table comes with the refresh.
+                        _slots[slot] = target;
+                    }
+                }
+                if (moved)
+                {
+                    refresh();
+                }
+                send(request, target, !moved);
+            }
+
+
+            void on_node_connected(std::shared_ptr<node> node, boost::system::error_code const & error)
+            {
+                if (error)
+                {
+                    ferror("redis-cluster error: cannot connect to node. address=%1%, reason=%2%", node->address, error.message());
+                    flush_waiting(node, false);
+                    return;
+                }
+                bool ready{false};
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    node->connected = true;
+                    ready = _ready;
+                }
+                flush_waiting(node, true);
+                if (!ready)
+                {
+                    refresh();
+                }
+            }
+
+
+            void on_node_disconnected(std::shared_ptr<node> node, boost::system::error_code const & error)
+            {
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    node->connected = false;
+                }
+                if (_disconnected_callback)
+                {
+                    _disconnected_callback(error);
+                }
+                refresh();
+            }
+
+
+            void flush_waiting(std::shared_ptr<node> node, bool connected)
+            {
+                std::vector<std::function<void (bool)>> waiting;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    waiting.swap(node->waiting);
+                }
+                for (auto & cb: waiting)
+                {
+                    cb(connected);
+                }
+            }
+
+
+            void on_topology(std::shared_ptr<node> source, ::nokia::net::proto::redis::reply && reply, bool shards)
+            {
+                std::vector<slot_range> ranges;
+                if (::nokia::net::proto::redis::reply::ERROR == reply.type && !shards && source->connection->ERROR_TCP_DISCONNECTED != reply.str)
+                {
+                    // CLUSTER SLOTS isn't supported, try the newer command.
+                    source->connection->execute([this, source] (::nokia::net::proto::redis::reply && reply)
+                                                {
+                                                    on_topology(source, std::move(reply), true);
+                                                },
+                                                "CLUSTER", "SHARDS");
+                    return;
+                }
+                bool const valid = shards ? parse_shards(reply, source->ip, ranges) : parse_slots(reply, source->ip, ranges);
+                if (!valid || ranges.empty())
+                {
+                    {
+                        std::unique_lock<std::mutex> guard(_mutex);
+                        _refreshing = false;
+                        if (!_running)
+                        {
+                            return;
+                        }
+                    }
+                    ferror("redis-cluster error: cannot load topology. address=%1%, reply=%2%", source->address, reply.str);
+                    schedule_refresh(_retry_interval);
+                    return;
+                }
+
+                bool first_load{false};
+                std::vector<std::shared_ptr<node>> unused_nodes;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _refreshing = false;
+                    if (!_running)
+                    {
+                        return;
+                    }
+                    std::vector<std::shared_ptr<node>> slots(CLUSTER_SLOTS);
+                    std::map<std::string, std::shared_ptr<node>> primaries;
+                    for (auto const & range: ranges)
+                    {
+                        std::shared_ptr<node> primary = get_node(range.ip, range.port);
+                        primaries[primary->address] = primary;
+                        for (uint32_t slot = range.first; slot <= range.last && slot < CLUSTER_SLOTS; ++slot)
+                        {
+                            slots[slot] = primary;
+                        }
+                    }
+                    _slots.swap(slots);
+                    _primaries.clear();
+                    for (auto & item: primaries)
+                    {
+                        _primaries.push_back(item.second);
+                    }
+
+                    // Nodes not serving any slot are closed once they don't have pending requests.
+                    for (auto it = _nodes.begin(); it != _nodes.end();)
+                    {
+                        bool const seed = (_seeds.end() != std::find(_seeds.begin(), _seeds.end(), it->first));
+                        if (seed || primaries.end() != primaries.find(it->first) || 0 != it->second->connection->pending_requests())
+                        {
+                            ++it;
+                            continue;
+                        }
+                        unused_nodes.push_back(it->second);
+                        it = _nodes.erase(it);
+                    }
+                    first_load = !_ready;
+                    _ready = true;
+                }
+                for (auto & node: unused_nodes)
+                {
+                    retire(node);
+                }
+                schedule_refresh(_refresh_interval);
+                if (first_load && _connected_callback)
+                {
+                    _connected_callback(boost::system::error_code());
+                }
+            }
+
+
+            /*
+             * 1) 1) (integer) 0
+             *    2) (integer) 5460
+             *    3) 1) "127.0.0.1"
+             *       2) (integer) 30001
+             *       3) "09dbe9720cda62f7865eabc5fd8857c5d2678366"
+             *    4) ... replicas
+             */
+            bool parse_slots(::nokia::net::proto::redis::reply const & topology, std::string const & source_ip, std::vector<slot_range> & ranges)
+            {
+                using ::nokia::net::proto::redis::reply;
+                if (reply::ARRAY != topology.type)
+                {
+                    return false;
+                }
+                for (auto const & item: topology.elements)
+                {
+                    if (reply::ARRAY != item.type || 3 > item.elements.size() ||
+                        reply::INTEGER != item.elements[0].type ||
+                        reply::INTEGER != item.elements[1].type ||
+                        reply::ARRAY != item.elements[2].type ||
+                        2 > item.elements[2].elements.size() ||
+                        reply::INTEGER != item.elements[2].elements[1].type)
+                    {
+                        return false;
+                    }
+                    std::string const & ip = item.elements[2].elements[0].str;
+                    ranges.push_back({static_cast<uint16_t>(item.elements[0].integer),
+                                      static_cast<uint16_t>(item.elements[1].integer),
+                                      ip.empty() || "?" == ip ? source_ip : ip,
+                                      static_cast<uint16_t>(item.elements[2].elements[1].integer)});
+                }
+                return true;
+            }
+
+
+            /*
+             * 1) 1) "slots"
+             *    2) 1) (integer) 0
+             *       2) (integer) 5460
+             *    3) "nodes"
+             *    4) 1)  1) "id"
+             *           2) "..."
+             *           3) "port"
+             *           4) (integer) 30001
+             *           5) "ip"
+             *           6) "127.0.0.1"
+             *           ...
+             *           x) "role"
+             *           y) "master"
+             */
+            bool parse_shards(::nokia::net::proto::redis::reply const & topology, std::string const & source_ip, std::vector<slot_range> & ranges)
+            {
+                using ::nokia::net::proto::redis::reply;
+                if (reply::ARRAY != topology.type)
+                {
+                    return false;
+                }
+                for (auto const & shard: topology.elements)
+                {
+                    if (reply::ARRAY != shard.type)
+                    {
+                        return false;
+                    }
+                    reply const * slots{nullptr};
+                    reply const * nodes{nullptr};
+                    for (std::size_t i = 0; i + 1 < shard.elements.size(); i += 2)
+                    {
+                        if ("slots" == shard.elements[i].str)
+                        {
+                            slots = &shard.elements[i + 1];
+                        }
+                        if ("nodes" == shard.elements[i].str)
+                        {
+                            nodes = &shard.elements[i + 1];
+                        }
+                    }
+                    if (nullptr == slots || nullptr == nodes)
+                    {
+                        return false;
+                    }
+                    std::string ip;
+                    uint16_t port{0};
+                    for (auto const & node: nodes->elements)
+                    {
+                        std::string node_ip;
+                        uint16_t node_port{0};
+                        bool primary{false};
+                        for (std::size_t i = 0; i + 1 < node.elements.size(); i += 2)
+                        {
+                            std::string const & field = node.elements[i].str;
+                            reply const & value = node.elements[i + 1];
+                            if ("ip" == field)
+                            {
+                                node_ip = value.str;
+                            }
+                            else if ("port" == field)
+                            {
+                                node_port = static_cast<uint16_t>(value.integer);
+                            }
+                            else if ("role" == field)
+                            {
+                                primary = ("master" == value.str);
+                            }
+                        }
+                        if (primary)
+                        {
+                            ip = node_ip.empty() || "?" == node_ip ? source_ip : node_ip;
+                            port = node_port;
+                        }
+                    }
+                    if (0 == port)
+                    {
+                        continue;
+                    }
+                    for (std::size_t i = 0; i + 1 < slots->elements.size(); i += 2)
+                    {
+                        ranges.push_back({static_cast<uint16_t>(slots->elements[i].integer),
+                                          static_cast<uint16_t>(slots->elements[i + 1].integer),
+                                          ip,
+                                          port});
+                    }
+                }
+                return true;
+            }
+
+
+            void schedule_refresh(std::chrono::milliseconds delay)
+            {
+                _io_service.dispatch([this, delay] ()
+                                     {
+                                         {
+                                             std::unique_lock<std::mutex> guard(_mutex);
+                                             if (!_running || 0 == delay.count())
+                                             {
+                                                 return;
+                                             }
+                                         }
+                                         _refresh_timer.expires_from_now(delay);
+                                         _refresh_timer.async_wait([this] (boost::system::error_code const & error)
+                                                                   {
+                                                                       if (::boost::asio::error::operation_aborted == error)
+                                                                       {
+                                                                           // Timer has been canceled.
+                                                                           return;
+                                                                       }
+                                                                       refresh();
+                                                                   });
+                                     });
+            }
+
+
+            void retire(std::shared_ptr<node> node)
+            {
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    ++_retiring;
+                }
+                node->connection->disconnect();
+                flush_waiting(node, false);
+                node->connection->join([this, node] ()
+                                       {
+                                           // Release the connection outside of its own callback.
+                                           _io_service.post([this, node] ()
+                                                            {
+                                                                std::vector<std::function<void ()>> join_callbacks;
+                                                                {
+                                                                    std::unique_lock<std::mutex> guard(_mutex);
+                                                                    if (0 == --_retiring)
+                                                                    {
+                                                                        join_callbacks.swap(_join_callbacks);
+                                                                    }
+                                                                }
+                                                                for (auto & cb: join_callbacks)
+                                                                {
+                                                                    cb();
+                                                                }
+                                                            });
+                                       });
+            }
+
+
+            void wait_for_retired(std::function<void ()> cb)
+            {
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if (0 != _retiring)
+                    {
+                        _join_callbacks.push_back(cb);
+                        return;
+                    }
+                }
+                // Join callbacks are called in the io_service thread, even if there is nothing to wait for.
+                _io_service.post(cb);
+            }
+
+
+            template <typename... Ts>
+            void ferror(Ts &&... ts)
+            {
+                std::string message = detail::concatenate(std::forward<Ts>(ts)...);
+                if (_log_callback)
+                {
+                    _log_callback(message);
+                }
+                else
+                {
+                    std::cerr << message << std::endl;
+                }
+            }
+
+
+        private:
+
+            boost::asio::io_service & _io_service;
+            boost::asio::steady_timer _refresh_timer;
+            std::chrono::milliseconds _refresh_interval;
+            std::chrono::milliseconds _retry_interval;
+
+            std::function<void (boost::system::error_code const &)> _connected_callback;
+            std::function<void (boost::system::error_code const &)> _disconnected_callback;
+            std::function<void (std::string const &)> _log_callback;
+            std::shared_ptr<script_registry> _scripts;
+            bool _keepalive_enabled;
+
+            mutable std::mutex _mutex;
+            bool _running;
+            bool _ready;
+            bool _refreshing;
+            std::vector<std::string> _seeds;
+            std::map<std::string, std::shared_ptr<node>> _nodes;      // every known node by "ip:port"
+            std::vector<std::shared_ptr<node>> _slots;                // primary of every hash slot
+            std::vector<std::shared_ptr<node>> _primaries;
+            std::size_t _next;
+            std::size_t _retiring;
+            std::vector<std::function<void ()>> _join_callbacks;
+        };
+
+    }
+}
@@ -7,9 +7,23 @@
             
 #include <deque>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
+#include <wiredis/circuit-breaker.h>
+#include <wiredis/commands.h>
+#include <wiredis/concurrency-limiter.h>
+#include <wiredis/latency.h>
+#include <wiredis/pipeline.h>
+#include <wiredis/reconnect-policy.h>
+#include <wiredis/script.h>
 #include <wiredis/tcp-connection.h>
+#include <wiredis/timing-wheel.h>
+#include <wiredis/transaction.h>
 #include <wiredis/proto/redis.h>
 #include <wiredis/log.h>
 
@@ -24,6 +38,13 @@ namespace nokia
 
             std::string const ERROR_TCP_DISCONNECTED;
             std::string const ERROR_TCP_CANNOT_SEND_MESSAGE;
+            std::string const ERROR_REQUEST_TIMEOUT;
+            std::string const ERROR_CIRCUIT_OPEN;
+            std::string const ERROR_CONCURRENCY_LIMIT;
+
+            // Returned by the execute functions for cancel(), NO_REQUEST if the callback has been called already.
+            typedef uint64_t request_id;
+            request_id const NO_REQUEST = 0;
 
             
             class subscription_already_exists: public std::runtime_error
@@ -49,224 +70,1787 @@ namespace nokia
             redis_connection(boost::asio::io_service & io_service):
                 ERROR_TCP_DISCONNECTED{"TCP DISCONNECTED"},
                 ERROR_TCP_CANNOT_SEND_MESSAGE{"TCP CANNOT SEND MESSAGE"},
+                ERROR_REQUEST_TIMEOUT{"REQUEST TIMEOUT"},
+                ERROR_CIRCUIT_OPEN{"CIRCUIT OPEN"},
+                ERROR_CONCURRENCY_LIMIT{"CONCURRENCY LIMIT REACHED"},
+                _io_service(io_service),
                 _tcp(io_service, 10240),
-                _pubsub_mode(false)
+                _wheel(boost::asio::use_service<timing_wheel>(io_service)),
+                _keepalive_enabled(true),
+                _connected(false),
+                _first_sequence(0),
+                _expired_in_flight(0),
+                _recycle_threshold(0),
+                _probe_interval(0),
+                _probe_min_timeout(0),
+                _probe_handle(0),
+                _probe_in_flight(false),
+                _max_lanes{0},
+                _watch_connected(false),
+                _watch_busy(false),
+                _completed_requests{0},
+                _timed_out_requests{0},
+                _shed_requests{0},
+                _request_timeout{0},
+                _pubsub_mode{false}
+            {
+            }
+
+
+            ~redis_connection()
+            {
+                // The wheel belongs to the io_service, it may outlive the connection. Handlers being
+                // called in other threads right now are waited for.
+                _wheel.cancel_all(this);
+            }
+
+
+            void set_log_callback(std::function<void (std::string const &)> cb)
+            {
+                _log_callback = cb;
+                for (auto & connection: side_connections(false))
+                {
+                    connection->set_log_callback(cb);
+                }
+            }
+
+
+            // See tcp_connection::set_reconnect_policy()
+            void set_reconnect_policy(reconnect_policy const & policy)
+            {
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _reconnect_policy = policy;
+                }
+                _tcp.set_reconnect_policy(policy);
+                for (auto & connection: side_connections(false))
+                {
+                    connection->set_reconnect_policy(policy);
+                }
+            }
+
+
+            // See tcp_connection::set_reconnect_hook()
+            void set_reconnect_hook(std::function<void (unsigned attempt, std::chrono::milliseconds delay)> hook)
+            {
+                _tcp.set_reconnect_hook(hook);
+            }
+
+
+            /*
+             * Timeout of the requests sent by execute(), execute_command() and execute_asking(), 0 (the default)
+             * means no timeout. A request not replied in time is called back with ERROR_REQUEST_TIMEOUT,
+             * its late reply is dropped when it arrives.
+             */
+            void set_request_timeout(std::chrono::milliseconds timeout)
+            {
+                _request_timeout = timeout.count();
+                for (auto & connection: side_connections(false))
+                {
+                    connection->set_request_timeout(timeout);
+                }
+            }
+
+
+            /*
+             * Reconnect once so many timed out requests are still waiting for their late reply, the server
+             * or the connection is probably stuck. The requests waiting for reply are called back with
+             * ERROR_TCP_DISCONNECTED. 0 (the default) means never.
+             */
+            void set_timeout_recycle_threshold(std::size_t timed_out_requests)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _recycle_threshold = timed_out_requests;
+            }
+
+
+            /*
+             * Sends PING after the connection has been idle (nothing waiting for reply, nothing
+             * received) for idle_interval. Its round-trip time is added to rtt(). If the reply is
+             * overdue, i.e. it's not got within SRTT + 4 * RTTVAR (but at least min_timeout), the
+             * server is considered stalled and the connection is reconnected, long before the
+             * kernel would notice it. idle_interval = 0 turns it off (default).
+             */
+            void set_health_probe(std::chrono::milliseconds idle_interval, std::chrono::milliseconds min_timeout = std::chrono::milliseconds(100))
+            {
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _probe_interval = idle_interval;
+                    _probe_min_timeout = min_timeout;
+                }
+                start_probe();
+                for (auto & connection: side_connections(false))
+                {
+                    connection->set_health_probe(idle_interval, min_timeout);
+                }
+            }
+
+
+            /*
+             * Requests are rejected right away with ERROR_CIRCUIT_OPEN while the breaker is open.
+             * The same breaker can be set on several connections (e.g. the members of a pool),
+             * then they open and close together. nullptr turns it off (default).
+             */
+            void set_circuit_breaker(std::shared_ptr<circuit_breaker> breaker)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _breaker = breaker;
+            }
+
+
+            /*
+             * Requests over the limit of the requests waiting for reply are rejected right away with
+             * ERROR_CONCURRENCY_LIMIT. The limiter can be shared by several connections, like the
+             * circuit breaker. nullptr turns it off (default).
+             */
+            void set_concurrency_limiter(std::shared_ptr<concurrency_limiter> limiter)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _limiter = limiter;
+            }
+
+
+            /*
+             * The scripts of the registry are loaded (SCRIPT LOAD) on every connect, before the connected
+             * callback, so execute_script() finds them by EVALSHA. nullptr turns it off (default).
+             */
+            void set_scripts(std::shared_ptr<script_registry> scripts)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _scripts = scripts;
+            }
+
+
+            /*
+             * Blocking commands (BLPOP, BRPOP, BLMOVE, XREAD BLOCK, ... see is_blocking()) are sent on separate
+             * connections to the same server (lanes), so they don't hold up the replies of the others. The
+             * lanes are connected when needed, at most max_lanes of them; a blocking command waits for a free
+             * lane. They can't be cancelled, and no client timeout applies to them (it would free the lane while
+             * the server still holds it), only their own timeout. The lanes get the other settings of the connection
+             * (log callback, reconnect policy, health probe, TLS). 0 turns it off (default). Call it before connect().
+             */
+            void set_blocking_lanes(std::size_t max_lanes)
+            {
+                _max_lanes = max_lanes;
+            }
+
+
+            // Number of lanes connected so far
+            std::size_t blocking_lanes() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _lanes.size();
+            }
+
+
+            // Round-trip times measured by the health probe, e.g. for routing
+            latency_tracker const & rtt() const
+            {
+                return _rtt;
+            }
+
+
+            // See tcp_connection::set_dns_cache_ttl()
+            void set_dns_cache_ttl(std::chrono::seconds ttl)
+            {
+                _tcp.set_dns_cache_ttl(ttl);
+            }
+
+
+#ifdef WIREDIS_ENABLE_TLS
+            // See tcp_connection::set_tls(). Call it before connect().
+            void set_tls(std::shared_ptr<boost::asio::ssl::context> context, bool session_resumption = true)
+            {
+                _tcp.set_tls(context, session_resumption);
+                _side_tls = [context, session_resumption] (redis_connection & connection)
+                    {
+                        connection.set_tls(context, session_resumption);
+                    };
+            }
+
+
+            bool tls_session_reused() const
+            {
+                return _tcp.tls_session_reused();
+            }
+#endif
+
+
+            void connect(std::string const & ip,
+                         uint16_t port,
+                         std::function<void (boost::system::error_code const &)> connected_callback,
+                         std::function<void (boost::system::error_code const &)> disconnected_callback,
+                         bool auto_reconnect = true,
+                         bool keepalive_enabled = true)
+            {
+                _ip = ip;
+                _port = port;
+                _keepalive_enabled = keepalive_enabled;
+                _connected_callback = connected_callback;
+                _disconnected_callback = disconnected_callback;
+                _tcp.connect(ip,
+                             port,
+                             std::bind(&redis_connection::on_connected, this, std::placeholders::_1),
+                             std::bind(&redis_connection::on_disconnected, this, std::placeholders::_1),
+                             std::bind(&redis_connection::on_read, this, std::placeholders::_1),
+                             auto_reconnect,
+                             keepalive_enabled);
+            }
+
+
+            /*
+             * Connect to the unixsocket of a local server, e.g. "/var/run/redis/redis.sock".
+             * Reconnect and replies work the same way as over TCP.
+             */
+            void connect_unix(std::string const & path,
+                              std::function<void (boost::system::error_code const &)> connected_callback,
+                              std::function<void (boost::system::error_code const &)> disconnected_callback,
+                              bool auto_reconnect = true)
+            {
+                _ip = path; // for the logs
+                _port = 0;
+                _connected_callback = connected_callback;
+                _disconnected_callback = disconnected_callback;
+                _tcp.connect_unix(path,
+                                  std::bind(&redis_connection::on_connected, this, std::placeholders::_1),
+                                  std::bind(&redis_connection::on_disconnected, this, std::placeholders::_1),
+                                  std::bind(&redis_connection::on_read, this, std::placeholders::_1),
+                                  auto_reconnect);
+            }
+
+
+            void disconnect()
+            {
+                _tcp.disconnect();
+                disconnect_lanes();
+                disconnect_watched();
+                // Requests already sent won't get any reply, don't leave them hanging.
+                _io_service.dispatch([this] ()
+                                     {
+                                         _connected_callback = nullptr;
+                                         _disconnected_callback = nullptr;
+                                         {
+                                             std::unique_lock<std::mutex> guard(_mutex);
+                                             _connected = false;
+                                             if (0 != _probe_handle)
+                                             {
+                                                 _wheel.cancel(_probe_handle);
+                                                 _probe_handle = 0;
+                                             }
+                                         }
+                                         notify_all_pending_requests(ERROR_TCP_DISCONNECTED);
+                                     });
+            }
+
+
+            /*
+             * Connect to another server right away, e.g. to the new master after failover.
+             * Requests waiting for reply are called back with ERROR_TCP_DISCONNECTED, they aren't resent
+             * because it isn't known whether the old server has executed them.
+             */
+            void repoint(std::string const & ip, uint16_t port)
+            {
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _connected = false;
+                }
+                _io_service.dispatch([this, ip, port] ()
+                                     {
+                                         _ip = ip;
+                                         _port = port;
+                                         _tcp.repoint(ip, port);
+                                         notify_all_pending_requests(ERROR_TCP_DISCONNECTED);
+                                     });
+                std::vector<std::shared_ptr<redis_connection>> connections;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    for (auto & item: _lanes)
+                    {
+                        connections.push_back(item->connection);
+                    }
+                    if (_watch_connection)
+                    {
+                        connections.push_back(_watch_connection);
+                    }
+                }
+                for (auto & connection: connections)
+                {
+                    connection->repoint(ip, port);
+                }
+            }
+
+
+            bool connected() const
+            {
+                return _tcp.connected();
+            }
+
+
+            // Number of requests waiting for reply (timed out ones included, until their late reply arrives)
+            std::size_t pending_requests()
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _op_callbacks.size();
+            }
+
+
+            // Number of bytes waiting to be sent
+            uint64_t pending_bytes()
+            {
+                return _tcp.send_buffer_size();
+            }
+
+
+            // Number of replies passed to request callbacks since the object was created
+            uint64_t completed_requests() const
+            {
+                return _completed_requests;
+            }
+
+
+            // Number of requests called back with ERROR_REQUEST_TIMEOUT since the object was created
+            uint64_t timed_out_requests() const
+            {
+                return _timed_out_requests;
+            }
+
+
+            // Number of timed out requests which weren't sent at all, since the object was created
+            uint64_t shed_requests() const
+            {
+                return _shed_requests;
+            }
+            
+
+            void join(std::function<void ()> cb)
+            {
+                auto connections = side_connections();
+                if (connections.empty())
+                {
+                    _tcp.join(cb);
+                    return;
+                }
+                auto remaining = std::make_shared<std::atomic<std::size_t>>(connections.size() + 1);
+                auto on_joined = [remaining, cb] ()
+                    {
+                        if (0 == --(*remaining))
+                        {
+                            cb();
+                        }
+                    };
+                for (auto & connection: connections)
+                {
+                    connection->join(on_joined);
+                }
+                _tcp.join(on_joined);
+            }
+
+            
+            void sync_join()
+            {
+                for (auto & connection: side_connections())
+                {
+                    connection->sync_join();
+                }
+                _tcp.sync_join();
+            }
+
+            
+            /*
+             * Can be called from any thread. Replies are passed to the callbacks in the io_service thread.
+             */
+            template <typename... Ts>
+            request_id execute(std::function<void (::nokia::net::proto::redis::reply &&)> callback, Ts &&... ts)
+            {
+                if (lanes_enabled())
+                {
+                    return execute_command(std::move(callback), std::vector<std::string>{std::forward<Ts>(ts)...}, request_timeout());
+                }
+                // todo [w] Throw exception if we are in pubsub mode and get non-proper command.
+                std::string message = "*" + std::to_string(sizeof...(ts)) + "\r\n";
+                append_bulk_string(message, ts...);
+                // std::cout << "message to be sent: " << message << std::endl;
+                return send_request(std::move(message), std::move(callback), request_timeout());
+            }
+
+
+            /*
+             * Same as execute() with the given timeout instead of the one of set_request_timeout().
+             */
+            template <typename... Ts>
+            request_id execute_with_timeout(std::chrono::milliseconds timeout, std::function<void (::nokia::net::proto::redis::reply &&)> callback, Ts &&... ts)
+            {
+                if (lanes_enabled())
+                {
+                    return execute_command(std::move(callback), std::vector<std::string>{std::forward<Ts>(ts)...}, timeout);
+                }
+                std::string message = "*" + std::to_string(sizeof...(ts)) + "\r\n";
+                append_bulk_string(message, ts...);
+                return send_request(std::move(message), std::move(callback), timeout);
+            }
+
+
+            /*
+             * Same as execute() but the command and its arguments are passed in a container.
+             */
+            request_id execute_command(std::function<void (::nokia::net::proto::redis::reply &&)> callback, std::vector<std::string> const & command)
+            {
+                return execute_command(std::move(callback), command, request_timeout());
+            }
+
+
+            request_id execute_command(std::function<void (::nokia::net::proto::redis::reply &&)> callback,
+                                       std::vector<std::string> const & command,
+                                       std::chrono::milliseconds timeout)
+            {
+                if (lanes_enabled() && is_blocking(command))
+                {
+                    execute_blocking(std::move(callback), command);
+                    return NO_REQUEST;
+                }
+                std::string message;
+                append_command(message, command);
+                return send_request(std::move(message), std::move(callback), timeout);
+            }
+
+
+            /*
+             * Sends ASKING and the command in one message, so no other command can get between them.
+             * Used on ASK redirection in cluster mode, the reply of ASKING isn't passed to the callback.
+             */
+            request_id execute_asking(std::function<void (::nokia::net::proto::redis::reply &&)> callback, std::vector<std::string> const & command)
+            {
+                std::string message;
+                append_command(message, {"ASKING"});
+                append_command(message, command);
+                std::function<void (::nokia::net::proto::redis::reply &&)> callbacks[] =
+                    {
+                        [] (::nokia::net::proto::redis::reply &&) {},
+                        std::move(callback)
+                    };
+                return send_requests(std::move(message), callbacks, 2, request_timeout());
+            }
+
+
+            /*
+             * Sends MULTI, the commands of the transaction and EXEC in one message. The callback is called
+             * once, with the reply of EXEC:
+             * - ARRAY: the results, one per command in order (a command failed at execution has its ERROR),
+             * - NIL: a watched key has changed, nothing has been executed (see execute_watched()),
+             * - ERROR: nothing has been executed. If the server has rejected a command (e.g. wrong number
+             *   of arguments), it's the error of the first rejected one, not the EXECABORT.
+             * The timeout is that of set_request_timeout().
+             */
+            request_id execute_transaction(transaction const & tx, std::function<void (::nokia::net::proto::redis::reply &&)> callback)
+            {
+                return execute_transaction(tx, std::move(callback), request_timeout());
+            }
+
+
+            request_id execute_transaction(transaction const & tx,
+                                           std::function<void (::nokia::net::proto::redis::reply &&)> callback,
+                                           std::chrono::milliseconds timeout)
+            {
+                std::string message;
+                append_command(message, {"MULTI"});
+                for (auto const & command: tx.commands())
+                {
+                    append_command(message, command);
+                }
+                append_command(message, {"EXEC"});
+                // The first error got for MULTI or a queued command
+                auto queue_error = std::make_shared<::nokia::net::proto::redis::reply>();
+                std::vector<std::function<void (::nokia::net::proto::redis::reply &&)>> callbacks(
+                    tx.size() + 1,
+                    [queue_error] (::nokia::net::proto::redis::reply && reply)
+                    {
+                        if (::nokia::net::proto::redis::reply::ERROR == reply.type &&
+                            ::nokia::net::proto::redis::reply::INVALID == queue_error->type)
+                        {
+                            *queue_error = std::move(reply);
+                        }
+                    });
+                callbacks.push_back([queue_error, callback] (::nokia::net::proto::redis::reply && reply)
+                    {
+                        if (::nokia::net::proto::redis::reply::ERROR == reply.type &&
+                            ::nokia::net::proto::redis::reply::INVALID != queue_error->type &&
+                            0 == reply.str.find("EXECABORT"))
+                        {
+                            callback(std::move(*queue_error));
+                            return;
+                        }
+                        callback(std::move(reply));
+                    });
+                return send_requests(std::move(message), callbacks.data(), callbacks.size(), timeout);
+            }
+
+
+            /*
+             * Optimistic locking: WATCH the keys, let the body build the transaction, then EXEC it. If a
+             * watched key has been changed meanwhile, it starts over after a backoff with jitter (5-100 ms).
+             *
+             * body: called after WATCH (again for every attempt). It may read the keys by execute(), then it
+             *     has to call commit() once with the transaction. An empty transaction just releases
+             *     the keys (UNWATCH), the callback gets an empty ARRAY then.
+             * callback: as for execute_transaction(). NIL if every attempt has met a concurrent change.
+             * max_attempts: number of EXECs at most.
+             *
+             * WATCH belongs to the connection, so WATCH and EXEC are sent on a separate connection to the
+             * same server (connected on first use), one watched transaction at a time; the others wait for
+             * it. If the body drops commit() without calling it, the keys are released and the callback
+             * gets an ERROR.
+             */
+            void execute_watched(std::vector<std::string> const & keys,
+                                 std::function<void (std::function<void (transaction const &)> commit)> body,
+                                 std::function<void (::nokia::net::proto::redis::reply &&)> callback,
+                                 unsigned max_attempts = 5)
+            {
+                auto watched = std::make_shared<watched_transaction>();
+                watched->keys = keys;
+                watched->body = std::move(body);
+                watched->callback = std::move(callback);
+                watched->attempts = 0;
+                watched->max_attempts = std::max(max_attempts, 1u);
+                queue_watched(watched);
+            }
+
+
+            /*
+             * Sends the commands of the pipeline in one message, with one callback for all of them. The
+             * replies are passed in the order of the commands. If the batch fails (ERROR_REQUEST_TIMEOUT,
+             * ERROR_TCP_DISCONNECTED, ...), every element is that error.
+             *
+             * The batch is one request for the timeout, cancel() and admission control, and it takes one
+             * place in the queue of requests waiting for reply. The pipeline isn't changed, so it can be
+             * cleared and reused.
+             */
+            request_id execute_pipeline(pipeline const & batch, std::function<void (std::vector<::nokia::net::proto::redis::reply> &&)> callback)
+            {
+                return execute_pipeline(batch, std::move(callback), request_timeout());
+            }
+
+
+            request_id execute_pipeline(pipeline const & batch,
+                                        std::function<void (std::vector<::nokia::net::proto::redis::reply> &&)> callback,
+                                        std::chrono::milliseconds timeout)
+            {
+                std::size_t const size = batch.size();
+                if (0 == size)
+                {
+                    callback(std::vector<::nokia::net::proto::redis::reply>());
+                    return NO_REQUEST;
+                }
+                std::function<void (::nokia::net::proto::redis::reply &&)> batch_callback =
+                    [size, callback] (::nokia::net::proto::redis::reply && reply)
+                    {
+                        if (::nokia::net::proto::redis::reply::ERROR == reply.type)
+                        {
+                            // Failed as a whole
+                            callback(std::vector<::nokia::net::proto::redis::reply>(size, reply));
+                            return;
+                        }
+                        // The replies are always wrapped, see on_read()
+                        callback(std::move(reply.elements));
+                    };
+                return send_requests(std::string(batch.buffer()), &batch_callback, 1, timeout, size);
+            }
+
+
+            /*
+             * Cancels a request, its callback won't be called. A request still in the send buffer is
+             * removed from there, so the server doesn't execute it. The reply of a request already sent
+             * is dropped when it arrives.
+             * Returns false if the callback has been (or is being) called already.
+             */
+            bool cancel(request_id id)
             {
+                std::function<void (::nokia::net::proto::redis::reply &&)> op_callback;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    uint64_t const sequence = id - 1;
+                    if (NO_REQUEST == id || sequence < _first_sequence || sequence - _first_sequence >= _op_callbacks.size())
+                    {
+                        return false;
+                    }
+                    pending_request & request = _op_callbacks[sequence - _first_sequence];
+                    if (!request.callback)
+                    {
+                        return false;
+                    }
+                    if (0 != request.deadline)
+                    {
+                        _wheel.cancel(request.deadline);
+                        request.deadline = 0;
+                    }
+                    // Destroyed out of the lock, it may hold anything
+                    op_callback = std::move(request.callback);
+                    request.callback = nullptr;
+                    request.cancelled = true;
+                    if (request.single && _tcp.cancel(request.message))
+                    {
+                        request.shed = true;
+                        pop_shed_requests();
+                    }
+                }
+                return true;
+            }
+
+            
+
+            void subscribe(std::string const & channel,
+                           std::function<void ()> subscribed_callback,
+                           std::function<void (std::string const & channel, std::string const & message)> change_callback,
+                           std::function<void ()> unsubscribed_callback)
+            {
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _pubsub_mode = true;
+
+                    if (_subs.end() != _subs.find(channel))
+                    {
+                        throw subscription_already_exists(channel);
+                    }
+
+                    _subs[channel] = std::make_shared<pubsub_callbacks>(subscribed_callback, change_callback, nullptr, unsubscribed_callback);
+                }
+                execute(std::bind(&redis_connection::on_subscribe_callback, this, std::placeholders::_1),
+                        "SUBSCRIBE", channel);
+            }
+
+
+            void unsubscribe(std::string const & channel)
+            {
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if (_subs.end() == _subs.find(channel))
+                    {
+                        throw subscription_does_not_exist(channel);
+                    }
+                }
+                execute(nullptr,
+                        "UNSUBSCRIBE", channel);
+            }
+            
+
+            void psubscribe(std::string const & pattern,
+                            std::function<void ()> subscribed_callback,
+                            std::function<void (std::string const & pattern, std::string const & channel, std::string const & message)> pattern_change_callback,
+                            std::function<void ()> unsubscribed_callback)
+            {
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _pubsub_mode = true;
+
+                    if (_subs.end() != _subs.find(pattern))
+                    {
+                        throw subscription_already_exists(pattern);
+                    }
+
+                    _subs[pattern] = std::make_shared<pubsub_callbacks>(subscribed_callback, nullptr, pattern_change_callback, unsubscribed_callback);
+                }
+                execute(std::bind(&redis_connection::on_subscribe_callback, this, std::placeholders::_1),
+                        "PSUBSCRIBE", pattern);
+            }
+
+
+            void punsubscribe(std::string const & pattern)
+            {
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if (_subs.end() == _subs.find(pattern))
+                    {
+                        throw subscription_does_not_exist(pattern);
+                    }
+                }
+                execute(nullptr, "PUNSUBSCRIBE", pattern);
+            }
+
+
+        private:
+
+            struct pubsub_callbacks;
+
+
+            struct admission_ticket
+            {
+                admission_ticket(std::shared_ptr<circuit_breaker> breaker, std::shared_ptr<concurrency_limiter> limiter):
+                    breaker(breaker),
+                    limiter(limiter),
+                    start(std::chrono::steady_clock::now()),
+                    done(false)
+                {
+                }
+
+
+                ~admission_ticket()
+                {
+                    if (done)
+                    {
+                        return;
+                    }
+                    if (limiter)
+                    {
+                        limiter->release();
+                    }
+                    if (breaker)
+                    {
+                        breaker->on_abandoned();
+                    }
+                }
+
+
+                // failed: no reply from the server
+                void complete(bool failed)
+                {
+                    done = true;
+                    if (limiter)
+                    {
+                        limiter->release(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start), failed);
+                    }
+                    if (breaker)
+                    {
+                        if (failed)
+                        {
+                            breaker->on_failure();
+                        }
+                        else
+                        {
+                            breaker->on_success();
+                        }
+                    }
+                }
+
+
+                std::shared_ptr<circuit_breaker> breaker;
+                std::shared_ptr<concurrency_limiter> limiter;
+                std::chrono::steady_clock::time_point start;
+                bool done;
+            };
+
+
+            // Connection of blocking commands, see set_blocking_lanes()
+            struct lane
+            {
+                std::shared_ptr<redis_connection> connection;
+                bool connected;
+                bool busy;          // a blocking command is in flight
+            };
+
+
+            struct blocking_request
+            {
+                std::vector<std::string> command;
+                std::function<void (::nokia::net::proto::redis::reply &&)> callback;
+            };
+
+
+            struct watched_transaction
+            {
+                std::vector<std::string> keys;
+                std::function<void (std::function<void (transaction const &)> commit)> body;
+                std::function<void (::nokia::net::proto::redis::reply &&)> callback;
+                unsigned attempts;
+                unsigned max_attempts;
+                reconnect_policy backoff{std::chrono::milliseconds(5), std::chrono::milliseconds(100), false};
+            };
+
+
+            // One attempt of a watched transaction, releases the watch connection if the body drops commit() uncalled.
+            struct watched_attempt
+            {
+                std::function<void ()> on_dropped;
+                bool committed;
+
+                ~watched_attempt()
+                {
+                    if (!committed)
+                    {
+                        on_dropped();
+                    }
+                }
+            };
+
+
+            struct closed_connection
+            {
+                std::shared_ptr<redis_connection> connection;
+                std::shared_ptr<std::atomic<bool>> joined;
+            };
+
+
+            struct pending_request
+            {
+                std::function<void (::nokia::net::proto::redis::reply &&)> callback;   // empty once timed out
+                timing_wheel::handle deadline;                                          // 0 if none
+                uint64_t message;                                                       // in the send buffer of _tcp
+                bool single;                                                            // the only request of its message
+                bool shed;                                                              // dropped unsent, won't be replied
+                bool cancelled;
+                std::size_t replies;                                                    // still expected
+                bool batched;                                                           // the replies are passed in one ARRAY
+                std::vector<::nokia::net::proto::redis::reply> batch;                  // replies got so far
+            };
+
+
+        protected:
+
+            template <typename... Ts>
+            void ferror(Ts &&... ts)
+            {
+                std::string message = detail::concatenate(std::forward<Ts>(ts)...);
+                if (_log_callback)
+                {
+                    _log_callback(message);
+                }
+                else
+                {
+                    std::cerr << message << std::endl;
+                }
+            }
+
+
+            void on_connected(boost::system::error_code const & error)
+            {
+                std::deque<pending_request> left;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _connected = !error;
+                    _pubsub_mode = false;
+                    _subs.clear();
+                    _last_reply_at = std::chrono::steady_clock::now();
+                    // Requests left from the previous connection (e.g. after a protocol error) won't get reply.
+                    // Taken under the same lock, so a request sent on the new connection isn't among them.
+                    left = take_pending_requests();
+                }
+                notify_pending_requests(left, ERROR_TCP_DISCONNECTED);
+                start_probe();
+                if (!error)
+                {
+                    load_scripts();
+                }
+
+                if (_connected_callback)
+                {
+                    _connected_callback(error);
+                }
+            }
+
+            
+            void on_disconnected(boost::system::error_code const & error)
+            {
+                ferror("redis-connection error: disconnected ungracefully. Notify all pending requests and reconnect. ip=%1%, port=%2%, reason=%3%", _ip, _port, error.message());
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _connected = false;
+                }
+                notify_all_pending_requests(ERROR_TCP_DISCONNECTED);
+                if (_disconnected_callback)
+                {
+                    _disconnected_callback(error);
+                }
+            }
+
+
+            void notify_all_pending_requests(std::string const & error_message)
+            {
+                std::deque<pending_request> op_callbacks;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    op_callbacks = take_pending_requests();
+                }
+                notify_pending_requests(op_callbacks, error_message);
+            }
+
+
+            // The caller holds _mutex.
+            std::deque<pending_request> take_pending_requests()
+            {
+                std::deque<pending_request> op_callbacks;
+                op_callbacks.swap(_op_callbacks);
+                _first_sequence += op_callbacks.size();
+                _expired_in_flight = 0;
+                return op_callbacks;
+            }
+
+
+            void notify_pending_requests(std::deque<pending_request> & op_callbacks, std::string const & error_message)
+            {
+                for (auto & request: op_callbacks)
+                {
+                    if (0 != request.deadline)
+                    {
+                        _wheel.cancel(request.deadline);
+                    }
+                    if (!request.callback)
+                    {
+                        // Timed out, it has already been called back.
+                        continue;
+                    }
+                    ::nokia::net::proto::redis::reply error_reply;
+                    error_reply.type = ::nokia::net::proto::redis::reply::ERROR;
+                    error_reply.str = error_message;
+                    request.callback(std::move(error_reply));
+                }
+            }
+
+
+            std::chrono::milliseconds request_timeout() const
+            {
+                return std::chrono::milliseconds(_request_timeout);
+            }
+
+
+            /*
+             * Called by the timing wheel. The request keeps its place in _op_callbacks without callback,
+             * so the late reply is matched and dropped.
+             */
+            void on_request_timeout(uint64_t sequence)
+            {
+                std::function<void (::nokia::net::proto::redis::reply &&)> op_callback;
+                bool recycle{false};
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    // Replied or called back on disconnect meanwhile
+                    if (sequence < _first_sequence || sequence - _first_sequence >= _op_callbacks.size())
+                    {
+                        return;
+                    }
+                    pending_request & request = _op_callbacks[sequence - _first_sequence];
+                    if (!request.callback)
+                    {
+                        // Shed or cancelled meanwhile
+                        return;
+                    }
+                    request.deadline = 0;
+                    op_callback = std::move(request.callback);
+                    request.callback = nullptr;
+                    ++_expired_in_flight;
+                    recycle = (0 != _recycle_threshold && _expired_in_flight >= _recycle_threshold);
+                }
+                ++_timed_out_requests;
+                ::nokia::net::proto::redis::reply error_reply;
+                error_reply.type = ::nokia::net::proto::redis::reply::ERROR;
+                error_reply.str = ERROR_REQUEST_TIMEOUT;
+                op_callback(std::move(error_reply));
+
+                if (recycle)
+                {
+                    ferror("redis-connection error: too many requests timed out without reply. Reconnecting. ip=%1%, port=%2%", _ip, _port);
+                    recycle_connection();
+                }
+            }
+
+
+            /*
+             * Reconnects without the disconnected callback (timeouts, protocol errors). The requests waiting
+             * for reply are called back right away, they won't get reply. They are taken under the same lock
+             * that stops new requests, so none of them can be sent on the new connection meanwhile.
+             */
+            void recycle_connection()
+            {
+                std::deque<pending_request> left;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _connected = false;
+                    left = take_pending_requests();
+                }
+                _tcp.reconnect();
+                notify_pending_requests(left, ERROR_TCP_DISCONNECTED);
+            }
+
+
+            bool lanes_enabled() const
+            {
+                return 0 != _max_lanes;
+            }
+
+
+            // Queues the command for the next free lane, connects a new lane if every one is busy.
+            void execute_blocking(std::function<void (::nokia::net::proto::redis::reply &&)> && callback,
+                                  std::vector<std::string> const & command)
+            {
+                bool queued{false};
+                std::shared_ptr<lane> created;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if (_connected)
+                    {
+                        _blocking_requests.push_back(blocking_request{command, std::move(callback)});
+                        queued = true;
+                        std::size_t available{0};
+                        for (auto const & item: _lanes)
+                        {
+                            available += item->busy ? 0 : 1;
+                        }
+                        if (available < _blocking_requests.size() && _lanes.size() < _max_lanes)
+                        {
+                            created = std::make_shared<lane>(lane{std::make_shared<redis_connection>(_io_service), false, false});
+                            _lanes.push_back(created);
+                        }
+                    }
+                }
+                if (!queued)
+                {
+                    fail_requests(&callback, 1, ERROR_TCP_CANNOT_SEND_MESSAGE);
+                    return;
+                }
+                if (created)
+                {
+                    connect_lane(created);
+                }
+                dispatch_blocking();
+            }
+
+
+            void connect_lane(std::shared_ptr<lane> const & target)
+            {
+                std::weak_ptr<lane> weak_lane(target);
+                connect_side_connection(target->connection,
+                                        [this, weak_lane] (boost::system::error_code const & error)
+                                        {
+                                            on_lane_connected(weak_lane.lock(), error);
+                                        },
+                                        [this, weak_lane] (boost::system::error_code const &)
+                                        {
+                                            auto target = weak_lane.lock();
+                                            if (target)
+                                            {
+                                                std::unique_lock<std::mutex> guard(_mutex);
+                                                target->connected = false;
+                                            }
+                                        });
+            }
+
+
+            // Connects a lane or the watch connection to the same server, with the settings of this connection
+            void connect_side_connection(std::shared_ptr<redis_connection> const & connection,
+                                         std::function<void (boost::system::error_code const &)> connected_callback,
+                                         std::function<void (boost::system::error_code const &)> disconnected_callback)
+            {
+                reconnect_policy policy;
+                std::chrono::milliseconds probe_interval;
+                std::chrono::milliseconds probe_min_timeout;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    policy = _reconnect_policy;
+                    probe_interval = _probe_interval;
+                    probe_min_timeout = _probe_min_timeout;
+                }
+                connection->set_log_callback(_log_callback);
+                connection->set_reconnect_policy(policy);
+                connection->set_request_timeout(request_timeout());
+                connection->set_health_probe(probe_interval, probe_min_timeout);
+                if (_side_tls)
+                {
+                    _side_tls(*connection);
+                }
+                if (0 == _port)
+                {
+                    connection->connect_unix(_ip, connected_callback, disconnected_callback);
+                }
+                else
+                {
+                    connection->connect(_ip, _port, connected_callback, disconnected_callback, true, _keepalive_enabled);
+                }
+            }
+
+
+            // Disconnects a lane or a watch connection, join() waits for it until it's released.
+            void close_side_connection(std::shared_ptr<redis_connection> const & connection)
+            {
+                auto joined = std::make_shared<std::atomic<bool>>(false);
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _closed.erase(std::remove_if(_closed.begin(),
+                                                 _closed.end(),
+                                                 [] (closed_connection const & item)
+                                                 {
+                                                     return item.joined->load();
+                                                 }),
+                                  _closed.end());
+                    _closed.push_back(closed_connection{connection, joined});
+                }
+                connection->disconnect();
+                auto & io_service = _io_service;
+                connection->join([joined, &io_service] ()
+                                 {
+                                     // After the handlers already queued for the connection
+                                     io_service.post([joined] ()
+                                                     {
+                                                         *joined = true;
+                                                     });
+                                 });
+            }
+
+
+            // closed: the disconnected ones too, e.g. for join()
+            std::vector<std::shared_ptr<redis_connection>> side_connections(bool closed = true) const
+            {
+                std::vector<std::shared_ptr<redis_connection>> connections;
+                std::unique_lock<std::mutex> guard(_mutex);
+                for (auto const & item: _lanes)
+                {
+                    connections.push_back(item->connection);
+                }
+                if (_watch_connection)
+                {
+                    connections.push_back(_watch_connection);
+                }
+                for (auto const & item: _closed)
+                {
+                    if (closed)
+                    {
+                        connections.push_back(item.connection);
+                    }
+                }
+                return connections;
+            }
+
+
+            void on_lane_connected(std::shared_ptr<lane> target, boost::system::error_code const & error)
+            {
+                if (!target)
+                {
+                    return;
+                }
+                std::deque<blocking_request> failed;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    target->connected = !error;
+                    // Nothing to wait for if no lane works, the lanes keep reconnecting anyway.
+                    bool any_connected{false};
+                    for (auto const & item: _lanes)
+                    {
+                        any_connected = any_connected || item->connected;
+                    }
+                    if (!any_connected)
+                    {
+                        failed.swap(_blocking_requests);
+                    }
+                }
+                for (auto & request: failed)
+                {
+                    fail_requests(&request.callback, 1, ERROR_TCP_CANNOT_SEND_MESSAGE);
+                }
+                dispatch_blocking();
+            }
+
+
+            // Sends the waiting blocking commands to the free lanes, one per lane.
+            void dispatch_blocking()
+            {
+                std::vector<std::pair<std::shared_ptr<lane>, blocking_request>> ready;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    for (auto & item: _lanes)
+                    {
+                        if (_blocking_requests.empty())
+                        {
+                            break;
+                        }
+                        if (item->connected && !item->busy)
+                        {
+                            item->busy = true;
+                            ready.emplace_back(item, std::move(_blocking_requests.front()));
+                            _blocking_requests.pop_front();
+                        }
+                    }
+                }
+                // No client timeout: the lane is held by the server until the command's own timeout, it's
+                // freed only by the reply or the disconnect.
+                for (auto & item: ready)
+                {
+                    std::shared_ptr<lane> target = item.first;
+                    auto callback = std::move(item.second.callback);
+                    target->connection->execute_command([this, target, callback] (::nokia::net::proto::redis::reply && reply)
+                                                        {
+                                                            {
+                                                                std::unique_lock<std::mutex> guard(_mutex);
+                                                                target->busy = false;
+                                                            }
+                                                            callback(std::move(reply));
+                                                            dispatch_blocking();
+                                                        },
+                                                        item.second.command,
+                                                        std::chrono::milliseconds(0));
+                }
             }
 
 
-            ~redis_connection()
+            // New lanes are connected after the next connect().
+            void disconnect_lanes()
             {
+                std::vector<std::shared_ptr<lane>> lanes;
+                std::deque<blocking_request> waiting;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    lanes.swap(_lanes);
+                    for (auto & item: lanes)
+                    {
+                        item->connected = false;
+                    }
+                    waiting.swap(_blocking_requests);
+                }
+                for (auto & item: lanes)
+                {
+                    close_side_connection(item->connection);
+                }
+                for (auto & request: waiting)
+                {
+                    fail_requests(&request.callback, 1, ERROR_TCP_DISCONNECTED);
+                }
             }
 
 
-            void set_log_callback(std::function<void (std::string const &)> cb)
+            // Pipelined, ahead of every request sent from the connected callback
+            void load_scripts()
             {
-                _log_callback = cb;
+                std::shared_ptr<script_registry> scripts;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    scripts = _scripts;
+                }
+                if (!scripts)
+                {
+                    return;
+                }
+                std::string message;
+                std::vector<std::function<void (::nokia::net::proto::redis::reply &&)>> callbacks;
+                for (auto const & lua: scripts->scripts())
+                {
+                    append_command(message, {"SCRIPT", "LOAD", lua->body()});
+                    callbacks.push_back([this, lua] (::nokia::net::proto::redis::reply && reply)
+                                        {
+                                            if (::nokia::net::proto::redis::reply::ERROR == reply.type)
+                                            {
+                                                ferror("redis-connection error: cannot load script. ip=%1%, port=%2%, sha=%3%, error=%4%", _ip, _port, lua->sha(), reply.str);
+                                            }
+                                        });
+                }
+                if (!callbacks.empty())
+                {
+                    enqueue_requests(std::move(message), callbacks.data(), callbacks.size(), std::chrono::milliseconds(0));
+                }
             }
 
 
-            void connect(std::string const & ip,
-                         uint16_t port,
-                         std::function<void (boost::system::error_code const &)> connected_callback,
-                         std::function<void (boost::system::error_code const &)> disconnected_callback,
-                         bool auto_reconnect = true,
-                         bool keepalive_enabled = true)
+            // Connects the watch connection on first use
+            void queue_watched(std::shared_ptr<watched_transaction> const & watched)
             {
-                _ip = ip;
-                _port = port;
-                _connected_callback = connected_callback;
-                _disconnected_callback = disconnected_callback;
-                _tcp.connect(ip,
-                             port,
-                             std::bind(&redis_connection::on_connected, this, std::placeholders::_1),
-                             std::bind(&redis_connection::on_disconnected, this, std::placeholders::_1),
-                             std::bind(&redis_connection::on_read, this, std::placeholders::_1),
-                             auto_reconnect,
-                             keepalive_enabled);
+                std::shared_ptr<redis_connection> created;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if (_connected)
+                    {
+                        _watched.push_back(watched);
+                        if (!_watch_connection)
+                        {
+                            created = std::make_shared<redis_connection>(_io_service);
+                            _watch_connection = created;
+                            _watch_connected = false;
+                            _watch_busy = false;
+                        }
+                    }
+                    else
+                    {
+                        guard.unlock();
+                        fail_requests(&watched->callback, 1, ERROR_TCP_CANNOT_SEND_MESSAGE);
+                        return;
+                    }
+                }
+                if (created)
+                {
+                    connect_side_connection(created,
+                                            [this, created] (boost::system::error_code const & error)
+                                            {
+                                                on_watch_connected(created, error);
+                                            },
+                                            [this, created] (boost::system::error_code const &)
+                                            {
+                                                std::unique_lock<std::mutex> guard(_mutex);
+                                                if (created == _watch_connection)
+                                                {
+                                                    _watch_connected = false;
+                                                }
+                                            });
+                }
+                run_watched();
             }
 
-            
-            void disconnect()
+
+            void on_watch_connected(std::shared_ptr<redis_connection> const & connection, boost::system::error_code const & error)
             {
-                _tcp.disconnect();
-                _connected_callback = nullptr;
-                _disconnected_callback = nullptr;
+                std::deque<std::shared_ptr<watched_transaction>> failed;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if (connection != _watch_connection)
+                    {
+                        return;
+                    }
+                    _watch_connected = !error;
+                    if (error)
+                    {
+                        // It keeps reconnecting, nothing waits for it meanwhile.
+                        failed.swap(_watched);
+                    }
+                }
+                for (auto & item: failed)
+                {
+                    fail_requests(&item->callback, 1, ERROR_TCP_CANNOT_SEND_MESSAGE);
+                }
+                run_watched();
             }
 
 
-            bool connected() const
+            // Starts the next watched transaction unless one is in progress
+            void run_watched()
             {
-                return _tcp.connected();
+                std::shared_ptr<watched_transaction> watched;
+                std::shared_ptr<redis_connection> connection;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if (_watch_busy || !_watch_connected || _watched.empty())
+                    {
+                        return;
+                    }
+                    _watch_busy = true;
+                    watched = _watched.front();
+                    _watched.pop_front();
+                    connection = _watch_connection;
+                }
+                watch_and_execute(connection, watched);
             }
-            
 
-            void join(std::function<void ()> cb)
+
+            // The attempt is over, the next watched transaction can be started.
+            void release_watch_connection(std::shared_ptr<redis_connection> const & connection)
             {
-                _tcp.join(cb);
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if (connection != _watch_connection)
+                    {
+                        // Disconnected meanwhile
+                        return;
+                    }
+                    _watch_busy = false;
+                }
+                run_watched();
             }
 
-            
-            void sync_join()
+
+            void finish_watched(std::shared_ptr<redis_connection> const & connection,
+                                std::shared_ptr<watched_transaction> const & watched,
+                                ::nokia::net::proto::redis::reply && reply)
             {
-                _tcp.sync_join();
+                release_watch_connection(connection);
+                watched->callback(std::move(reply));
             }
 
-            
-            template <typename... Ts>
-            void execute(std::function<void (::nokia::net::proto::redis::reply &&)> callback, Ts &&... ts)
+
+            void watch_and_execute(std::shared_ptr<redis_connection> connection, std::shared_ptr<watched_transaction> watched)
             {
-                // todo [w] Throw exception if we are in pubsub mode and get non-proper command.
-                // todo [w] Guard the _op_callbacks. Right now it's not an issue, since all redis
-                //          related calls are coming from io_service, but that would be the
-                //          generic solution.
+                std::vector<std::string> watch{"WATCH"};
+                watch.insert(watch.end(), watched->keys.begin(), watched->keys.end());
+                connection->execute_command([this, connection, watched] (::nokia::net::proto::redis::reply && reply)
+                                            {
+                                                if (::nokia::net::proto::redis::reply::ERROR == reply.type)
+                                                {
+                                                    finish_watched(connection, watched, std::move(reply));
+                                                    return;
+                                                }
+                                                ++watched->attempts;
+                                                auto attempt = std::make_shared<watched_attempt>();
+                                                attempt->committed = false;
+                                                attempt->on_dropped = [this, connection, watched] ()
+                                                    {
+                                                        connection->execute([] (::nokia::net::proto::redis::reply &&) {}, "UNWATCH");
+                                                        ::nokia::net::proto::redis::reply error;
+                                                        error.type = ::nokia::net::proto::redis::reply::ERROR;
+                                                        error.str = "ERR transaction not committed";
+                                                        finish_watched(connection, watched, std::move(error));
+                                                    };
+                                                watched->body([this, connection, watched, attempt] (transaction const & tx)
+                                                              {
+                                                                  if (attempt->committed)
+                                                                  {
+                                                                      return;
+                                                                  }
+                                                                  attempt->committed = true;
+                                                                  commit_watched(connection, watched, tx);
+                                                              });
+                                            },
+                                            watch);
+            }
+
 
-                if (!_tcp.connected())
+            void commit_watched(std::shared_ptr<redis_connection> const & connection,
+                                std::shared_ptr<watched_transaction> const & watched,
+                                transaction const & tx)
+            {
+                if (tx.empty())
                 {
-                    ::nokia::net::proto::redis::reply error_reply;
-                    error_reply.type = ::nokia::net::proto::redis::reply::ERROR;
-                    error_reply.str = ERROR_TCP_CANNOT_SEND_MESSAGE;
-                    callback(std::move(error_reply));
+                    // Queued ahead of the WATCH of the next one, its reply isn't waited for.
+                    connection->execute([] (::nokia::net::proto::redis::reply &&) {}, "UNWATCH");
+                    ::nokia::net::proto::redis::reply empty;
+                    empty.type = ::nokia::net::proto::redis::reply::ARRAY;
+                    finish_watched(connection, watched, std::move(empty));
                     return;
                 }
-                
-                std::string message = "*" + std::to_string(sizeof...(ts)) + "\r\n";
-                append_bulk_string(message, ts...);
-                // std::cout << "message to be sent: " << message << std::endl;
-                if (nullptr != callback)
+                connection->execute_transaction(tx,
+                                                [this, connection, watched] (::nokia::net::proto::redis::reply && reply)
+                                                {
+                                                    if (::nokia::net::proto::redis::reply::NIL != reply.type ||
+                                                        watched->attempts >= watched->max_attempts)
+                                                    {
+                                                        finish_watched(connection, watched, std::move(reply));
+                                                        return;
+                                                    }
+                                                    // Others may go meanwhile
+                                                    release_watch_connection(connection);
+                                                    retry_watched(watched);
+                                                });
+            }
+
+
+            void retry_watched(std::shared_ptr<watched_transaction> watched)
+            {
+                // Cancelled by the destructor
+                _wheel.schedule(std::max(watched->backoff.next_delay(), timing_wheel::TICK),
+                                [this, watched] ()
+                                {
+                                    queue_watched(watched);
+                                },
+                                this);
+            }
+
+
+            // Watched transactions in progress are called back by their own connection.
+            void disconnect_watched()
+            {
+                std::shared_ptr<redis_connection> connection;
+                std::deque<std::shared_ptr<watched_transaction>> waiting;
                 {
-                    // unsubscribe commands are handled different
-                    _op_callbacks.emplace_back(callback);
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    connection.swap(_watch_connection);
+                    _watch_connected = false;
+                    waiting.swap(_watched);
                 }
-                try
+                if (connection)
                 {
-                    _tcp.send(std::move(message));
+                    close_side_connection(connection);
                 }
-                catch (std::exception const & ex)
+                for (auto & item: waiting)
                 {
-                    if (nullptr != callback)
-                    {
-                        ::nokia::net::proto::redis::reply error_reply;
-                        error_reply.type = ::nokia::net::proto::redis::reply::ERROR;
-                        error_reply.str = ex.what();
-                        auto & op_callback = _op_callbacks.back();
-                        op_callback(std::move(error_reply));
-                        _op_callbacks.pop_back();
-                    }
-
+                    fail_requests(&item->callback, 1, ERROR_TCP_DISCONNECTED);
                 }
             }
 
-            
 
-            void subscribe(std::string const & channel,
-                           std::function<void ()> subscribed_callback,
-                           std::function<void (std::string const & channel, std::string const & message)> change_callback,
-                           std::function<void ()> unsubscribed_callback)
+            void start_probe()
             {
-                _pubsub_mode = true;
-                
-                if (_subs.end() != _subs.find(channel))
+                std::unique_lock<std::mutex> guard(_mutex);
+                if (0 == _probe_interval.count() || 0 != _probe_handle || _probe_in_flight || !_connected)
                 {
-                    throw subscription_already_exists(channel);
+                    return;
                 }
-                
-                _subs[channel] = { subscribed_callback, change_callback, nullptr, unsubscribed_callback } ;
-                execute(std::bind(&redis_connection::on_subscribe_callback, this, std::placeholders::_1),
-                        "SUBSCRIBE", channel);
+                _probe_handle = _wheel.schedule(_probe_interval,
+                                                [this] ()
+                                                {
+                                                    on_probe_timer();
+                                                },
+                                                this);
             }
 
 
-            void unsubscribe(std::string const & channel)
+            void on_probe_timer()
             {
-                if (_subs.end() == _subs.find(channel))
+                std::chrono::milliseconds timeout;
                 {
-                    throw subscription_does_not_exist(channel);
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _probe_handle = 0;
+                    if (0 == _probe_interval.count() || !_connected)
+                    {
+                        // Started again on connect
+                        return;
+                    }
+                    auto const idle = std::chrono::steady_clock::now() - _last_reply_at;
+                    if (!_op_callbacks.empty() || idle < _probe_interval)
+                    {
+                        // The connection is in use, its replies show it's alive.
+                        _probe_handle = _wheel.schedule(std::max(std::chrono::duration_cast<std::chrono::milliseconds>(_probe_interval - idle),
+                                                                 timing_wheel::TICK),
+                                                        [this] ()
+                                                        {
+                                                            on_probe_timer();
+                                                        },
+                                                        this);
+                        return;
+                    }
+                    _probe_in_flight = true;
+                    // Never 0, that would mean no timeout (e.g. min_timeout 0 and no RTT sample yet)
+                    timeout = std::max({_probe_min_timeout,
+                                        std::chrono::duration_cast<std::chrono::milliseconds>(_rtt.average() + 4 * _rtt.deviation()),
+                                        std::chrono::milliseconds(timing_wheel::TICK)});
                 }
-                execute(nullptr,
-                        "UNSUBSCRIBE", channel);
+                auto const start = std::chrono::steady_clock::now();
+                std::string message;
+                append_command(message, {"PING"});
+                // Not subject to admission control: it's what tells whether the server is alive.
+                std::function<void (::nokia::net::proto::redis::reply &&)> callback =
+                    [this, start] (::nokia::net::proto::redis::reply && reply)
+                    {
+                        {
+                            std::unique_lock<std::mutex> guard(_mutex);
+                            _probe_in_flight = false;
+                        }
+                        if (::nokia::net::proto::redis::reply::ERROR == reply.type)
+                        {
+                            if (ERROR_REQUEST_TIMEOUT == reply.str)
+                            {
+                                ferror("redis-connection error: health probe is not replied in time. Reconnecting. ip=%1%, port=%2%", _ip, _port);
+                                recycle_connection();
+                                return;
+                            }
+                            if (ERROR_TCP_DISCONNECTED == reply.str || ERROR_TCP_CANNOT_SEND_MESSAGE == reply.str)
+                            {
+                                // Started again on connect
+                                return;
+                            }
+                        }
+                        // Even an error reply (e.g. NOAUTH) shows the server is alive.
+                        _rtt.add(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+                        start_probe();
+                    };
+                enqueue_requests(std::move(message), &callback, 1, timeout);
             }
-            
 
-            void psubscribe(std::string const & pattern,
-                            std::function<void ()> subscribed_callback,
-                            std::function<void (std::string const & pattern, std::string const & channel, std::string const & message)> pattern_change_callback,
-                            std::function<void ()> unsubscribed_callback)
+
+            /*
+             * Called by the tcp connection for a message dropped without sending, because its deadline
+             * had passed. Its requests won't get any reply, so they leave _op_callbacks.
+             */
+            void on_requests_shed(uint64_t first_sequence, std::size_t count)
             {
-                _pubsub_mode = true;
-                
-                if (_subs.end() != _subs.find(pattern))
+                std::vector<std::function<void (::nokia::net::proto::redis::reply &&)>> op_callbacks;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    for (uint64_t sequence = first_sequence; sequence < first_sequence + count; ++sequence)
+                    {
+                        if (sequence < _first_sequence || sequence - _first_sequence >= _op_callbacks.size())
+                        {
+                            // Notified on disconnect meanwhile
+                            continue;
+                        }
+                        pending_request & request = _op_callbacks[sequence - _first_sequence];
+                        if (0 != request.deadline)
+                        {
+                            _wheel.cancel(request.deadline);
+                            request.deadline = 0;
+                        }
+                        if (request.callback)
+                        {
+                            op_callbacks.push_back(std::move(request.callback));
+                            request.callback = nullptr;
+                        }
+                        else if (!request.shed && !request.cancelled)
+                        {
+                            // Timed out already, no late reply will come.
+                            --_expired_in_flight;
+                        }
+                        request.shed = true;
+                    }
+                    pop_shed_requests();
+                }
+                _shed_requests += count;
+                _timed_out_requests += op_callbacks.size();
+                for (auto & op_callback: op_callbacks)
                 {
-                    throw subscription_already_exists(pattern);
+                    ::nokia::net::proto::redis::reply error_reply;
+                    error_reply.type = ::nokia::net::proto::redis::reply::ERROR;
+                    error_reply.str = ERROR_REQUEST_TIMEOUT;
+                    op_callback(std::move(error_reply));
                 }
-                
-                _subs[pattern] = { subscribed_callback, nullptr, pattern_change_callback, unsubscribed_callback } ;
-                execute(std::bind(&redis_connection::on_subscribe_callback, this, std::placeholders::_1),
-                        "PSUBSCRIBE", pattern);
             }
 
 
-            void punsubscribe(std::string const & pattern)
+            // The next reply belongs to the first request actually sent. Call it under lock.
+            void pop_shed_requests()
             {
-                if (_subs.end() == _subs.find(pattern))
+                while (!_op_callbacks.empty() && _op_callbacks.front().shed)
                 {
-                    throw subscription_does_not_exist(pattern);
+                    _op_callbacks.pop_front();
+                    ++_first_sequence;
                 }
-                execute(nullptr, "PUNSUBSCRIBE", pattern);
             }
 
 
-        protected:
+            request_id send_request(std::string && message,
+                                    std::function<void (::nokia::net::proto::redis::reply &&)> && callback,
+                                    std::chrono::milliseconds timeout)
+            {
+                return send_requests(std::move(message), &callback, 1, timeout);
+            }
 
-            template <typename... Ts>
-            void ferror(Ts &&... ts)
+
+            /*
+             * message: one or more encoded commands
+             * callbacks: one callback per command. Unsubscribe commands don't have callback, it's nullptr.
+             * timeout: of every command, 0 means no timeout
+             * batch: number of replies of each callback, collected and passed to the callback in one
+             *     ARRAY (even a single one). 0 means one reply, passed as it is.
+             * Returns the id of the last request.
+             *
+             * The commands of a message are admitted (circuit breaker, concurrency limit) as one request.
+             */
+            request_id send_requests(std::string && message,
+                                     std::function<void (::nokia::net::proto::redis::reply &&)> * callbacks,
+                                     std::size_t num_of_callbacks,
+                                     std::chrono::milliseconds timeout,
+                                     std::size_t batch = 0)
             {
-                std::string message = detail::concatenate(std::forward<Ts>(ts)...);
-                if (_log_callback)
+                std::shared_ptr<circuit_breaker> breaker;
+                std::shared_ptr<concurrency_limiter> limiter;
                 {
-                    _log_callback(message);
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    breaker = _breaker;
+                    limiter = _limiter;
                 }
-                else
+                std::size_t last = num_of_callbacks;
+                for (std::size_t i = 0; i < num_of_callbacks; ++i)
                 {
-                    std::cerr << message << std::endl;
+                    if (nullptr != callbacks[i])
+                    {
+                        last = i;
+                    }
                 }
-            }
-
-
-            void on_connected(boost::system::error_code const & error)
-            {
-                _pubsub_mode = false;
-                _subs.clear();
-                
-                if (_connected_callback)
+                if ((!breaker && !limiter) || num_of_callbacks == last)
                 {
-                    _connected_callback(error);
+                    return enqueue_requests(std::move(message), callbacks, num_of_callbacks, timeout, batch);
+                }
+                if (breaker && !breaker->allow())
+                {
+                    fail_requests(callbacks, num_of_callbacks, ERROR_CIRCUIT_OPEN);
+                    return NO_REQUEST;
+                }
+                if (limiter && !limiter->try_acquire())
+                {
+                    if (breaker)
+                    {
+                        breaker->on_abandoned();
+                    }
+                    fail_requests(callbacks, num_of_callbacks, ERROR_CONCURRENCY_LIMIT);
+                    return NO_REQUEST;
                 }
+                // The result is reported by the last callback, or on its destruction if it's never called (cancel).
+                auto ticket = std::make_shared<admission_ticket>(breaker, limiter);
+                auto callback = std::move(callbacks[last]);
+                callbacks[last] = [this, ticket, callback] (::nokia::net::proto::redis::reply && reply)
+                    {
+                        ticket->complete(::nokia::net::proto::redis::reply::ERROR == reply.type &&
+                                         (ERROR_REQUEST_TIMEOUT == reply.str ||
+                                          ERROR_TCP_DISCONNECTED == reply.str ||
+                                          ERROR_TCP_CANNOT_SEND_MESSAGE == reply.str ||
+                                          0 == reply.str.find("ERROR: TCP send buffer is full")));
+                        callback(std::move(reply));
+                    };
+                return enqueue_requests(std::move(message), callbacks, num_of_callbacks, timeout, batch);
             }
 
-            
-            void on_disconnected(boost::system::error_code const & error)
+
+            void fail_requests(std::function<void (::nokia::net::proto::redis::reply &&)> * callbacks,
+                               std::size_t num_of_callbacks,
+                               std::string const & error_message)
             {
-                ferror("redis-connection error: disconnected ungracefully. Notify all pending requests and reconnect. ip=%1%, port=%2%, reason=%3%", _ip, _port, error.message());
-                notify_all_pending_requests(ERROR_TCP_DISCONNECTED);
-                if (_disconnected_callback)
+                for (std::size_t i = 0; i < num_of_callbacks; ++i)
                 {
-                    _disconnected_callback(error);
+                    if (nullptr != callbacks[i])
+                    {
+                        ::nokia::net::proto::redis::reply error_reply;
+                        error_reply.type = ::nokia::net::proto::redis::reply::ERROR;
+                        error_reply.str = error_message;
+                        callbacks[i](std::move(error_reply));
+                    }
                 }
             }
 
 
-            void notify_all_pending_requests(std::string const & error_message)
+            // Same as send_requests() without admission control
+            request_id enqueue_requests(std::string && message,
+                                        std::function<void (::nokia::net::proto::redis::reply &&)> * callbacks,
+                                        std::size_t num_of_callbacks,
+                                        std::chrono::milliseconds timeout,
+                                        std::size_t batch = 0)
             {
-                while (!_op_callbacks.empty())
+                // The order of _op_callbacks has to match the order of messages in the send buffer,
+                // so the callbacks are stored and the message is queued under the same lock.
+                std::string error_message;
                 {
-                    ::nokia::net::proto::redis::reply error_reply;
-                    error_reply.type = ::nokia::net::proto::redis::reply::ERROR;
-                    error_reply.str = error_message;
-                    auto & op_callback = _op_callbacks.front();
-                    op_callback(std::move(error_reply));
-                    _op_callbacks.pop_front();
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if (!_connected)
+                    {
+                        error_message = ERROR_TCP_CANNOT_SEND_MESSAGE;
+                    }
+                    else
+                    {
+                        uint64_t const first_sequence = _first_sequence + _op_callbacks.size();
+                        std::size_t count{0};
+                        for (std::size_t i = 0; i < num_of_callbacks; ++i)
+                        {
+                            count += (nullptr != callbacks[i]) ? 1 : 0;
+                        }
+                        uint64_t message_id{0};
+                        try
+                        {
+                            if (timeout.count() > 0)
+                            {
+                                message_id = _tcp.send(std::move(message),
+                                                       std::chrono::steady_clock::now() + timeout,
+                                                       [this, first_sequence, count] ()
+                                                       {
+                                                           on_requests_shed(first_sequence, count);
+                                                       });
+                            }
+                            else
+                            {
+                                message_id = _tcp.send(std::move(message));
+                            }
+                        }
+                        catch (std::exception const & ex)
+                        {
+                            error_message = ex.what();
+                        }
+                        if (error_message.empty())
+                        {
+                            // No reply can be processed before the callbacks are stored, since
+                            // the reading side needs the lock as well.
+                            request_id id{NO_REQUEST};
+                            for (std::size_t i = 0; i < num_of_callbacks; ++i)
+                            {
+                                if (nullptr != callbacks[i])
+                                {
+                                    // unsubscribe commands are handled different
+                                    timing_wheel::handle deadline{0};
+                                    if (timeout.count() > 0)
+                                    {
+                                        uint64_t const sequence = _first_sequence + _op_callbacks.size();
+                                        deadline = _wheel.schedule(timeout,
+                                                                   [this, sequence] ()
+                                                                   {
+                                                                       on_request_timeout(sequence);
+                                                                   },
+                                                                   this);
+                                    }
+                                    _op_callbacks.push_back(pending_request{std::move(callbacks[i]), deadline, message_id, 1 == count, false, false, std::max<std::size_t>(batch, 1), 0 != batch, {}});
+                                    id = _first_sequence + _op_callbacks.size();
+                                }
+                            }
+                            return id;
+                        }
+                    }
                 }
+                // Never call back under the lock, the callback may send a new request.
+                fail_requests(callbacks, num_of_callbacks, error_message);
+                return NO_REQUEST;
             }
 
             
@@ -278,19 +1862,71 @@ namespace nokia
                     return;
                 }
                 // Regular callbacks
-                if (_op_callbacks.empty())
+                std::function<void (::nokia::net::proto::redis::reply &&)> op_callback;
+                bool found{false};
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _last_reply_at = std::chrono::steady_clock::now();
+                    if (!_op_callbacks.empty())
+                    {
+                        found = true;
+                        pending_request & request = _op_callbacks.front();
+                        if (request.batched)
+                        {
+                            // Collected until its last reply
+                            if (request.callback)
+                            {
+                                request.batch.push_back(std::move(reply));
+                            }
+                            if (0 != --request.replies)
+                            {
+                                return;
+                            }
+                            reply = ::nokia::net::proto::redis::reply();
+                            reply.type = ::nokia::net::proto::redis::reply::ARRAY;
+                            reply.elements.swap(request.batch);
+                        }
+                        if (0 != request.deadline)
+                        {
+                            _wheel.cancel(request.deadline);
+                        }
+                        else if (!request.callback && !request.cancelled)
+                        {
+                            // Late reply of a timed out request
+                            --_expired_in_flight;
+                        }
+                        op_callback = std::move(request.callback);
+                        _op_callbacks.pop_front();
+                        ++_first_sequence;
+                        pop_shed_requests();
+                    }
+                }
+                if (found && nullptr == op_callback)
+                {
+                    return;
+                }
+                if (nullptr == op_callback)
                 {
                     ferror("redis-connection error: got reply but doesn't have any stored callback (should not happen). Reconnecting. ip=%1%, port=%2%", _ip, _port);
                     // std::cout << "   reply: " << reply << std::endl;
-                    _tcp.reconnect();
+                    recycle_connection();
                     return;
                 }
-                auto & op_callback = _op_callbacks.front();
                 op_callback(std::move(reply));
-                _op_callbacks.pop_front();
+                ++_completed_requests;
             }
 
             
+            void append_command(std::string & target, std::vector<std::string> const & command)
+            {
+                target += "*" + std::to_string(command.size()) + "\r\n";
+                for (auto const & argument: command)
+                {
+                    append_bulk_string(target, argument);
+                }
+            }
+
+
             void append_bulk_string(std::string & target, std::string const & t)
             {
                 target += "$" + std::to_string(t.size()) + "\r\n" + t + "\r\n";
@@ -305,6 +1941,23 @@ namespace nokia
             }
 
 
+            std::shared_ptr<pubsub_callbacks> find_subscription(std::string const & name, bool remove)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                auto it = _subs.find(name);
+                if (_subs.end() == it)
+                {
+                    return nullptr;
+                }
+                std::shared_ptr<pubsub_callbacks> callbacks = it->second;
+                if (remove)
+                {
+                    _subs.erase(it);
+                }
+                return callbacks;
+            }
+
+
             bool check_subscribe_callback(::nokia::net::proto::redis::reply & reply)
             {
                 if (::nokia::net::proto::redis::reply::ARRAY != reply.type) { return false; }
@@ -335,7 +1988,7 @@ namespace nokia
                         {
                             ferror("redis-connection error: got non-valid subscribe-related response. Reconnecting. ip=%1%, port=%2%", _ip, _port);
                             // std::cout << "   reply: " << reply << std::endl;
-                            _tcp.reconnect();
+                            recycle_connection();
                             return false;
                         }
                     };
@@ -357,15 +2010,14 @@ namespace nokia
                     ::nokia::net::proto::redis::reply const & reply_num_of_subs = reply.elements[2];
                     if (!check(::nokia::net::proto::redis::reply::INTEGER == reply_num_of_subs.type)) { return; }
 
-                    auto it = _subs.find(channel);
-                    if (_subs.end() == it)
+                    std::shared_ptr<pubsub_callbacks> callbacks = find_subscription(channel, false);
+                    if (!callbacks)
                     {
                         ferror("redis-connection error: cannot find subscription callback for reply. Reconnecting. ip=%1%, port=%2%", _ip, _port);
-                        _tcp.reconnect();
+                        recycle_connection();
                         return;
                     }
-                    auto & callbacks = it->second;
-                    callbacks.subscribed_callback();
+                    callbacks->subscribed_callback();
                     return;
                 }
                 if ("MESSAGE" == command)
@@ -375,20 +2027,29 @@ namespace nokia
                     if (!check(::nokia::net::proto::redis::reply::STRING == reply_channel.type)) { return; }
                     std::string const & channel = reply_channel.str;
 
+                    // Invalidation messages of client tracking (__redis__:invalidate) carry an array of keys,
+                    // or nil if every key is invalid. They are passed one by one, nil as empty message.
                     ::nokia::net::proto::redis::reply const & reply_message = reply.elements[2];
-                    if (!check(::nokia::net::proto::redis::reply::STRING == reply_message.type)) { return; }
-                    std::string const & message = reply_message.str;
+                    if (!check(::nokia::net::proto::redis::reply::STRING == reply_message.type ||
+                               ::nokia::net::proto::redis::reply::ARRAY == reply_message.type ||
+                               ::nokia::net::proto::redis::reply::NIL == reply_message.type)) { return; }
 
-                    auto it = _subs.find(channel);
-                    if (_subs.end() == it)
+                    std::shared_ptr<pubsub_callbacks> callbacks = find_subscription(channel, false);
+                    if (!callbacks)
                     {
                         ferror("redis-connection error: cannot find subscription callback for reply. Reconnecting. ip=%1%, port=%2%", _ip, _port);
-                        // std::cout << "   reply: " << reply << std::endl;
-                        _tcp.reconnect();
+                        recycle_connection();
+                        return;
+                    }
+                    if (::nokia::net::proto::redis::reply::ARRAY == reply_message.type)
+                    {
+                        for (auto const & element: reply_message.elements)
+                        {
+                            callbacks->change_callback(channel, element.str);
+                        }
                         return;
                     }
-                    auto & callbacks = it->second;
-                    callbacks.change_callback(channel, message);
+                    callbacks->change_callback(channel, reply_message.str);
                     return;
                 }
                 if ("UNSUBSCRIBE" == command)
@@ -401,17 +2062,14 @@ namespace nokia
                     ::nokia::net::proto::redis::reply const & reply_num_of_subs = reply.elements[2];
                     if (!check(::nokia::net::proto::redis::reply::INTEGER == reply_num_of_subs.type)) { return; }
 
-                    auto it = _subs.find(channel);
-                    if (_subs.end() == it)
+                    std::shared_ptr<pubsub_callbacks> callbacks = find_subscription(channel, true);
+                    if (!callbacks)
                     {
                         ferror("redis-connection error: cannot find subscription callback for reply. Reconnecting. ip=%1%, port=%2%", _ip, _port);
-                        // std::cout << "   reply: " << reply << std::endl;
-                        _tcp.reconnect();
+                        recycle_connection();
                         return;
                     }
-                    auto & callbacks = it->second;
-                    callbacks.unsubscribed_callback();
-                    _subs.erase(it);
+                    callbacks->unsubscribed_callback();
                     return;
                 }
                 if ("PMESSAGE" == command)
@@ -431,16 +2089,14 @@ namespace nokia
                     if (!check(::nokia::net::proto::redis::reply::STRING == reply_message.type)) { return; }
                     std::string const & message = reply_message.str;
 
-                    auto it = _subs.find(pattern);
-                    if (_subs.end() == it)
+                    std::shared_ptr<pubsub_callbacks> callbacks = find_subscription(pattern, false);
+                    if (!callbacks)
                     {
                         ferror("redis-connection error: cannot find subscription callback for reply. Reconnecting. ip=%1%, port=%2%", _ip, _port);
-                        // std::cout << "   reply: " << reply << std::endl;
-                        _tcp.reconnect();
+                        recycle_connection();
                         return;
                     }
-                    auto & callbacks = it->second;
-                    callbacks.pattern_change_callback(pattern, channel, message);
+                    callbacks->pattern_change_callback(pattern, channel, message);
                     return;
                 }
                 if ("PUNSUBSCRIBE" == command)
@@ -453,17 +2109,14 @@ namespace nokia
                     ::nokia::net::proto::redis::reply const & reply_num_of_subs = reply.elements[2];
                     if (!check(::nokia::net::proto::redis::reply::INTEGER == reply_num_of_subs.type)) { return; }
 
-                    auto it = _subs.find(pattern);
-                    if (_subs.end() == it)
+                    std::shared_ptr<pubsub_callbacks> callbacks = find_subscription(pattern, true);
+                    if (!callbacks)
                     {
                         ferror("redis-connection error: cannot find subscription callback for reply. Reconnecting. ip=%1%, port=%2%", _ip, _port);
-                        // std::cout << "   reply: " << reply << std::endl;
-                        _tcp.reconnect();
+                        recycle_connection();
                         return;
                     }
-                    auto & callbacks = it->second;
-                    callbacks.unsubscribed_callback();
-                    _subs.erase(it);
+                    callbacks->unsubscribed_callback();
                     return;
                 }
             }
@@ -493,17 +2146,51 @@ namespace nokia
                 }
             };
 
+            boost::asio::io_service & _io_service;
             ::nokia::net::tcp_connection<::nokia::net::proto::redis::parser> _tcp;
+            timing_wheel & _wheel;
             std::string _ip;
             uint16_t _port;
             std::function<void (boost::system::error_code const &)> _connected_callback;
             std::function<void (boost::system::error_code const &)> _disconnected_callback;
             std::function<void (std::string const &)> _log_callback;
+            bool _keepalive_enabled;
             
-            std::deque<std::function<void (::nokia::net::proto::redis::reply &&)>> _op_callbacks;
+            // Guards the request and subscription administration, so the public functions can be called from any thread.
+            mutable std::mutex _mutex;
+            bool _connected;
+            std::deque<pending_request> _op_callbacks;
+            uint64_t _first_sequence;               // of _op_callbacks.front(), the deadlines refer to the requests by sequence
+            std::size_t _expired_in_flight;         // timed out requests waiting for their late reply
+            std::size_t _recycle_threshold;
+
+            std::chrono::milliseconds _probe_interval;
+            std::chrono::milliseconds _probe_min_timeout;
+            reconnect_policy _reconnect_policy;      // of the lanes and the watch connection, see set_reconnect_policy()
+            timing_wheel::handle _probe_handle;
+            bool _probe_in_flight;
+            std::chrono::steady_clock::time_point _last_reply_at;
+            latency_tracker _rtt;
+
+            std::shared_ptr<circuit_breaker> _breaker;
+            std::shared_ptr<concurrency_limiter> _limiter;
+            std::shared_ptr<script_registry> _scripts;
+            std::atomic<std::size_t> _max_lanes;
+            std::vector<std::shared_ptr<lane>> _lanes;
+            std::deque<blocking_request> _blocking_requests;       // waiting for a free lane
+            std::shared_ptr<redis_connection> _watch_connection;   // of execute_watched(), connected on first use
+            bool _watch_connected;
+            bool _watch_busy;                                       // a watched transaction is between WATCH and EXEC
+            std::deque<std::shared_ptr<watched_transaction>> _watched;   // waiting for the watch connection
+            std::vector<closed_connection> _closed;                 // disconnected lanes and watch connections, joined by join()
+            std::function<void (redis_connection &)> _side_tls;    // sets TLS on the lanes and the watch connection, empty without TLS
+            std::atomic<uint64_t> _completed_requests;
+            std::atomic<uint64_t> _timed_out_requests;
+            std::atomic<uint64_t> _shed_requests;
+            std::atomic<std::chrono::milliseconds::rep> _request_timeout;
 
-            bool _pubsub_mode;
-            std::map<std::string, pubsub_callbacks> _subs;
+            std::atomic<bool> _pubsub_mode;
+            std::map<std::string, std::shared_ptr<pubsub_callbacks>> _subs;
         };
 
     }
@@ -0,0 +1,669 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <wiredis/commands.h>
+#include <wiredis/hedging.h>
+#include <wiredis/latency.h>
+#include <wiredis/redis-connection.h>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Set of redis_connections to the same redis-server.
+         *
+         * Every command goes to the connected member with the fewest outstanding requests
+         * (ties are broken by the number of bytes waiting to be sent), so one slow reply
+         * blocks only the requests behind it on the same socket.
+         *
+         * Members can be spread over several io_services. Unhealthy members (disconnected
+         * or stalled for too long) are replaced in the background.
+         *
+         * With hedging turned on a read-only command is sent on a second member too, if the
+         * first one doesn't reply in time (e.g. it's stuck behind a slow command). The first reply wins.
+         */
+        class redis_pool
+        {
+        public:
+
+            std::string const ERROR_NO_CONNECTION;
+
+
+            redis_pool(boost::asio::io_service & io_service, std::size_t size):
+                redis_pool(std::vector<std::reference_wrapper<boost::asio::io_service>>{std::ref(io_service)}, size)
+            {
+            }
+
+
+            /*
+             * io_services: the members are assigned to the io_services in round-robin order.
+             *     The first one runs the health check timer.
+             */
+            redis_pool(std::vector<std::reference_wrapper<boost::asio::io_service>> const & io_services, std::size_t size):
+                ERROR_NO_CONNECTION{"NO CONNECTION AVAILABLE"},
+                _io_services(io_services),
+                _health_timer(_io_services.front().get()),
+                _health_check_interval(1000),
+                _unhealthy_after(5000),
+                _port(0),
+                _auto_reconnect(true),
+                _keepalive_enabled(true),
+                _running(false),
+                _hedging_percentile(0),
+                _hedging_min_delay(0),
+                _probe_interval(0),
+                _probe_min_timeout(0),
+                _max_lanes(0),
+                _hedged_requests{0},
+                _next{0},
+                _retiring{0}
+            {
+                for (std::size_t i = 0; i < size; ++i)
+                {
+                    _members.emplace_back(create_slot(i));
+                }
+            }
+
+
+            ~redis_pool()
+            {
+            }
+
+
+            void set_log_callback(std::function<void (std::string const &)> cb)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _log_callback = cb;
+                for (auto & member: _members)
+                {
+                    member.connection->set_log_callback(cb);
+                }
+            }
+
+
+            /*
+             * interval: how often the members are checked.
+             * unhealthy_after: a member is replaced if it's been disconnected for this long,
+             *     or it has pending requests but hasn't got any reply for this long.
+             */
+            void set_health_check(std::chrono::milliseconds interval, std::chrono::milliseconds unhealthy_after)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _health_check_interval = interval;
+                _unhealthy_after = unhealthy_after;
+            }
+
+
+            /*
+             * Read-only commands which aren't replied within the given percentile of the latency
+             * (e.g. 0.95 for the running p95, but at least min_delay) are sent on another member too.
+             * percentile = 0 turns it off (default).
+             */
+            void set_hedging(double percentile, std::chrono::microseconds min_delay = std::chrono::milliseconds(1))
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _hedging_percentile = percentile;
+                _hedging_min_delay = min_delay;
+            }
+
+
+            // See redis_connection::set_health_probe(), applied to every member
+            void set_health_probe(std::chrono::milliseconds idle_interval, std::chrono::milliseconds min_timeout = std::chrono::milliseconds(100))
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _probe_interval = idle_interval;
+                _probe_min_timeout = min_timeout;
+                for (auto & member: _members)
+                {
+                    member.connection->set_health_probe(idle_interval, min_timeout);
+                }
+            }
+
+
+            /*
+             * See redis_connection::set_circuit_breaker() and set_concurrency_limiter(). The same
+             * breaker and limiter is set on every member, so they protect the server of the pool.
+             */
+            void set_circuit_breaker(std::shared_ptr<circuit_breaker> breaker)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _breaker = breaker;
+                for (auto & member: _members)
+                {
+                    member.connection->set_circuit_breaker(breaker);
+                }
+            }
+
+
+            void set_concurrency_limiter(std::shared_ptr<concurrency_limiter> limiter)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _limiter = limiter;
+                for (auto & member: _members)
+                {
+                    member.connection->set_concurrency_limiter(limiter);
+                }
+            }
+
+
+            // Every member loads the scripts on connect, see redis_connection::set_scripts().
+            void set_scripts(std::shared_ptr<script_registry> scripts)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _scripts = scripts;
+                for (auto & member: _members)
+                {
+                    member.connection->set_scripts(scripts);
+                }
+            }
+
+
+            // Every member has its own lanes for blocking commands, see redis_connection::set_blocking_lanes().
+            void set_blocking_lanes(std::size_t max_lanes_per_member)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _max_lanes = max_lanes_per_member;
+                for (auto & member: _members)
+                {
+                    member.connection->set_blocking_lanes(max_lanes_per_member);
+                }
+            }
+
+
+            /*
+             * Parameters are the same as redis_connection::connect().
+             * Callbacks are invoked per member, including the replaced ones.
+             */
+            void connect(std::string const & ip,
+                         uint16_t port,
+                         std::function<void (boost::system::error_code const &)> connected_callback,
+                         std::function<void (boost::system::error_code const &)> disconnected_callback,
+                         bool auto_reconnect = true,
+                         bool keepalive_enabled = true)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _ip = ip;
+                _port = port;
+                _connected_callback = connected_callback;
+                _disconnected_callback = disconnected_callback;
+                _auto_reconnect = auto_reconnect;
+                _keepalive_enabled = keepalive_enabled;
+                _running = true;
+
+                auto now = std::chrono::steady_clock::now();
+                for (auto & member: _members)
+                {
+                    connect_slot(member, now);
+                }
+                _io_services.front().get().dispatch([this] ()
+                                                    {
+                                                        start_health_timer();
+                                                    });
+            }
+
+
+            void disconnect()
+            {
+                std::vector<std::shared_ptr<redis_connection>> connections;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _running = false;
+                    for (auto & member: _members)
+                    {
+                        connections.push_back(member.connection);
+                    }
+                }
+                _io_services.front().get().dispatch([this] ()
+                                                    {
+                                                        _health_timer.cancel();
+                                                    });
+                // Pending requests are notified from disconnect(), don't hold the lock meanwhile.
+                for (auto & connection: connections)
+                {
+                    connection->disconnect();
+                }
+            }
+
+
+            // True if at least one member is connected
+            bool connected() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                for (auto const & member: _members)
+                {
+                    if (member.connection->connected())
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+
+            std::size_t size() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _members.size();
+            }
+
+
+            void join(std::function<void ()> cb)
+            {
+                std::vector<std::shared_ptr<redis_connection>> connections;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    for (auto & member: _members)
+                    {
+                        connections.push_back(member.connection);
+                    }
+                }
+                if (connections.empty())
+                {
+                    cb();
+                    return;
+                }
+                auto remaining = std::make_shared<std::atomic<std::size_t>>(connections.size());
+                auto on_joined = [this, remaining, cb] ()
+                    {
+                        if (0 != --(*remaining))
+                        {
+                            return;
+                        }
+                        {
+                            std::unique_lock<std::mutex> guard(_mutex);
+                            if (0 != _retiring)
+                            {
+                                // Completed once the last replaced connection is cleaned up
+                                _join_callbacks.push_back(cb);
+                                return;
+                            }
+                        }
+                        cb();
+                    };
+                for (auto & connection: connections)
+                {
+                    connection->join(on_joined);
+                }
+            }
+
+
+            void sync_join()
+            {
+                // Blocking join. Do not call from io_service thread!
+                std::mutex mutex;
+                std::unique_lock<std::mutex> guard(mutex);
+                std::condition_variable cv;
+                bool done{false};
+
+                join([&] ()
+                     {
+                         std::unique_lock<std::mutex> guard(mutex);
+                         done = true;
+                         cv.notify_one();
+                     });
+                cv.wait(guard, [&] () { return done; });
+            }
+
+
+            template <typename... Ts>
+            void execute(std::function<void (::nokia::net::proto::redis::reply &&)> callback, Ts &&... ts)
+            {
+                if (hedging_enabled())
+                {
+                    execute_command(std::move(callback), std::vector<std::string>{std::forward<Ts>(ts)...});
+                    return;
+                }
+                std::shared_ptr<redis_connection> connection = pick();
+                if (!connection)
+                {
+                    reply_no_connection(callback);
+                    return;
+                }
+                connection->execute(callback, std::forward<Ts>(ts)...);
+            }
+
+
+            void execute_command(std::function<void (::nokia::net::proto::redis::reply &&)> callback, std::vector<std::string> const & command)
+            {
+                std::shared_ptr<redis_connection> connection = pick();
+                if (!connection)
+                {
+                    reply_no_connection(callback);
+                    return;
+                }
+                double percentile{0};
+                std::chrono::microseconds min_delay;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    percentile = _hedging_percentile;
+                    min_delay = _hedging_min_delay;
+                }
+                if (0 == percentile || !is_readonly(command))
+                {
+                    connection->execute_command(std::move(callback), command);
+                    return;
+                }
+                auto request = std::make_shared<hedged_request>(_io_services.front().get(), std::move(callback));
+                execute_measured(connection, request->reply_handler(), command);
+                request->hedge_after(std::max(_latency.percentile(percentile), min_delay),
+                                     [this, connection, request, command] ()
+                                     {
+                                         std::shared_ptr<redis_connection> second = pick(connection.get());
+                                         if (!second)
+                                         {
+                                             return;
+                                         }
+                                         ++_hedged_requests;
+                                         execute_measured(second, request->reply_handler(), command);
+                                     });
+            }
+
+
+            // The whole batch goes to one member, see redis_connection::execute_pipeline().
+            void execute_pipeline(pipeline const & batch, std::function<void (std::vector<::nokia::net::proto::redis::reply> &&)> callback)
+            {
+                std::shared_ptr<redis_connection> connection = pick();
+                if (!connection)
+                {
+                    reply_no_connection([&batch, &callback] (::nokia::net::proto::redis::reply && reply)
+                                        {
+                                            callback(std::vector<::nokia::net::proto::redis::reply>(batch.size(), reply));
+                                        });
+                    return;
+                }
+                connection->execute_pipeline(batch, std::move(callback));
+            }
+
+
+            // Number of commands sent on a second member
+            uint64_t hedged_requests() const
+            {
+                return _hedged_requests;
+            }
+
+
+        protected:
+
+            struct slot
+            {
+                std::size_t index;
+                std::shared_ptr<redis_connection> connection;
+                std::chrono::steady_clock::time_point healthy_at;  // last time the member was found healthy
+                uint64_t completed_requests;                        // value at the last health check
+            };
+
+
+            std::shared_ptr<redis_connection> create_connection(std::size_t index)
+            {
+                auto connection = std::make_shared<redis_connection>(_io_services[index % _io_services.size()].get());
+                if (_log_callback)
+                {
+                    connection->set_log_callback(_log_callback);
+                }
+                connection->set_health_probe(_probe_interval, _probe_min_timeout);
+                connection->set_circuit_breaker(_breaker);
+                connection->set_concurrency_limiter(_limiter);
+                connection->set_scripts(_scripts);
+                connection->set_blocking_lanes(_max_lanes);
+                return connection;
+            }
+
+
+            slot create_slot(std::size_t index)
+            {
+                return slot{index, create_connection(index), std::chrono::steady_clock::now(), 0};
+            }
+
+
+            void connect_slot(slot & member, std::chrono::steady_clock::time_point now)
+            {
+                member.healthy_at = now;
+                member.completed_requests = 0;
+                member.connection->connect(_ip,
+                                           _port,
+                                           _connected_callback,
+                                           _disconnected_callback,
+                                           _auto_reconnect,
+                                           _keepalive_enabled);
+            }
+
+
+            bool hedging_enabled() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return 0 != _hedging_percentile;
+            }
+
+
+            void reply_no_connection(std::function<void (::nokia::net::proto::redis::reply &&)> const & callback)
+            {
+                ::nokia::net::proto::redis::reply error_reply;
+                error_reply.type = ::nokia::net::proto::redis::reply::ERROR;
+                error_reply.str = ERROR_NO_CONNECTION;
+                callback(std::move(error_reply));
+            }
+
+
+            // Latency of the hedged commands is tracked, it gives the hedging delay.
+            void execute_measured(std::shared_ptr<redis_connection> const & connection,
+                                  std::function<void (::nokia::net::proto::redis::reply &&)> callback,
+                                  std::vector<std::string> const & command)
+            {
+                auto const start = std::chrono::steady_clock::now();
+                connection->execute_command([this, connection, start, callback] (::nokia::net::proto::redis::reply && reply)
+                                            {
+                                                if (::nokia::net::proto::redis::reply::ERROR != reply.type ||
+                                                    (connection->ERROR_TCP_DISCONNECTED != reply.str &&
+                                                     connection->ERROR_TCP_CANNOT_SEND_MESSAGE != reply.str))
+                                                {
+                                                    _latency.add(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+                                                }
+                                                callback(std::move(reply));
+                                            },
+                                            command);
+            }
+
+
+            /*
+             * Returns the connected member with the fewest outstanding requests or nullptr.
+             * exclude: member which has already got the request.
+             */
+            std::shared_ptr<redis_connection> pick(redis_connection const * exclude = nullptr)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                std::size_t const size = _members.size();
+                if (0 == size)
+                {
+                    return nullptr;
+                }
+                // Rotate the starting point so equally loaded members are used evenly.
+                std::size_t const start = _next++ % size;
+                redis_connection * best{nullptr};
+                std::size_t best_index{0};
+                std::size_t best_requests{0};
+                uint64_t best_bytes{0};
+                for (std::size_t i = 0; i < size; ++i)
+                {
+                    std::size_t const index = (start + i) % size;
+                    redis_connection & candidate = *_members[index].connection;
+                    if (&candidate == exclude || !candidate.connected())
+                    {
+                        continue;
+                    }
+                    std::size_t const requests = candidate.pending_requests();
+                    if (best && requests > best_requests)
+                    {
+                        continue;
+                    }
+                    uint64_t const bytes = candidate.pending_bytes();
+                    if (!best || requests < best_requests || bytes < best_bytes)
+                    {
+                        best = &candidate;
+                        best_index = index;
+                        best_requests = requests;
+                        best_bytes = bytes;
+                        if (0 == requests && 0 == bytes)
+                        {
+                            break;
+                        }
+                    }
+                }
+                if (!best)
+                {
+                    return nullptr;
+                }
+                return _members[best_index].connection;
+            }
+
+
+            void start_health_timer()
+            {
+                _health_timer.expires_from_now(_health_check_interval);
+                _health_timer.async_wait([this] (boost::system::error_code const & error)
+                                         {
+                                             if (::boost::asio::error::operation_aborted == error)
+                                             {
+                                                 // Timer has been canceled.
+                                                 return;
+                                             }
+                                             check_health();
+                                         });
+            }
+
+
+            void check_health()
+            {
+                std::vector<std::pair<std::shared_ptr<redis_connection>, std::size_t>> unhealthy_connections;  // with member index
+                std::unique_lock<std::mutex> guard(_mutex);
+                if (!_running)
+                {
+                    return;
+                }
+                auto now = std::chrono::steady_clock::now();
+                for (auto & member: _members)
+                {
+                    redis_connection & connection = *member.connection;
+                    uint64_t const completed_requests = connection.completed_requests();
+                    bool const healthy = connection.connected() &&
+                        (0 == connection.pending_requests() || completed_requests != member.completed_requests);
+                    member.completed_requests = completed_requests;
+                    if (healthy)
+                    {
+                        member.healthy_at = now;
+                        continue;
+                    }
+                    if (now - member.healthy_at < _unhealthy_after)
+                    {
+                        continue;
+                    }
+                    ferror("redis-pool error: replacing unhealthy connection. ip=%1%, port=%2%, index=%3%, connected=%4%, pending requests=%5%",
+                           _ip, _port, member.index, connection.connected(), connection.pending_requests());
+                    unhealthy_connections.emplace_back(member.connection, member.index);
+                    member.connection = create_connection(member.index);
+                    connect_slot(member, now);
+                }
+                start_health_timer();
+                guard.unlock();
+
+                for (auto & item: unhealthy_connections)
+                {
+                    retire(item.first, _io_services[item.second % _io_services.size()].get());
+                }
+            }
+
+
+            // io_service: the one of the connection
+            void retire(std::shared_ptr<redis_connection> connection, boost::asio::io_service & io_service)
+            {
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    ++_retiring;
+                }
+                connection->disconnect();
+                connection->join([this, connection, &io_service] ()
+                                 {
+                                     // Released outside of its own callback, after the handlers already queued
+                                     // on its io_service (e.g. aborted reads and writes) have run.
+                                     io_service.post([this, connection] ()
+                                                     {
+                                                         std::vector<std::function<void ()>> join_callbacks;
+                                                         {
+                                                             std::unique_lock<std::mutex> guard(_mutex);
+                                                             if (0 == --_retiring)
+                                                             {
+                                                                 join_callbacks.swap(_join_callbacks);
+                                                             }
+                                                         }
+                                                         for (auto & cb: join_callbacks)
+                                                         {
+                                                             cb();
+                                                         }
+                                                     });
+                                 });
+            }
+
+
+            template <typename... Ts>
+            void ferror(Ts &&... ts)
+            {
+                std::string message = detail::concatenate(std::forward<Ts>(ts)...);
+                if (_log_callback)
+                {
+                    _log_callback(message);
+                }
+                else
+                {
+                    std::cerr << message << std::endl;
+                }
+            }
+
+
+        private:
+
+            std::vector<std::reference_wrapper<boost::asio::io_service>> _io_services;
+            boost::asio::steady_timer _health_timer;
+            std::chrono::milliseconds _health_check_interval;
+            std::chrono::milliseconds _unhealthy_after;
+
+            std::string _ip;
+            uint16_t _port;
+            std::function<void (boost::system::error_code const &)> _connected_callback;
+            std::function<void (boost::system::error_code const &)> _disconnected_callback;
+            std::function<void (std::string const &)> _log_callback;
+            bool _auto_reconnect;
+            bool _keepalive_enabled;
+            bool _running;
+            double _hedging_percentile;
+            std::chrono::microseconds _hedging_min_delay;
+            std::chrono::milliseconds _probe_interval;
+            std::chrono::milliseconds _probe_min_timeout;
+            std::shared_ptr<circuit_breaker> _breaker;
+            std::shared_ptr<concurrency_limiter> _limiter;
+            std::shared_ptr<script_registry> _scripts;
+            std::size_t _max_lanes;
+            latency_tracker _latency;
+            std::atomic<uint64_t> _hedged_requests;
+
+            mutable std::mutex _mutex;
+            std::vector<slot> _members;
+            std::size_t _next;
+            std::size_t _retiring;
+            std::vector<std::function<void ()>> _join_callbacks;
+        };
+
+    }
+}
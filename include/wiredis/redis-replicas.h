@@ -0,0 +1,395 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <wiredis/commands.h>
+#include <wiredis/hedging.h>
+#include <wiredis/latency.h>
+#include <wiredis/redis-connection.h>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Read/write splitting client.
+         *
+         * Read-only commands (see is_readonly()) are sent to the replica with the lowest
+         * expected latency: smoothed round-trip time multiplied by the number of outstanding requests.
+         * Until a replica has served reads, the round-trip time of its health probe is used.
+         * Everything else goes to the primary. If none of the replicas is connected, reads go to the primary.
+         *
+         * With hedging turned on a read is sent to a second replica too, if the first one
+         * doesn't reply in time. The first reply wins.
+         */
+        class redis_replicas
+        {
+        public:
+
+            struct replica_info
+            {
+                std::string address;
+                bool connected;
+                std::size_t pending_requests;
+                std::chrono::microseconds rtt;
+            };
+
+
+            redis_replicas(boost::asio::io_service & io_service):
+                _io_service(io_service),
+                _primary(std::make_shared<redis_connection>(io_service)),
+                _sync_replicas(0),
+                _sync_timeout(0),
+                _hedging_percentile(0),
+                _hedging_min_delay(0),
+                _probe_interval(0),
+                _probe_min_timeout(0),
+                _next{0},
+                _hedged_requests{0}
+            {
+            }
+
+
+            ~redis_replicas()
+            {
+            }
+
+
+            void set_log_callback(std::function<void (std::string const &)> cb)
+            {
+                _primary->set_log_callback(cb);
+                for (auto & replica: _replicas)
+                {
+                    replica->connection->set_log_callback(cb);
+                }
+            }
+
+
+            /*
+             * Every write is followed by WAIT <replicas> <timeout> on the primary and the callback is called
+             * after WAIT returns, so a following read sees the write on the replicas (read-your-writes).
+             * replicas = 0 turns it off (default).
+             */
+            void set_write_sync(unsigned replicas, std::chrono::milliseconds timeout)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _sync_replicas = replicas;
+                _sync_timeout = timeout;
+            }
+
+
+            /*
+             * Reads which aren't replied within the given percentile of the replica's latency
+             * (e.g. 0.95 for its running p95, but at least min_delay) are sent to another replica too.
+             * percentile = 0 turns it off (default).
+             */
+            void set_hedging(double percentile, std::chrono::microseconds min_delay = std::chrono::milliseconds(1))
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _hedging_percentile = percentile;
+                _hedging_min_delay = min_delay;
+            }
+
+
+            // See redis_connection::set_health_probe(), applied to the primary and to every replica
+            void set_health_probe(std::chrono::milliseconds idle_interval, std::chrono::milliseconds min_timeout = std::chrono::milliseconds(100))
+            {
+                _probe_interval = idle_interval;
+                _probe_min_timeout = min_timeout;
+                _primary->set_health_probe(idle_interval, min_timeout);
+                for (auto & replica: _replicas)
+                {
+                    replica->connection->set_health_probe(idle_interval, min_timeout);
+                }
+            }
+
+
+            /*
+             * primary: ip/port of the primary.
+             *
+             * replicas: ip/port of the replicas.
+             *
+             * The callbacks are called for the primary and for every replica.
+             */
+            void connect(std::pair<std::string, uint16_t> const & primary,
+                         std::vector<std::pair<std::string, uint16_t>> const & replicas,
+                         std::function<void (boost::system::error_code const &)> connected_callback,
+                         std::function<void (boost::system::error_code const &)> disconnected_callback,
+                         bool keepalive_enabled = true)
+            {
+                for (auto const & address: replicas)
+                {
+                    auto new_replica = std::make_shared<replica>(_io_service);
+                    new_replica->address = address.first + ":" + std::to_string(address.second);
+                    new_replica->connection->set_health_probe(_probe_interval, _probe_min_timeout);
+                    _replicas.push_back(new_replica);
+                }
+                _primary->connect(primary.first, primary.second, connected_callback, disconnected_callback, true, keepalive_enabled);
+                for (std::size_t i = 0; i < replicas.size(); ++i)
+                {
+                    _replicas[i]->connection->connect(replicas[i].first, replicas[i].second, connected_callback, disconnected_callback, true, keepalive_enabled);
+                }
+            }
+
+
+            void disconnect()
+            {
+                _primary->disconnect();
+                for (auto & replica: _replicas)
+                {
+                    replica->connection->disconnect();
+                }
+            }
+
+
+            // Connected to the primary
+            bool connected() const
+            {
+                return _primary->connected();
+            }
+
+
+            void join(std::function<void ()> cb)
+            {
+                auto remaining = std::make_shared<std::atomic<std::size_t>>(_replicas.size() + 1);
+                auto on_joined = [remaining, cb] ()
+                    {
+                        if (0 == --(*remaining))
+                        {
+                            cb();
+                        }
+                    };
+                _primary->join(on_joined);
+                for (auto & replica: _replicas)
+                {
+                    replica->connection->join(on_joined);
+                }
+            }
+
+
+            void sync_join()
+            {
+                // Blocking join. Do not call from io_service thread!
+                std::mutex mutex;
+                std::unique_lock<std::mutex> guard(mutex);
+                std::condition_variable cv;
+                bool done{false};
+
+                join([&] ()
+                     {
+                         std::unique_lock<std::mutex> guard(mutex);
+                         done = true;
+                         cv.notify_one();
+                     });
+                cv.wait(guard, [&] () { return done; });
+            }
+
+
+            template <typename... Ts>
+            void execute(std::function<void (::nokia::net::proto::redis::reply &&)> callback, Ts &&... ts)
+            {
+                execute_command(std::move(callback), std::vector<std::string>{std::forward<Ts>(ts)...});
+            }
+
+
+            void execute_command(std::function<void (::nokia::net::proto::redis::reply &&)> callback, std::vector<std::string> const & command)
+            {
+                if (is_readonly(command))
+                {
+                    std::shared_ptr<replica> target = pick(nullptr);
+                    if (target)
+                    {
+                        double percentile{0};
+                        std::chrono::microseconds min_delay;
+                        {
+                            std::unique_lock<std::mutex> guard(_mutex);
+                            percentile = _hedging_percentile;
+                            min_delay = _hedging_min_delay;
+                        }
+                        if (0 == percentile || _replicas.size() < 2)
+                        {
+                            execute_on_replica(target, std::move(callback), command);
+                            return;
+                        }
+                        auto request = std::make_shared<hedged_request>(_io_service, std::move(callback));
+                        execute_on_replica(target, request->reply_handler(), command);
+                        request->hedge_after(std::max(target->latency.percentile(percentile), min_delay),
+                                             [this, target, request, command] ()
+                                             {
+                                                 std::shared_ptr<replica> second = pick(target.get());
+                                                 if (!second)
+                                                 {
+                                                     return;
+                                                 }
+                                                 ++_hedged_requests;
+                                                 execute_on_replica(second, request->reply_handler(), command);
+                                             });
+                        return;
+                    }
+                }
+                execute_on_primary(std::move(callback), command);
+            }
+
+
+            /*
+             * Send the command to the primary even if it's read-only, e.g. to read own writes without write sync.
+             */
+            void execute_on_primary(std::function<void (::nokia::net::proto::redis::reply &&)> callback, std::vector<std::string> const & command)
+            {
+                unsigned sync_replicas{0};
+                std::chrono::milliseconds sync_timeout;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    sync_replicas = _sync_replicas;
+                    sync_timeout = _sync_timeout;
+                }
+                if (0 == sync_replicas || is_readonly(command))
+                {
+                    _primary->execute_command(std::move(callback), command);
+                    return;
+                }
+
+                auto result = std::make_shared<::nokia::net::proto::redis::reply>();
+                _primary->execute_command([result] (::nokia::net::proto::redis::reply && reply)
+                                          {
+                                              *result = std::move(reply);
+                                          },
+                                          command);
+                _primary->execute([result, callback] (::nokia::net::proto::redis::reply && reply)
+                                  {
+                                      // The write is replied first, unless it couldn't be sent at all.
+                                      if (::nokia::net::proto::redis::reply::INVALID == result->type)
+                                      {
+                                          callback(std::move(reply));
+                                          return;
+                                      }
+                                      callback(std::move(*result));
+                                  },
+                                  "WAIT", std::to_string(sync_replicas), std::to_string(sync_timeout.count()));
+            }
+
+
+            std::vector<replica_info> replicas() const
+            {
+                std::vector<replica_info> result;
+                for (auto const & replica: _replicas)
+                {
+                    result.push_back({replica->address,
+                                      replica->connection->connected(),
+                                      replica->connection->pending_requests(),
+                                      replica->rtt()});
+                }
+                return result;
+            }
+
+
+            // Number of reads sent to a second replica
+            uint64_t hedged_requests() const
+            {
+                return _hedged_requests;
+            }
+
+
+        protected:
+
+            struct replica
+            {
+                replica(boost::asio::io_service & io_service):
+                    connection(std::make_shared<redis_connection>(io_service))
+                {}
+
+                // Of the reads, or of the health probe if there's no read yet
+                std::chrono::microseconds rtt() const
+                {
+                    return (0 != latency.samples()) ? latency.average() : connection->rtt().average();
+                }
+
+                std::string address;
+                std::shared_ptr<redis_connection> connection;
+                latency_tracker latency;
+            };
+
+
+            void execute_on_replica(std::shared_ptr<replica> target,
+                                    std::function<void (::nokia::net::proto::redis::reply &&)> callback,
+                                    std::vector<std::string> const & command)
+            {
+                auto const start = std::chrono::steady_clock::now();
+                target->connection->execute_command([target, start, callback] (::nokia::net::proto::redis::reply && reply)
+                                                    {
+                                                        if (::nokia::net::proto::redis::reply::ERROR != reply.type ||
+                                                            (target->connection->ERROR_TCP_DISCONNECTED != reply.str &&
+                                                             target->connection->ERROR_TCP_CANNOT_SEND_MESSAGE != reply.str))
+                                                        {
+                                                            target->latency.add(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+                                                        }
+                                                        callback(std::move(reply));
+                                                    },
+                                                    command);
+            }
+
+
+            // exclude: replica which has already got the request or nullptr
+            std::shared_ptr<replica> pick(replica const * exclude)
+            {
+                if (_replicas.empty())
+                {
+                    return nullptr;
+                }
+                std::shared_ptr<replica> best;
+                uint64_t best_cost = std::numeric_limits<uint64_t>::max();
+                // Rotate the start point, so equal replicas share the load.
+                std::size_t const start = _next++;
+                for (std::size_t i = 0; i < _replicas.size(); ++i)
+                {
+                    auto & candidate = _replicas[(start + i) % _replicas.size()];
+                    if (candidate.get() == exclude || !candidate->connection->connected())
+                    {
+                        continue;
+                    }
+                    // Expected waiting time: rtt * (queue length + 1)
+                    uint64_t const cost = static_cast<uint64_t>(candidate->rtt().count() + 1) * (candidate->connection->pending_requests() + 1);
+                    if (cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best = candidate;
+                    }
+                }
+                return best;
+            }
+
+
+        private:
+
+            boost::asio::io_service & _io_service;
+            std::shared_ptr<redis_connection> _primary;
+            std::vector<std::shared_ptr<replica>> _replicas;
+
+            std::mutex _mutex;
+            unsigned _sync_replicas;
+            std::chrono::milliseconds _sync_timeout;
+            double _hedging_percentile;
+            std::chrono::microseconds _hedging_min_delay;
+            std::chrono::milliseconds _probe_interval;
+            std::chrono::milliseconds _probe_min_timeout;
+            std::atomic<std::size_t> _next;
+            std::atomic<uint64_t> _hedged_requests;
+        };
+
+    }
+}
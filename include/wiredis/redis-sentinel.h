@@ -0,0 +1,411 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include <wiredis/redis-connection.h>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Connection to the master of a redis replication group monitored by Sentinels.
+         *
+         * The address of the master is asked from the sentinels (SENTINEL get-master-addr-by-name)
+         * and the client subscribes to +switch-master on them. After failover the connection
+         * is repointed to the new master at once, instead of reconnecting to the old address.
+         */
+        class redis_sentinel
+        {
+        public:
+
+            std::string const SWITCH_MASTER_CHANNEL;
+
+
+            redis_sentinel(boost::asio::io_service & io_service):
+                SWITCH_MASTER_CHANNEL{"+switch-master"},
+                _io_service(io_service),
+                _master(io_service),
+                _sentinel(io_service),
+                _subscriber(io_service),
+                _retry_timer(io_service),
+                _query_timer(io_service),
+                _retry_interval(1000),
+                _keepalive_enabled(true),
+                _running(false),
+                _master_started(false),
+                _sentinel_index(0),
+                _master_port(0)
+            {
+            }
+
+
+            ~redis_sentinel()
+            {
+            }
+
+
+            void set_log_callback(std::function<void (std::string const &)> cb)
+            {
+                _log_callback = cb;
+                _master.set_log_callback(cb);
+                _sentinel.set_log_callback(cb);
+                _subscriber.set_log_callback(cb);
+            }
+
+
+            /*
+             * sentinels: ip/port of the sentinels. They are tried one after the other until one answers.
+             *
+             * master_name: name of the monitored master in the sentinel configuration.
+             *
+             * connected_callback: called if the connection to the master is established or failed
+             *     (also after failover). In case of error the master address is asked again from the sentinels.
+             *
+             * disconnected_callback: called if the connection to the master is lost.
+             */
+            void connect(std::vector<std::pair<std::string, uint16_t>> const & sentinels,
+                         std::string const & master_name,
+                         std::function<void (boost::system::error_code const &)> connected_callback,
+                         std::function<void (boost::system::error_code const &)> disconnected_callback,
+                         bool keepalive_enabled = true)
+            {
+                if (sentinels.empty())
+                {
+                    throw std::invalid_argument("redis_sentinel: list of sentinels is empty");
+                }
+                _sentinels = sentinels;
+                _master_name = master_name;
+                _connected_callback = connected_callback;
+                _disconnected_callback = disconnected_callback;
+                _keepalive_enabled = keepalive_enabled;
+                _running = true;
+
+                auto const & sentinel = _sentinels[_sentinel_index];
+                _sentinel.connect(sentinel.first,
+                                  sentinel.second,
+                                  std::bind(&redis_sentinel::on_sentinel_connected, this, std::placeholders::_1),
+                                  std::bind(&redis_sentinel::on_sentinel_disconnected, this, std::placeholders::_1),
+                                  false,    // next_sentinel() reconnects, to the next sentinel
+                                  keepalive_enabled);
+                _subscriber.connect(sentinel.first,
+                                    sentinel.second,
+                                    std::bind(&redis_sentinel::on_subscriber_connected, this, std::placeholders::_1),
+                                    nullptr,
+                                    true,
+                                    keepalive_enabled);
+            }
+
+
+            void disconnect()
+            {
+                _io_service.dispatch([this] ()
+                                     {
+                                         _running = false;
+                                         _retry_timer.cancel();
+                                         _query_timer.cancel();
+                                     });
+                _subscriber.disconnect();
+                _sentinel.disconnect();
+                _master.disconnect();
+            }
+
+
+            // Connected to the master
+            bool connected() const
+            {
+                return _master.connected();
+            }
+
+
+            // Current address of the master, port is 0 if it isn't known yet
+            std::pair<std::string, uint16_t> master() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return std::make_pair(_master_ip, _master_port);
+            }
+
+
+            void join(std::function<void ()> cb)
+            {
+                _subscriber.join([this, cb] ()
+                                 {
+                                     _sentinel.join([this, cb] ()
+                                                    {
+                                                        _master.join(cb);
+                                                    });
+                                 });
+            }
+
+
+            void sync_join()
+            {
+                // Blocking join. Do not call from io_service thread!
+                std::mutex mutex;
+                std::unique_lock<std::mutex> guard(mutex);
+                std::condition_variable cv;
+                bool done{false};
+
+                join([&] ()
+                     {
+                         std::unique_lock<std::mutex> guard(mutex);
+                         done = true;
+                         cv.notify_one();
+                     });
+                cv.wait(guard, [&] () { return done; });
+            }
+
+
+            template <typename... Ts>
+            void execute(std::function<void (::nokia::net::proto::redis::reply &&)> callback, Ts &&... ts)
+            {
+                _master.execute(std::move(callback), std::forward<Ts>(ts)...);
+            }
+
+
+            void execute_command(std::function<void (::nokia::net::proto::redis::reply &&)> callback, std::vector<std::string> const & command)
+            {
+                _master.execute_command(std::move(callback), command);
+            }
+
+
+        protected:
+
+            void on_sentinel_connected(boost::system::error_code const & error)
+            {
+                if (error)
+                {
+                    next_sentinel();
+                    return;
+                }
+                query_master();
+            }
+
+
+            void on_sentinel_disconnected(boost::system::error_code const &)
+            {
+                next_sentinel();
+            }
+
+
+            void on_subscriber_connected(boost::system::error_code const & error)
+            {
+                if (error)
+                {
+                    return;
+                }
+                // Subscriptions are dropped on reconnect, subscribe again.
+                _subscriber.subscribe(SWITCH_MASTER_CHANNEL,
+                                      [] () {},
+                                      std::bind(&redis_sentinel::on_switch_master, this, std::placeholders::_1, std::placeholders::_2),
+                                      [] () {});
+            }
+
+
+            // Try the next sentinel of the list
+            void next_sentinel()
+            {
+                if (!_running)
+                {
+                    return;
+                }
+                _sentinel_index = (_sentinel_index + 1) % _sentinels.size();
+                if (0 == _sentinel_index)
+                {
+                    // None of the sentinels is available, wait before the next round.
+                    _retry_timer.expires_from_now(_retry_interval);
+                    _retry_timer.async_wait([this] (boost::system::error_code const & error)
+                                            {
+                                                if (::boost::asio::error::operation_aborted == error)
+                                                {
+                                                    return;
+                                                }
+                                                repoint_sentinel();
+                                            });
+                    return;
+                }
+                // Called from the callback of the connection, it has to return first.
+                _io_service.post([this] ()
+                                 {
+                                     repoint_sentinel();
+                                 });
+            }
+
+
+            void repoint_sentinel()
+            {
+                if (!_running)
+                {
+                    return;
+                }
+                auto const & sentinel = _sentinels[_sentinel_index];
+                _sentinel.repoint(sentinel.first, sentinel.second);
+                _subscriber.repoint(sentinel.first, sentinel.second);
+            }
+
+
+            void query_master()
+            {
+                _sentinel.execute([this] (::nokia::net::proto::redis::reply && reply)
+                                  {
+                                      if (!_running)
+                                      {
+                                          return;
+                                      }
+                                      if (::nokia::net::proto::redis::reply::ARRAY != reply.type || 2 != reply.elements.size())
+                                      {
+                                          if (_sentinel.ERROR_TCP_DISCONNECTED != reply.str)
+                                          {
+                                              ferror("redis-sentinel error: cannot get master address. name=%1%, reply=%2%", _master_name, reply.str);
+                                              retry_query();
+                                          }
+                                          return;
+                                      }
+                                      set_master(reply.elements[0].str, static_cast<uint16_t>(std::atoi(reply.elements[1].str.c_str())));
+                                  },
+                                  "SENTINEL", "get-master-addr-by-name", _master_name);
+            }
+
+
+            void retry_query()
+            {
+                _query_timer.expires_from_now(_retry_interval);
+                _query_timer.async_wait([this] (boost::system::error_code const & error)
+                                        {
+                                            if (::boost::asio::error::operation_aborted == error || !_running)
+                                            {
+                                                return;
+                                            }
+                                            query_master();
+                                        });
+            }
+
+
+            // Message: <master name> <old ip> <old port> <new ip> <new port>
+            void on_switch_master(std::string const &, std::string const & message)
+            {
+                std::istringstream stream(message);
+                std::string name, old_ip, old_port, new_ip;
+                uint16_t new_port{0};
+                stream >> name >> old_ip >> old_port >> new_ip >> new_port;
+                if (!stream || name != _master_name)
+                {
+                    return;
+                }
+                set_master(new_ip, new_port);
+            }
+
+
+            void set_master(std::string const & ip, uint16_t port)
+            {
+                if (!_running)
+                {
+                    return;
+                }
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if (_master_started && ip == _master_ip && port == _master_port)
+                    {
+                        return;
+                    }
+                    _master_ip = ip;
+                    _master_port = port;
+                }
+                if (!_master_started)
+                {
+                    _master_started = true;
+                    _master.connect(ip,
+                                    port,
+                                    std::bind(&redis_sentinel::on_master_connected, this, std::placeholders::_1),
+                                    std::bind(&redis_sentinel::on_master_disconnected, this, std::placeholders::_1),
+                                    true,
+                                    _keepalive_enabled);
+                    return;
+                }
+                _master.repoint(ip, port);
+            }
+
+
+            void on_master_connected(boost::system::error_code const & error)
+            {
+                if (_connected_callback)
+                {
+                    _connected_callback(error);
+                }
+                if (error)
+                {
+                    // The master may have been changed, don't wait for the old one.
+                    query_master();
+                }
+            }
+
+
+            void on_master_disconnected(boost::system::error_code const & error)
+            {
+                if (_disconnected_callback)
+                {
+                    _disconnected_callback(error);
+                }
+                query_master();
+            }
+
+
+            template <typename... Ts>
+            void ferror(Ts &&... ts)
+            {
+                std::string message = detail::concatenate(std::forward<Ts>(ts)...);
+                if (_log_callback)
+                {
+                    _log_callback(message);
+                }
+                else
+                {
+                    std::cerr << message << std::endl;
+                }
+            }
+
+
+        private:
+
+            boost::asio::io_service & _io_service;
+            redis_connection _master;
+            redis_connection _sentinel;     // for queries
+            redis_connection _subscriber;   // for +switch-master notifications
+            boost::asio::steady_timer _retry_timer;     // next round of the sentinels
+            boost::asio::steady_timer _query_timer;     // next query of the master address
+            std::chrono::milliseconds _retry_interval;
+
+            std::vector<std::pair<std::string, uint16_t>> _sentinels;
+            std::string _master_name;
+            std::function<void (boost::system::error_code const &)> _connected_callback;
+            std::function<void (boost::system::error_code const &)> _disconnected_callback;
+            std::function<void (std::string const &)> _log_callback;
+            bool _keepalive_enabled;
+
+            // Set by connect() and disconnect() from any thread
+            std::atomic<bool> _running;
+
+            // Below are used in the io_service thread only, except the master address
+            bool _master_started;
+            std::size_t _sentinel_index;
+
+            mutable std::mutex _mutex;
+            std::string _master_ip;
+            uint16_t _master_port;
+        };
+
+    }
+}
@@ -0,0 +1,478 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <wiredis/commands.h>
+#include <wiredis/hash-slot.h>
+#include <wiredis/md5.h>
+#include <wiredis/redis-connection.h>
+#include <wiredis/scatter.h>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Client-side sharding over independent redis servers (no cluster mode).
+         *
+         * Keys are mapped to the servers by consistent hashing compatible with ketama: every server
+         * has points_per_node virtual nodes on a 32 bit ring, a key belongs to the first point after its
+         * hash. Adding or removing a server moves only the keys of its own ring segments.
+         * Hash tags work the same way as in redis cluster: only the {...} part of the key is hashed.
+         */
+        class redis_sharded
+        {
+        public:
+
+            std::string const ERROR_NO_NODE;
+
+
+            /*
+             * points_per_node: virtual nodes per server on the ring (ketama uses 160).
+             */
+            redis_sharded(boost::asio::io_service & io_service, std::size_t points_per_node = 160):
+                ERROR_NO_NODE{"NO NODE AVAILABLE"},
+                _io_service(io_service),
+                _points_per_node(points_per_node),
+                _keepalive_enabled(true),
+                _running(false),
+                _next(0)
+            {
+            }
+
+
+            ~redis_sharded()
+            {
+            }
+
+
+            void set_log_callback(std::function<void (std::string const &)> cb)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _log_callback = cb;
+                for (auto & item: _shards)
+                {
+                    item.second->connection->set_log_callback(cb);
+                }
+            }
+
+
+            /*
+             * nodes: ip/port of the servers.
+             *
+             * The callbacks are called for every server, including the ones added later.
+             */
+            void connect(std::vector<std::pair<std::string, uint16_t>> const & nodes,
+                         std::function<void (boost::system::error_code const &)> connected_callback,
+                         std::function<void (boost::system::error_code const &)> disconnected_callback,
+                         bool keepalive_enabled = true)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _connected_callback = connected_callback;
+                _disconnected_callback = disconnected_callback;
+                _keepalive_enabled = keepalive_enabled;
+                _running = true;
+                // Added by add_node() before connect()
+                for (auto & item: _shards)
+                {
+                    connect_shard(*item.second);
+                }
+                for (auto const & node: nodes)
+                {
+                    insert_shard(node.first, node.second);
+                }
+                build_ring();
+            }
+
+
+            /*
+             * The new server takes over the keys of its ring segments, about 1/(n+1) of the keys.
+             * Can be called before connect() too.
+             */
+            void add_node(std::string const & ip, uint16_t port)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                insert_shard(ip, port);
+                build_ring();
+            }
+
+
+            /*
+             * The keys of the server go to the neighbours on the ring, other keys stay where they are.
+             * Requests waiting for the reply of the removed server are called back with ERROR_TCP_DISCONNECTED.
+             */
+            void remove_node(std::string const & ip, uint16_t port)
+            {
+                std::shared_ptr<shard> removed;
+                auto joined = std::make_shared<std::atomic<bool>>(false);
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    auto it = _shards.find(ip + ":" + std::to_string(port));
+                    if (_shards.end() == it)
+                    {
+                        return;
+                    }
+                    removed = it->second;
+                    _shards.erase(it);
+                    build_ring();
+                    // The ones removed earlier are released once they have joined.
+                    _retired.erase(std::remove_if(_retired.begin(),
+                                                  _retired.end(),
+                                                  [] (retired_connection const & item)
+                                                  {
+                                                      return item.joined->load();
+                                                  }),
+                                   _retired.end());
+                    _retired.push_back(retired_connection{removed->connection, joined});
+                }
+                removed->connection->disconnect();
+                auto & io_service = _io_service;
+                removed->connection->join([joined, &io_service] ()
+                                          {
+                                              // After the handlers already queued for the connection
+                                              io_service.post([joined] ()
+                                                              {
+                                                                  *joined = true;
+                                                              });
+                                          });
+            }
+
+
+            void disconnect()
+            {
+                std::vector<std::shared_ptr<redis_connection>> connections;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _running = false;
+                    for (auto & item: _shards)
+                    {
+                        connections.push_back(item.second->connection);
+                    }
+                }
+                for (auto & connection: connections)
+                {
+                    connection->disconnect();
+                }
+            }
+
+
+            // True if every server is connected
+            bool connected() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                if (_shards.empty())
+                {
+                    return false;
+                }
+                for (auto const & item: _shards)
+                {
+                    if (!item.second->connection->connected())
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+
+            // "ip:port" of the servers
+            std::vector<std::string> nodes() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                std::vector<std::string> result;
+                for (auto const & item: _shards)
+                {
+                    result.push_back(item.first);
+                }
+                return result;
+            }
+
+
+            // Connection of every server, e.g. for scan_parallel()
+            std::vector<std::shared_ptr<redis_connection>> connections() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                std::vector<std::shared_ptr<redis_connection>> result;
+                for (auto const & item: _shards)
+                {
+                    result.push_back(item.second->connection);
+                }
+                return result;
+            }
+
+
+            // "ip:port" of the server of the key, empty if there's no server
+            std::string node_of(std::string const & key) const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                std::shared_ptr<shard> target = find_shard(key);
+                return target ? target->address : std::string();
+            }
+
+
+            void join(std::function<void ()> cb)
+            {
+                std::vector<std::shared_ptr<redis_connection>> connections;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    for (auto & item: _shards)
+                    {
+                        connections.push_back(item.second->connection);
+                    }
+                    for (auto & item: _retired)
+                    {
+                        connections.push_back(item.connection);
+                    }
+                }
+                if (connections.empty())
+                {
+                    // Called back later, the caller may hold a lock.
+                    _io_service.post(cb);
+                    return;
+                }
+                auto remaining = std::make_shared<std::atomic<std::size_t>>(connections.size());
+                for (auto & connection: connections)
+                {
+                    connection->join([remaining, cb] ()
+                                     {
+                                         if (0 == --(*remaining))
+                                         {
+                                             cb();
+                                         }
+                                     });
+                }
+            }
+
+
+            void sync_join()
+            {
+                // Blocking join. Do not call from io_service thread!
+                std::mutex mutex;
+                std::unique_lock<std::mutex> guard(mutex);
+                std::condition_variable cv;
+                bool done{false};
+
+                join([&] ()
+                     {
+                         std::unique_lock<std::mutex> guard(mutex);
+                         done = true;
+                         cv.notify_one();
+                     });
+                cv.wait(guard, [&] () { return done; });
+            }
+
+
+            template <typename... Ts>
+            void execute(std::function<void (::nokia::net::proto::redis::reply &&)> callback, Ts &&... ts)
+            {
+                execute_command(std::move(callback), std::vector<std::string>{std::forward<Ts>(ts)...});
+            }
+
+
+            /*
+             * The command is sent to the server of its first key. Commands without key are sent to
+             * the servers in round-robin order.
+             *
+             * MGET, MSET, DEL, UNLINK, EXISTS and TOUCH with keys of several servers are split by server,
+             * the parts are sent in parallel and the callback gets the merged reply (in the original key order).
+             * Other multi-key commands need hash tags to keep their keys on the same server.
+             */
+            void execute_command(std::function<void (::nokia::net::proto::redis::reply &&)> callback, std::vector<std::string> const & command)
+            {
+                std::vector<std::vector<std::string>> commands;
+                std::vector<std::shared_ptr<shard>> targets;
+                std::shared_ptr<scattered_request> scattered;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    scattered = scatter<std::shared_ptr<shard>>(command,
+                                                                callback,
+                                                                [this] (std::string const & key)
+                                                                {
+                                                                    return find_shard(key);
+                                                                },
+                                                                commands,
+                                                                targets);
+                    if (!scattered)
+                    {
+                        targets.push_back(route(command));
+                    }
+                }
+                if (!scattered)
+                {
+                    send(targets.front(), std::move(callback), command);
+                    return;
+                }
+                for (std::size_t part = 0; part < commands.size(); ++part)
+                {
+                    send(targets[part],
+                         [scattered, part] (::nokia::net::proto::redis::reply && reply)
+                         {
+                             scattered->on_reply(part, std::move(reply));
+                         },
+                         commands[part]);
+                }
+            }
+
+
+        protected:
+
+            struct shard
+            {
+                std::string address;
+                std::string ip;
+                uint16_t port;
+                std::shared_ptr<redis_connection> connection;
+            };
+
+
+            struct retired_connection
+            {
+                std::shared_ptr<redis_connection> connection;
+                std::shared_ptr<std::atomic<bool>> joined;
+            };
+
+
+            // Has to be called under the lock
+            void insert_shard(std::string const & ip, uint16_t port)
+            {
+                std::string const address = ip + ":" + std::to_string(port);
+                if (_shards.count(address))
+                {
+                    return;
+                }
+                auto new_shard = std::make_shared<shard>();
+                new_shard->address = address;
+                new_shard->connection = std::make_shared<redis_connection>(_io_service);
+                if (_log_callback)
+                {
+                    new_shard->connection->set_log_callback(_log_callback);
+                }
+                new_shard->ip = ip;
+                new_shard->port = port;
+                if (_running)
+                {
+                    connect_shard(*new_shard);
+                }
+                _shards.emplace(address, new_shard);
+            }
+
+
+            void connect_shard(shard & target)
+            {
+                target.connection->connect(target.ip, target.port, _connected_callback, _disconnected_callback, true, _keepalive_enabled);
+            }
+
+
+            // Ketama: every MD5 digest of "<ip:port>-<n>" gives 4 points. Has to be called under the lock.
+            void build_ring()
+            {
+                _ring.clear();
+                for (auto const & item: _shards)
+                {
+                    for (std::size_t n = 0; n < (_points_per_node + 3) / 4; ++n)
+                    {
+                        auto const digest = md5(item.first + "-" + std::to_string(n));
+                        for (int part = 0; part < 4; ++part)
+                        {
+                            // The first server wins in the rare case of collision.
+                            _ring.emplace(ring_point(digest, part), item.second);
+                        }
+                    }
+                }
+            }
+
+
+            static uint32_t ring_point(std::array<uint8_t, 16> const & digest, int part)
+            {
+                return (static_cast<uint32_t>(digest[3 + part * 4]) << 24) |
+                    (static_cast<uint32_t>(digest[2 + part * 4]) << 16) |
+                    (static_cast<uint32_t>(digest[1 + part * 4]) << 8) |
+                    static_cast<uint32_t>(digest[part * 4]);
+            }
+
+
+            // Has to be called under the lock
+            std::shared_ptr<shard> find_shard(std::string const & key) const
+            {
+                if (_ring.empty())
+                {
+                    return nullptr;
+                }
+                std::size_t start{0};
+                std::size_t length{0};
+                hash_tag(key, start, length);
+                auto it = _ring.lower_bound(ring_point(md5(key.data() + start, length), 0));
+                if (_ring.end() == it)
+                {
+                    it = _ring.begin();
+                }
+                return it->second;
+            }
+
+
+            // Has to be called under the lock
+            std::shared_ptr<shard> route(std::vector<std::string> const & command)
+            {
+                std::size_t const key_index = first_key_index(command);
+                if (0 != key_index)
+                {
+                    return find_shard(command[key_index]);
+                }
+                if (_shards.empty())
+                {
+                    return nullptr;
+                }
+                return std::next(_shards.begin(), _next++ % _shards.size())->second;
+            }
+
+
+            void send(std::shared_ptr<shard> const & target,
+                      std::function<void (::nokia::net::proto::redis::reply &&)> callback,
+                      std::vector<std::string> const & command)
+            {
+                if (!target)
+                {
+                    ::nokia::net::proto::redis::reply error_reply;
+                    error_reply.type = ::nokia::net::proto::redis::reply::ERROR;
+                    error_reply.str = ERROR_NO_NODE;
+                    callback(std::move(error_reply));
+                    return;
+                }
+                target->connection->execute_command(std::move(callback), command);
+            }
+
+
+        private:
+
+            boost::asio::io_service & _io_service;
+            std::size_t const _points_per_node;
+            std::function<void (boost::system::error_code const &)> _connected_callback;
+            std::function<void (boost::system::error_code const &)> _disconnected_callback;
+            std::function<void (std::string const &)> _log_callback;
+            bool _keepalive_enabled;
+            bool _running;
+
+            mutable std::mutex _mutex;
+            std::map<std::string, std::shared_ptr<shard>> _shards;     // by "ip:port"
+            std::map<uint32_t, std::shared_ptr<shard>> _ring;
+            std::vector<retired_connection> _retired;  // removed servers, joined by join()
+            std::size_t _next;
+        };
+
+    }
+}
@@ -0,0 +1,301 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <wiredis/proto/redis.h>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Iterates SCAN, HSCAN, SSCAN or ZSCAN, the pages (the items of one reply) are passed to the
+         * consumer one by one.
+         *
+         * The next page is requested while the consumer is processing the current one, but not more:
+         * at most one page waits. pause() stops the delivery (e.g. until the consumer's own requests are
+         * done), resume() continues it; the cursor doesn't go ahead meanwhile.
+         *
+         * Client: anything with execute_command(), e.g. redis_connection or redis_pool (the cursor isn't
+         * bound to a connection). See scan_parallel() for cluster and shards.
+         */
+        template <typename Client>
+        class scan_iterator: public std::enable_shared_from_this<scan_iterator<Client>>
+        {
+        public:
+
+            // HSCAN and ZSCAN items are field/member and value/score pairs, one after the other.
+            typedef std::function<void (std::vector<std::string> && items)> page_callback;
+            // Empty string if the whole collection has been iterated, otherwise the error
+            typedef std::function<void (std::string const & error)> done_callback;
+
+
+            /*
+             * command: {"SCAN"}, or {"HSCAN", key}, {"SSCAN", key}, {"ZSCAN", key}
+             * options: sent after the cursor, e.g. {"MATCH", "session:*", "COUNT", "1000"}
+             * on_page: called in the io_service thread (or in the thread of resume())
+             * on_done: called once, after the last page is processed
+             * paused: nothing is delivered until resume() (the first page is requested meanwhile), e.g. if
+             *     on_page refers to the returned iterator
+             */
+            static std::shared_ptr<scan_iterator> start(Client & client,
+                                                        std::vector<std::string> command,
+                                                        std::vector<std::string> options,
+                                                        page_callback on_page,
+                                                        done_callback on_done,
+                                                        bool paused = false)
+            {
+                std::shared_ptr<scan_iterator> iterator(new scan_iterator(client, std::move(command), std::move(options), std::move(on_page), std::move(on_done)));
+                iterator->_paused = paused;
+                iterator->pump();
+                return iterator;
+            }
+
+
+            void pause()
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _paused = true;
+            }
+
+
+            void resume()
+            {
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _paused = false;
+                }
+                pump();
+            }
+
+
+            // No more pages are requested or delivered, on_done gets "stopped".
+            void stop()
+            {
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if (_error.empty())
+                    {
+                        _error = "stopped";
+                    }
+                    _has_page = false;
+                    _page.clear();
+                }
+                pump();
+            }
+
+
+            bool done() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _done;
+            }
+
+
+        private:
+
+            scan_iterator(Client & client,
+                          std::vector<std::string> && command,
+                          std::vector<std::string> && options,
+                          page_callback && on_page,
+                          done_callback && on_done):
+                _client(client),
+                _command(std::move(command)),
+                _options(std::move(options)),
+                _on_page(std::move(on_page)),
+                _on_done(std::move(on_done)),
+                _cursor("0"),
+                _end(false),
+                _fetching(false),
+                _has_page(false),
+                _delivering(false),
+                _paused(false),
+                _done(false)
+            {
+            }
+
+
+            void fetch()
+            {
+                std::vector<std::string> command(_command);
+                command.push_back(_cursor);
+                command.insert(command.end(), _options.begin(), _options.end());
+                auto self = this->shared_from_this();
+                _client.execute_command([self] (::nokia::net::proto::redis::reply && reply)
+                                        {
+                                            self->on_reply(std::move(reply));
+                                        },
+                                        command);
+            }
+
+
+            void on_reply(::nokia::net::proto::redis::reply && reply)
+            {
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    _fetching = false;
+                    if (!_error.empty())
+                    {
+                        // Stopped meanwhile
+                    }
+                    else if (::nokia::net::proto::redis::reply::ERROR == reply.type)
+                    {
+                        _error = reply.str;
+                    }
+                    else if (::nokia::net::proto::redis::reply::ARRAY != reply.type ||
+                             2 != reply.elements.size() ||
+                             ::nokia::net::proto::redis::reply::ARRAY != reply.elements[1].type)
+                    {
+                        _error = "ERR unexpected reply of " + _command.front();
+                    }
+                    else
+                    {
+                        _cursor = reply.elements[0].str;
+                        _end = ("0" == _cursor);
+                        // Empty pages are skipped, the next one is requested.
+                        for (auto & item: reply.elements[1].elements)
+                        {
+                            _page.push_back(std::move(item.str));
+                        }
+                        _has_page = !_page.empty();
+                    }
+                }
+                pump();
+            }
+
+
+            // Delivers the waiting page, requests the next one, or reports the end.
+            void pump()
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                while (!_delivering && !_done)
+                {
+                    bool const failed = !_error.empty();
+                    if (!failed && !_has_page && !_fetching && !_end)
+                    {
+                        _fetching = true;
+                        guard.unlock();
+                        fetch();
+                        guard.lock();
+                        continue;
+                    }
+                    if (!failed && _has_page && !_paused)
+                    {
+                        std::vector<std::string> page;
+                        page.swap(_page);
+                        _has_page = false;
+                        _delivering = true;
+                        // The next page is on the way while the consumer processes this one.
+                        bool const prefetch = !_end && !_fetching;
+                        _fetching = _fetching || prefetch;
+                        guard.unlock();
+                        if (prefetch)
+                        {
+                            fetch();
+                        }
+                        _on_page(std::move(page));
+                        guard.lock();
+                        _delivering = false;
+                        continue;
+                    }
+                    if (!_fetching && !_has_page && (failed || _end))
+                    {
+                        _done = true;
+                        std::string const error = _error;
+                        guard.unlock();
+                        _on_done(error);
+                        return;
+                    }
+                    return;
+                }
+            }
+
+
+            Client & _client;
+            std::vector<std::string> const _command;
+            std::vector<std::string> const _options;
+            page_callback _on_page;
+            done_callback _on_done;
+
+            mutable std::mutex _mutex;
+            std::string _cursor;
+            bool _end;                          // the last page has been got
+            bool _fetching;
+            std::vector<std::string> _page;     // got, not delivered yet
+            bool _has_page;
+            bool _delivering;
+            bool _paused;
+            bool _done;
+            std::string _error;
+        };
+
+
+        /*
+         * SCAN of every server at once, e.g. redis_cluster::connections() or redis_sharded::connections().
+         * Every server has its own iterator (pause and resume them one by one), on_page may be called
+         * from several threads if the connections run in different io_services. on_done is called once,
+         * after every iterator has finished, with the first error.
+         */
+        template <typename Connection>
+        std::vector<std::shared_ptr<scan_iterator<Connection>>> scan_parallel(std::vector<std::shared_ptr<Connection>> const & connections,
+                                                                               std::vector<std::string> const & options,
+                                                                               typename scan_iterator<Connection>::page_callback on_page,
+                                                                               typename scan_iterator<Connection>::done_callback on_done)
+        {
+            struct progress
+            {
+                std::mutex mutex;
+                std::size_t remaining;
+                std::string error;
+            };
+            auto state = std::make_shared<progress>();
+            state->remaining = connections.size();
+            if (connections.empty())
+            {
+                on_done("");
+                return {};
+            }
+            std::vector<std::shared_ptr<scan_iterator<Connection>>> iterators;
+            for (auto const & connection: connections)
+            {
+                // The connection is kept alive by the iterator.
+                iterators.push_back(scan_iterator<Connection>::start(*connection,
+                                                                     {"SCAN"},
+                                                                     options,
+                                                                     [connection, on_page] (std::vector<std::string> && items)
+                                                                     {
+                                                                         on_page(std::move(items));
+                                                                     },
+                                                                     [connection, state, on_done] (std::string const & error)
+                                                                     {
+                                                                         std::string result;
+                                                                         {
+                                                                             std::unique_lock<std::mutex> guard(state->mutex);
+                                                                             if (state->error.empty())
+                                                                             {
+                                                                                 state->error = error;
+                                                                             }
+                                                                             if (0 != --state->remaining)
+                                                                             {
+                                                                                 return;
+                                                                             }
+                                                                             result = state->error;
+                                                                         }
+                                                                         on_done(result);
+                                                                     }));
+            }
+            return iterators;
+        }
+
+    }
+}
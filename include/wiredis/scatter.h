@@ -0,0 +1,183 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <wiredis/commands.h>
+#include <wiredis/proto/redis.h>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Multi-key command split into parts, one part per shard (hash slot, node, ...).
+         * The callback is called once, with the merged reply, after the last part is replied.
+         */
+        struct scattered_request
+        {
+            enum merge
+            {
+                VALUES,     // MGET: array of values in key order
+                STATUS,     // MSET: OK if every part succeeded
+                SUM         // DEL, UNLINK, EXISTS, TOUCH: number of keys
+            };
+
+            merge merge_type;
+            std::size_t keys;
+            std::function<void (::nokia::net::proto::redis::reply &&)> callback;
+            std::vector<std::vector<std::size_t>> positions;     // original key positions of every part
+            std::vector<::nokia::net::proto::redis::reply> replies;
+            std::atomic<std::size_t> remaining;
+
+
+            void on_reply(std::size_t part, ::nokia::net::proto::redis::reply && reply)
+            {
+                replies[part] = std::move(reply);
+                if (0 == --remaining)
+                {
+                    gather();
+                }
+            }
+
+
+            // The first error wins.
+            void gather()
+            {
+                ::nokia::net::proto::redis::reply result;
+                for (std::size_t part = 0; part < replies.size(); ++part)
+                {
+                    auto & reply = replies[part];
+                    if (::nokia::net::proto::redis::reply::ERROR == reply.type)
+                    {
+                        callback(std::move(reply));
+                        return;
+                    }
+                    switch (merge_type)
+                    {
+                    case VALUES:
+                        if (::nokia::net::proto::redis::reply::ARRAY != reply.type || reply.elements.size() != positions[part].size())
+                        {
+                            result.type = ::nokia::net::proto::redis::reply::ERROR;
+                            result.str = "ERR unexpected reply of a part of MGET";
+                            callback(std::move(result));
+                            return;
+                        }
+                        result.type = ::nokia::net::proto::redis::reply::ARRAY;
+                        result.elements.resize(keys);
+                        for (std::size_t i = 0; i < reply.elements.size(); ++i)
+                        {
+                            result.elements[positions[part][i]] = std::move(reply.elements[i]);
+                        }
+                        break;
+                    case STATUS:
+                        result = std::move(reply);
+                        break;
+                    case SUM:
+                        result.type = ::nokia::net::proto::redis::reply::INTEGER;
+                        result.integer += reply.integer;
+                        break;
+                    }
+                }
+                callback(std::move(result));
+            }
+        };
+
+
+        /*
+         * Splits MGET, MSET, DEL, UNLINK, EXISTS and TOUCH by shard_of(key).
+         *
+         * Returns nullptr (and leaves the callback untouched) if the command can't be split or all of
+         * its keys belong to the same shard. Otherwise the callback is moved into the returned request,
+         * commands[i] has to be sent to shards[i] and its reply passed to on_reply(i, ...).
+         */
+        template <typename Shard>
+        std::shared_ptr<scattered_request> scatter(std::vector<std::string> const & command,
+                                                   std::function<void (::nokia::net::proto::redis::reply &&)> & callback,
+                                                   std::function<Shard (std::string const &)> const & shard_of,
+                                                   std::vector<std::vector<std::string>> & commands,
+                                                   std::vector<Shard> & shards)
+        {
+            if (command.size() < 3)
+            {
+                return nullptr;
+            }
+            std::string name = command[0];
+            std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+            scattered_request::merge merge_type;
+            if ("MGET" == name)
+            {
+                merge_type = scattered_request::VALUES;
+            }
+            else if ("MSET" == name)
+            {
+                merge_type = scattered_request::STATUS;
+            }
+            else if ("DEL" == name || "UNLINK" == name || "EXISTS" == name || "TOUCH" == name)
+            {
+                merge_type = scattered_request::SUM;
+            }
+            else
+            {
+                return nullptr;
+            }
+
+            std::vector<std::size_t> const indexes = key_indexes(command);
+            if (indexes.empty())
+            {
+                return nullptr;
+            }
+            std::vector<Shard> key_shards;
+            key_shards.reserve(indexes.size());
+            bool single_shard{true};
+            for (std::size_t index: indexes)
+            {
+                key_shards.push_back(shard_of(command[index]));
+                single_shard = single_shard && (key_shards.front() == key_shards.back());
+            }
+            if (single_shard)
+            {
+                return nullptr;
+            }
+
+            // Arguments belonging to a key: the key and its value in case of MSET
+            std::size_t const step = (1 < indexes.size()) ? indexes[1] - indexes[0] : command.size() - indexes[0];
+            std::map<Shard, std::size_t> parts;
+            auto scattered = std::make_shared<scattered_request>();
+            scattered->merge_type = merge_type;
+            scattered->keys = indexes.size();
+            scattered->callback = std::move(callback);
+            for (std::size_t i = 0; i < indexes.size(); ++i)
+            {
+                auto inserted = parts.emplace(key_shards[i], commands.size());
+                if (inserted.second)
+                {
+                    commands.emplace_back(1, command[0]);
+                    shards.push_back(key_shards[i]);
+                    scattered->positions.emplace_back();
+                }
+                std::size_t const part = inserted.first->second;
+                for (std::size_t j = indexes[i]; j < indexes[i] + step && j < command.size(); ++j)
+                {
+                    commands[part].push_back(command[j]);
+                }
+                scattered->positions[part].push_back(i);
+            }
+            scattered->replies.resize(commands.size());
+            scattered->remaining = commands.size();
+            return scattered;
+        }
+
+    }
+}
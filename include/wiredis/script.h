@@ -0,0 +1,128 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <wiredis/sha1.h>
+#include <wiredis/proto/redis.h>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        // Lua script with its SHA1 name, computed once
+        class script
+        {
+        public:
+
+            explicit script(std::string body):
+                _body(std::move(body)),
+                _sha(sha1_hex(_body))
+            {
+            }
+
+
+            std::string const & body() const
+            {
+                return _body;
+            }
+
+
+            std::string const & sha() const
+            {
+                return _sha;
+            }
+
+
+        private:
+
+            std::string _body;
+            std::string _sha;
+        };
+
+
+        /*
+         * Scripts loaded (SCRIPT LOAD) by the connections on every connect and reconnect, see
+         * redis_connection::set_scripts(). The same registry can be set on several connections.
+         */
+        class script_registry
+        {
+        public:
+
+            // Can be called any time, the connections load the script on their next connect.
+            std::shared_ptr<script const> add(std::string body)
+            {
+                auto added = std::make_shared<script const>(std::move(body));
+                std::unique_lock<std::mutex> guard(_mutex);
+                for (auto const & existing: _scripts)
+                {
+                    if (existing->sha() == added->sha())
+                    {
+                        return existing;
+                    }
+                }
+                _scripts.push_back(added);
+                return added;
+            }
+
+
+            std::vector<std::shared_ptr<script const>> scripts() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _scripts;
+            }
+
+
+        private:
+
+            mutable std::mutex _mutex;
+            std::vector<std::shared_ptr<script const>> _scripts;
+        };
+
+
+        /*
+         * Runs the script by EVALSHA, so only its SHA1 is sent. If the server doesn't have it (NOSCRIPT,
+         * e.g. after restart or SCRIPT FLUSH), it's sent again by EVAL, which loads it as well.
+         *
+         * client: anything with execute_command() (redis_connection, redis_pool, redis_cluster, ...).
+         *     The EVAL has the same keys, so a cluster sends it to the same node.
+         */
+        template <typename Client>
+        void execute_script(Client & client,
+                            std::shared_ptr<script const> const & lua,
+                            std::vector<std::string> const & keys,
+                            std::vector<std::string> const & args,
+                            std::function<void (::nokia::net::proto::redis::reply &&)> callback)
+        {
+            std::vector<std::string> command;
+            command.reserve(3 + keys.size() + args.size());
+            command.push_back("EVALSHA");
+            command.push_back(lua->sha());
+            command.push_back(std::to_string(keys.size()));
+            command.insert(command.end(), keys.begin(), keys.end());
+            command.insert(command.end(), args.begin(), args.end());
+            client.execute_command([&client, lua, command, callback] (::nokia::net::proto::redis::reply && reply)
+                                   {
+                                       if (::nokia::net::proto::redis::reply::ERROR != reply.type || 0 != reply.str.find("NOSCRIPT"))
+                                       {
+                                           callback(std::move(reply));
+                                           return;
+                                       }
+                                       std::vector<std::string> eval(command);
+                                       eval[0] = "EVAL";
+                                       eval[1] = lua->body();
+                                       client.execute_command(callback, eval);
+                                   },
+                                   command);
+        }
+
+    }
+}
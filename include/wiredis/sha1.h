@@ -0,0 +1,124 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * SHA1 digest (RFC 3174). Used for the script names of redis (EVALSHA), not for security.
+         */
+        inline std::array<uint8_t, 20> sha1(char const * buffer, std::size_t size)
+        {
+            uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+
+            // Message + 0x80 + zero padding + length in bits (big endian), multiple of 64 bytes
+            std::string message(buffer, size);
+            message += static_cast<char>(0x80);
+            while (56 != message.size() % 64)
+            {
+                message += '\0';
+            }
+            uint64_t const bits = static_cast<uint64_t>(size) * 8;
+            for (int i = 7; i >= 0; --i)
+            {
+                message += static_cast<char>((bits >> (8 * i)) & 0xff);
+            }
+
+            for (std::size_t offset = 0; offset < message.size(); offset += 64)
+            {
+                uint32_t w[80];
+                for (int i = 0; i < 16; ++i)
+                {
+                    uint8_t const * p = reinterpret_cast<uint8_t const *>(message.data() + offset + i * 4);
+                    w[i] = (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+                        (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+                }
+                for (int i = 16; i < 80; ++i)
+                {
+                    uint32_t const x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+                    w[i] = (x << 1) | (x >> 31);
+                }
+                uint32_t a = h[0];
+                uint32_t b = h[1];
+                uint32_t c = h[2];
+                uint32_t d = h[3];
+                uint32_t e = h[4];
+                for (int i = 0; i < 80; ++i)
+                {
+                    uint32_t f;
+                    uint32_t k;
+                    if (i < 20)
+                    {
+                        f = (b & c) | (~b & d);
+                        k = 0x5a827999;
+                    }
+                    else if (i < 40)
+                    {
+                        f = b ^ c ^ d;
+                        k = 0x6ed9eba1;
+                    }
+                    else if (i < 60)
+                    {
+                        f = (b & c) | (b & d) | (c & d);
+                        k = 0x8f1bbcdc;
+                    }
+                    else
+                    {
+                        f = b ^ c ^ d;
+                        k = 0xca62c1d6;
+                    }
+                    uint32_t const t = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+                    e = d;
+                    d = c;
+                    c = (b << 30) | (b >> 2);
+                    b = a;
+                    a = t;
+                }
+                h[0] += a;
+                h[1] += b;
+                h[2] += c;
+                h[3] += d;
+                h[4] += e;
+            }
+
+            std::array<uint8_t, 20> digest;
+            for (int i = 0; i < 5; ++i)
+            {
+                for (int j = 0; j < 4; ++j)
+                {
+                    digest[i * 4 + j] = static_cast<uint8_t>((h[i] >> (24 - 8 * j)) & 0xff);
+                }
+            }
+            return digest;
+        }
+
+
+        inline std::array<uint8_t, 20> sha1(std::string const & input)
+        {
+            return sha1(input.data(), input.size());
+        }
+
+
+        // Lower case hexadecimal, as redis names the scripts
+        inline std::string sha1_hex(std::string const & input)
+        {
+            static char const digits[] = "0123456789abcdef";
+            std::string result;
+            for (auto byte: sha1(input))
+            {
+                result += digits[byte >> 4];
+                result += digits[byte & 0x0f];
+            }
+            return result;
+        }
+    }
+}
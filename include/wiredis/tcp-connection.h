@@ -6,10 +6,20 @@
 
             
 #include <boost/asio.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
 #include <boost/asio/steady_timer.hpp>
+#ifdef WIREDIS_ENABLE_TLS
+#include <boost/asio/ssl.hpp>
+#endif
+#include <atomic>
+#include <iterator>
 #include <list>
+#include <memory>
+#include <vector>
 
 #include <wiredis/proto/raw.h>
+#include <wiredis/reconnect-policy.h>
 #include <wiredis/types.h>
 
 namespace nokia
@@ -25,29 +35,96 @@ namespace nokia
                 std::runtime_error(std::forward<Ts>(ts)...)
             {}
         };
+
+
+#ifdef WIREDIS_ENABLE_TLS
+        // The last TLS session (ticket) got by a connection, offered on reconnect.
+        struct tls_session_cache
+        {
+            SSL_SESSION * session{nullptr};
+
+            ~tls_session_cache()
+            {
+                reset(nullptr);
+            }
+
+            void reset(SSL_SESSION * new_session)
+            {
+                if (session)
+                {
+                    SSL_SESSION_free(session);
+                }
+                session = new_session;
+            }
+        };
+
+
+        // Index of tls_session_cache in the SSL objects (the app data is used by asio)
+        inline int tls_session_index()
+        {
+            static int const index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+            return index;
+        }
+
+
+        /*
+         * New session callback of OpenSSL. TLS 1.3 tickets arrive after the handshake, this catches them too.
+         * A copy is kept: OpenSSL marks the session of the connection not resumable if the connection
+         * is closed without close_notify, which is the usual way of losing a connection.
+         */
+        inline int on_new_tls_session(SSL * ssl, SSL_SESSION * session)
+        {
+            auto cache = static_cast<tls_session_cache *>(SSL_get_ex_data(ssl, tls_session_index()));
+            if (cache)
+            {
+                cache->reset(SSL_SESSION_dup(session));
+            }
+            return 0; // We didn't take the reference
+        }
+#endif
+
         
         
+        /*
+         * Stream connection with auto reconnect. The socket is generic over the stream protocols,
+         * it can be a TCP (connect()) or a unix domain socket (connect_unix()).
+         *
+         * Host names are resolved asynchronously, the addresses are cached for dns_cache_ttl and
+         * resolved again when none of them could be connected. IPv4 and IPv6 addresses are tried
+         * in the happy eyeballs way (RFC 8305): the next address is tried if the previous one hasn't
+         * connected in CONNECTION_ATTEMPT_DELAY, the first established connection wins.
+         *
+         * With WIREDIS_ENABLE_TLS, set_tls() turns on TLS over the connection.
+         */
         template <typename parser = ::nokia::net::proto::raw::parser>
         class tcp_connection
         {
         public:
 
             uint64_t const SEND_BUFFER_LIMIT = 10485760; // 10 Megabyte. todo [w] Do we need so much?
+            std::chrono::milliseconds const CONNECTION_ATTEMPT_DELAY{250}; // Recommended by RFC 8305
                 
             template <typename... Ts>
             tcp_connection(boost::asio::io_service & io_service, Ts &&... parser_args):
                 _io_service(io_service),
                 _socket(_io_service),
+                _resolver(_io_service),
+                _attempt_timer(_io_service),
+                _generation(0),
+                _resolve(false),
+                _port(0),
+                _dns_cache_ttl(std::chrono::seconds(30)),
+                _failed_attempts(0),
                 _astate(astate::DISCONNECTED),
                 _ostate(ostate::DISCONNECTED),
-                _ip(""),
-                _port(0),
+                _tls_session_resumption(false),
+                _tls_session_reused(false),
                 _auto_reconnect(true),
                 _tcp_keepalive_enabled(true),
-                _reconnect_wait(2),
                 _parser(std::forward<Ts>(parser_args)...),
                 _timer(_io_service),
-                _send_buffer_size{0}
+                _send_buffer_size{0},
+                _next_message_id{1}
             {
             }
 
@@ -58,6 +135,8 @@ namespace nokia
 
 
             /*
+             * ip: IPv4 or IPv6 address or host name.
+             *
              * connected_callback: called if connection is esablished or given up the connecting
              *     In case of auto_reconnect, the tcp-connection will initiate reconnecting.
              *     Error code is passed the the callback function.
@@ -80,14 +159,88 @@ namespace nokia
                          bool tcp_keepalive_enabled = true,
                          bool tcp_user_timeout_enabled = true)
             {
-                internal_connect(ip, port, connected_callback, disconnected_callback, read_callback, auto_reconnect, tcp_keepalive_enabled, tcp_user_timeout_enabled);
+                set_target(ip, port);
+                internal_connect(connected_callback, disconnected_callback, read_callback, auto_reconnect, tcp_keepalive_enabled, tcp_user_timeout_enabled);
+            }
+
+
+            /*
+             * Same as connect() but over the unix domain socket of a local server (e.g. unixsocket of redis).
+             * The TCP options don't apply.
+             */
+            void connect_unix(std::string const & path,
+                              std::function<void (boost::system::error_code const &)> connected_callback,
+                              std::function<void (boost::system::error_code const &)> disconnected_callback,
+                              std::function<void (typename parser::protocol_message_type &&)> read_callback,
+                              bool auto_reconnect = true)
+            {
+                set_target(boost::asio::local::stream_protocol::endpoint(path));
+                internal_connect(connected_callback, disconnected_callback, read_callback, auto_reconnect, false, false);
+            }
+
+
+            /*
+             * How long the resolved addresses of a host name are used for reconnecting.
+             * After that the name is resolved again, so a reconnect follows a DNS based failover.
+             */
+            void set_dns_cache_ttl(std::chrono::seconds ttl)
+            {
+                _io_service.dispatch([this, ttl] ()
+                                     {
+                                         _dns_cache_ttl = ttl;
+                                     });
+            }
+
+
+#ifdef WIREDIS_ENABLE_TLS
+            /*
+             * Use TLS over the connection. Call it before connect().
+             *
+             * context: certificates and verify mode, it can be shared by connections.
+             * session_resumption: the session (ticket) got from the server is offered on reconnect,
+             *     so the server can skip the full handshake. It installs the client session callback
+             *     of the context.
+             *
+             * Host names are sent as SNI. If the context verifies the peer, the certificate has to
+             * match the host name or the address given to connect().
+             */
+            void set_tls(std::shared_ptr<boost::asio::ssl::context> context, bool session_resumption = true)
+            {
+                _tls_state.reset();
+                if (context)
+                {
+                    _tls_state = std::make_shared<tls_state>();
+                    _tls_state->context = context;
+                }
+                _tls_session_resumption = session_resumption;
+                if (context && session_resumption)
+                {
+                    SSL_CTX_set_session_cache_mode(context->native_handle(), SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+                    SSL_CTX_sess_set_new_cb(context->native_handle(), &on_new_tls_session);
+                }
             }
 
 
+            // True if the last TLS handshake resumed a previous session
+            bool tls_session_reused() const
+            {
+                return _tls_session_reused;
+            }
+#endif
+
+
             bool connected() const
             {
                 return (astate::CONNECTED == _astate && ostate::CONNECTED == _ostate);
             }
+
+
+            // Number of bytes waiting in the send buffer (including the partially sent message)
+            uint64_t send_buffer_size()
+            {
+                std::unique_lock<std::mutex> guard(_send_buffer_mutex);
+                return _send_buffer_size;
+            }
             
             
             void disconnect()
@@ -105,6 +258,10 @@ namespace nokia
             }
 
 
+            /*
+             * cb is called when the user has disconnected (right away if it's already disconnected).
+             * The waiters are completed by disconnect(), nothing is polled.
+             */
             void join(std::function<void ()> cb)
             {
                 _io_service.dispatch([this, cb] ()
@@ -115,17 +272,7 @@ namespace nokia
                                          }
                                          else
                                          {
-                                             // todo [w] cancel timers!
-                                             _timer.expires_from_now(std::chrono::milliseconds(10));
-                                             _timer.async_wait([this, cb] (boost::system::error_code const & error)
-                                                                {
-                                                                    if (::boost::asio::error::operation_aborted == error)
-                                                                    {
-                                                                        // Timer has been canceled.
-                                                                        return;
-                                                                    }
-                                                                    join(cb);
-                                                                });
+                                             _join_waiters.push_back(cb);
                                          }
                                      });
             }
@@ -137,13 +284,15 @@ namespace nokia
                 std::mutex mutex;
                 std::unique_lock<std::mutex> guard(mutex);
                 std::condition_variable cv;
+                bool done{false};
                 
                 join([&] ()
                          {
                              std::unique_lock<std::mutex> guard(mutex);
+                             done = true;
                              cv.notify_one();
                          });
-                cv.wait(guard);
+                cv.wait(guard, [&] () { return done; });
             }
 
             
@@ -151,12 +300,24 @@ namespace nokia
             {
                 _io_service.dispatch([this] ()
                                      {
+                                         // A connection dropped right after it was established (e.g. maxclients) doesn't restart the backoff.
+                                         bool const stable = (ostate::CONNECTED == _ostate) &&
+                                             (std::chrono::steady_clock::now() - _connected_at >= _reconnect_policy.cap());
                                          disconnect(false); // Preserve CONNECTED administration state
                                          if (!_auto_reconnect)
                                          {
                                              return;
                                          }
-                                         _timer.expires_from_now(std::chrono::seconds(_reconnect_wait));
+                                         if (stable)
+                                         {
+                                             _reconnect_policy.reset();
+                                         }
+                                         std::chrono::milliseconds const delay = _reconnect_policy.next_delay();
+                                         if (_reconnect_hook)
+                                         {
+                                             _reconnect_hook(_reconnect_policy.attempts(), delay);
+                                         }
+                                         _timer.expires_from_now(delay);
                                          _timer.async_wait([this] (boost::system::error_code const & error)
                                                            {
                                                                 
@@ -170,10 +331,13 @@ namespace nokia
                                                                {
                                                                    return;
                                                                }
+                                                               // Meanwhile repointed (the handler was already queued when the timer was canceled)
+                                                               if (ostate::DISCONNECTED != _ostate)
+                                                               {
+                                                                   return;
+                                                               }
                                                                
-                                                               internal_connect(_ip,
-                                                                       _port,
-                                                                       _connected_callback,
+                                                               internal_connect(_connected_callback,
                                                                        _disconnected_callback,
                                                                        _read_callback,
                                                                        _auto_reconnect,
@@ -184,9 +348,80 @@ namespace nokia
 
             }
 
-            void send(std::string && buffer)
+            /*
+             * Delays of automatic reconnect, see reconnect_policy. Default: immediate first attempt,
+             * then backoff with jitter from 100 ms up to 2 seconds. The backoff restarts once
+             * a connection has been up for the cap of the policy.
+             */
+            void set_reconnect_policy(reconnect_policy const & policy)
+            {
+                _io_service.dispatch([this, policy] ()
+                                     {
+                                         _reconnect_policy = policy;
+                                         _reconnect_policy.reset();
+                                     });
+            }
+
+
+            /*
+             * Called in the io_service thread when a reconnect attempt is scheduled.
+             * attempt: 1 for the first attempt after losing the connection.
+             */
+            void set_reconnect_hook(std::function<void (unsigned attempt, std::chrono::milliseconds delay)> hook)
+            {
+                _io_service.dispatch([this, hook] ()
+                                     {
+                                         _reconnect_hook = hook;
+                                     });
+            }
+
+
+            /*
+             * Connect to a new address right away (without waiting for the reconnect timer),
+             * e.g. to the new master after failover. The current connection is closed without calling
+             * the disconnected callback and the content of the send buffer is dropped.
+             * Does nothing if the user has disconnected.
+             */
+            void repoint(std::string const & ip, uint16_t port)
+            {
+                _io_service.dispatch([this, ip, port] ()
+                                     {
+                                         if (astate::DISCONNECTED == _astate)
+                                         {
+                                             return;
+                                         }
+                                         _timer.cancel();
+                                         disconnect(false);
+                                         set_target(ip, port);
+                                         internal_connect(_connected_callback,
+                                                          _disconnected_callback,
+                                                          _read_callback,
+                                                          _auto_reconnect,
+                                                          _tcp_keepalive_enabled,
+                                                          _tcp_user_timeout_enabled);
+                                     });
+            }
+
+
+            // Returns the id of the message for cancel()
+            uint64_t send(std::string && buffer)
+            {
+                return send(std::move(buffer), std::chrono::steady_clock::time_point::max(), nullptr);
+            }
+
+
+            /*
+             * The message is dropped without sending if its deadline has passed by the time it would be
+             * written, e.g. it has waited behind a backlog. Then expired_callback is called in the io_service
+             * thread. A message partly written is always finished.
+             */
+            uint64_t send(std::string && buffer,
+                          std::chrono::steady_clock::time_point deadline,
+                          std::function<void ()> expired_callback)
             {
                 bool send_now = true;
+                bool const has_deadline = (nullptr != expired_callback);
+                uint64_t id{0};
                 {
                     std::unique_lock<std::mutex> guard(_send_buffer_mutex);
                     send_now = _send_buffer.empty();
@@ -198,16 +433,52 @@ namespace nokia
                     _send_buffer_size += buffer.size();
 
                     // we can send now if the sending buffer is empty, otherwise the send-callback will do that.
-                    _send_buffer.emplace_back(std::move(buffer));
+                    id = _next_message_id++;
+                    _send_buffer.push_back(outgoing_message{id, std::move(buffer), deadline, std::move(expired_callback)});
                 }
 
                 if (send_now)
                 {
-                    _io_service.dispatch([this] ()
-                                         {
-                                             try_to_send();
-                                         });
+                    auto write = [this] ()
+                        {
+                            try_to_send();
+                        };
+                    if (has_deadline)
+                    {
+                        // Never inline: the message may expire right away, and the caller of send() may
+                        // hold a lock its expired_callback needs.
+                        _io_service.post(write);
+                    }
+                    else
+                    {
+                        _io_service.dispatch(write);
+                    }
+                }
+                return id;
+            }
+
+
+            /*
+             * Removes a message from the send buffer. False if it's been (or being) written already,
+             * the first message of the buffer is never removed.
+             */
+            bool cancel(uint64_t id)
+            {
+                std::unique_lock<std::mutex> guard(_send_buffer_mutex);
+                if (_send_buffer.empty())
+                {
+                    return false;
+                }
+                for (auto it = std::next(_send_buffer.begin()); _send_buffer.end() != it; ++it)
+                {
+                    if (id == it->id)
+                    {
+                        _send_buffer_size -= it->data.size();
+                        _send_buffer.erase(it);
+                        return true;
+                    }
                 }
+                return false;
             }
             
 
@@ -215,9 +486,43 @@ namespace nokia
         protected:
 
 
-            void internal_connect(std::string const & ip,
-                         uint16_t port,
-                         std::function<void (boost::system::error_code const &)> connected_callback,
+            typedef boost::asio::generic::stream_protocol::endpoint endpoint_type;
+            typedef boost::asio::generic::stream_protocol::socket socket_type;
+
+
+            static bool is_tcp(endpoint_type const & endpoint)
+            {
+                return AF_INET == endpoint.protocol().family() || AF_INET6 == endpoint.protocol().family();
+            }
+
+
+            // Address literals are used as they are, host names are resolved when connecting.
+            void set_target(std::string const & host, uint16_t port)
+            {
+                boost::system::error_code error;
+                boost::asio::ip::address const address = boost::asio::ip::make_address(host, error);
+                _resolve = static_cast<bool>(error);
+                _host = host;
+                _port = port;
+                _resolved.clear();
+                if (!_resolve)
+                {
+                    _endpoint = boost::asio::ip::tcp::endpoint(address, port);
+                }
+            }
+
+
+            void set_target(endpoint_type const & endpoint)
+            {
+                _resolve = false;
+                _host.clear();
+                _port = 0;
+                _resolved.clear();
+                _endpoint = endpoint;
+            }
+
+
+            void internal_connect(std::function<void (boost::system::error_code const &)> connected_callback,
                          std::function<void (boost::system::error_code const &)> disconnected_callback,
                          std::function<void (typename parser::protocol_message_type &&)> read_callback,
                          bool auto_reconnect,
@@ -226,8 +531,6 @@ namespace nokia
             {
                 _astate = astate::CONNECTED;
                 _ostate = ostate::CONNECTING;
-                _ip = ip;
-                _port = port;
                 _connected_callback = connected_callback;
                 _disconnected_callback = disconnected_callback;
                 _read_callback = read_callback;
@@ -235,38 +538,297 @@ namespace nokia
                 _tcp_keepalive_enabled = tcp_keepalive_enabled;
                 _tcp_user_timeout_enabled = tcp_user_timeout_enabled;
 
-                _socket.open(boost::asio::ip::tcp::v4());
-                set_socket_options();
-                    
-                boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(ip), port);
-                _socket.async_connect(endpoint,
-                                      [this] (boost::system::error_code const & error)
+                unsigned const generation = ++_generation;
+                if (!_resolve)
+                {
+                    connect_to(std::vector<endpoint_type>{_endpoint}, generation);
+                    return;
+                }
+                if (!_resolved.empty() && std::chrono::steady_clock::now() - _resolved_at < _dns_cache_ttl)
+                {
+                    connect_to(_resolved, generation);
+                    return;
+                }
+                _resolver.async_resolve(_host,
+                                        std::to_string(_port),
+                                        [this, generation] (boost::system::error_code const & error,
+                                                            boost::asio::ip::tcp::resolver::results_type results)
+                                        {
+                                            if (generation != _generation)
+                                            {
+                                                // Disconnected or repointed meanwhile
+                                                return;
+                                            }
+                                            if (error || results.empty())
+                                            {
+                                                on_connect_failed(error ? error : boost::asio::error::host_not_found);
+                                                return;
+                                            }
+                                            _resolved = interleave(results);
+                                            _resolved_at = std::chrono::steady_clock::now();
+                                            connect_to(_resolved, generation);
+                                        });
+            }
+
+
+            /*
+             * Alternates the address families (RFC 8305), keeping the order of the resolver
+             * (RFC 6724) within a family. A dead family doesn't delay the other one more than one step.
+             */
+            static std::vector<endpoint_type> interleave(boost::asio::ip::tcp::resolver::results_type const & results)
+            {
+                std::vector<endpoint_type> first;
+                std::vector<endpoint_type> second;
+                bool const first_is_v6 = results.begin()->endpoint().address().is_v6();
+                for (auto const & entry: results)
+                {
+                    (entry.endpoint().address().is_v6() == first_is_v6 ? first : second).push_back(entry.endpoint());
+                }
+                std::vector<endpoint_type> result;
+                for (std::size_t i = 0; i < std::max(first.size(), second.size()); ++i)
+                {
+                    if (i < first.size())
+                    {
+                        result.push_back(first[i]);
+                    }
+                    if (i < second.size())
+                    {
+                        result.push_back(second[i]);
+                    }
+                }
+                return result;
+            }
+
+
+            void connect_to(std::vector<endpoint_type> const & endpoints, unsigned generation)
+            {
+                _attempt_endpoints = endpoints;
+                _attempts.clear();
+                _failed_attempts = 0;
+                start_next_attempt(generation);
+            }
+
+
+            // Starts a connection attempt to the next address and schedules the one after it.
+            void start_next_attempt(unsigned generation)
+            {
+                std::size_t const index = _attempts.size();
+                if (index >= _attempt_endpoints.size())
+                {
+                    return;
+                }
+                endpoint_type const endpoint = _attempt_endpoints[index];
+                auto socket = std::make_shared<socket_type>(_io_service);
+                _attempts.push_back(socket);
+
+                boost::system::error_code error;
+                socket->open(endpoint.protocol(), error);
+                if (!error && is_tcp(endpoint))
+                {
+                    set_socket_options(*socket);
+                }
+                if (error)
+                {
+                    // E.g. no IPv6 on the host
+                    _io_service.post([this, generation, error] ()
+                                     {
+                                         on_attempt_failed(generation, error);
+                                     });
+                    return;
+                }
+
+                socket->async_connect(endpoint,
+                                      [this, generation, socket] (boost::system::error_code const & error)
                                       {
-                                          if (error)
+                                          if (generation != _generation || ::boost::asio::error::operation_aborted == error)
                                           {
-                                              _ostate = ostate::DISCONNECTED;
-                                              if (_connected_callback)
-                                              {
-                                                  _connected_callback(error);
-                                              }
-                                              reconnect();
+                                              // We closed the socket (disconnect, repoint or another attempt won), do nothing
                                               return;
                                           }
-                                          else
+                                          if (error)
                                           {
-                                              _ostate = ostate::CONNECTED;
-                                              _send_buffer.clear();
-                                              _send_buffer_size = 0;
-                                              
-                                              ::nokia::net::proto::char_buffer const & buffer = _parser.buffer();
-                                              _socket.async_read_some(boost::asio::buffer(buffer.ptr, buffer.size),
-                                                                      std::bind(&tcp_connection::on_read, this, std::placeholders::_1, std::placeholders::_2));
-                                              if (_connected_callback)
-                                              {
-                                                  _connected_callback(error);
-                                              }
+                                              on_attempt_failed(generation, error);
+                                              return;
                                           }
+                                          on_connected(socket);
                                       });
+
+                if (index + 1 < _attempt_endpoints.size())
+                {
+                    _attempt_timer.expires_from_now(CONNECTION_ATTEMPT_DELAY);
+                    _attempt_timer.async_wait([this, generation] (boost::system::error_code const & error)
+                                              {
+                                                  if (::boost::asio::error::operation_aborted == error || generation != _generation)
+                                                  {
+                                                      return;
+                                                  }
+                                                  start_next_attempt(generation);
+                                              });
+                }
+            }
+
+
+            void on_attempt_failed(unsigned generation, boost::system::error_code const & error)
+            {
+                if (generation != _generation)
+                {
+                    return;
+                }
+                if (++_failed_attempts < _attempt_endpoints.size())
+                {
+                    if (_failed_attempts == _attempts.size())
+                    {
+                        // Nothing in progress, don't wait for the attempt delay
+                        _attempt_timer.cancel();
+                        start_next_attempt(generation);
+                    }
+                    return;
+                }
+                // The addresses may have changed (DNS based failover), resolve again next time
+                _resolved.clear();
+                on_connect_failed(error);
+            }
+
+
+            void on_connect_failed(boost::system::error_code const & error)
+            {
+                close_attempts();
+                _ostate = ostate::DISCONNECTED;
+                if (_connected_callback)
+                {
+                    _connected_callback(error);
+                }
+                reconnect();
+            }
+
+
+            void on_connected(std::shared_ptr<socket_type> const & socket)
+            {
+                _socket = std::move(*socket);
+                close_attempts();
+                // The handlers of the other attempts (and of the attempt timer) may be queued already,
+                // closing them is not enough: they belong to the previous generation from now on.
+                ++_generation;
+#ifdef WIREDIS_ENABLE_TLS
+                if (_tls_state)
+                {
+                    start_tls(_generation);
+                    return;
+                }
+#endif
+                on_established();
+            }
+
+
+#ifdef WIREDIS_ENABLE_TLS
+            void start_tls(unsigned generation)
+            {
+                auto tls = std::make_shared<typename tls_state::stream_type>(_socket, *_tls_state->context);
+                _tls_state->stream = tls;
+                SSL * ssl = tls->native_handle();
+                if (_resolve)
+                {
+                    SSL_set_tlsext_host_name(ssl, _host.c_str());
+                }
+                if (!_host.empty())
+                {
+                    tls->set_verify_callback(boost::asio::ssl::host_name_verification(_host));
+                }
+                if (_tls_session_resumption)
+                {
+                    SSL_set_ex_data(ssl, tls_session_index(), &_tls_state->session);
+                    if (_tls_state->session.session)
+                    {
+                        SSL_set_session(ssl, _tls_state->session.session);
+                    }
+                }
+
+                tls->async_handshake(boost::asio::ssl::stream_base::client,
+                                     [this, generation, tls] (boost::system::error_code const & error)
+                                     {
+                                         if (generation != _generation || ::boost::asio::error::operation_aborted == error)
+                                         {
+                                             return;
+                                         }
+                                         if (error)
+                                         {
+                                             _tls_state->session.reset(nullptr);
+                                             on_connect_failed(error);
+                                             return;
+                                         }
+                                         _tls_session_reused = (1 == SSL_session_reused(tls->native_handle()));
+                                         on_established();
+                                     });
+            }
+#endif
+
+
+            // Reads and writes go through TLS if it's on
+            template <typename Handler>
+            void stream_read_some(boost::asio::mutable_buffer const & buffer, Handler handler)
+            {
+#ifdef WIREDIS_ENABLE_TLS
+                if (_tls_state && _tls_state->stream)
+                {
+                    // Pending operations keep the stream alive after disconnect
+                    auto tls = _tls_state->stream;
+                    tls->async_read_some(buffer,
+                                         [tls, handler] (boost::system::error_code const & error, std::size_t bytes_transferred) mutable
+                                         {
+                                             handler(error, bytes_transferred);
+                                         });
+                    return;
+                }
+#endif
+                _socket.async_read_some(buffer, handler);
+            }
+
+
+            template <typename Handler>
+            void stream_write_some(boost::asio::const_buffer const & buffer, Handler handler)
+            {
+#ifdef WIREDIS_ENABLE_TLS
+                if (_tls_state && _tls_state->stream)
+                {
+                    auto tls = _tls_state->stream;
+                    tls->async_write_some(buffer,
+                                          [tls, handler] (boost::system::error_code const & error, std::size_t bytes_transferred) mutable
+                                          {
+                                              handler(error, bytes_transferred);
+                                          });
+                    return;
+                }
+#endif
+                _socket.async_write_some(buffer, handler);
+            }
+
+
+            void on_established()
+            {
+                _ostate = ostate::CONNECTED;
+                _connected_at = std::chrono::steady_clock::now();
+                _send_buffer.clear();
+                _send_buffer_size = 0;
+
+                ::nokia::net::proto::char_buffer const & buffer = _parser.buffer();
+                stream_read_some(boost::asio::buffer(buffer.ptr, buffer.size),
+                                 std::bind(&tcp_connection::on_read, this, std::placeholders::_1, std::placeholders::_2));
+                if (_connected_callback)
+                {
+                    _connected_callback(boost::system::error_code());
+                }
+            }
+
+
+            void close_attempts()
+            {
+                _attempt_timer.cancel();
+                for (auto & socket: _attempts)
+                {
+                    boost::system::error_code ignored;
+                    socket->close(ignored);
+                }
+                _attempts.clear();
             }
 
 
@@ -277,54 +839,83 @@ namespace nokia
                     return;
                 }
 
+                std::vector<std::function<void ()>> expired_callbacks;
                 std::unique_lock<std::mutex> guard(_send_buffer_mutex);
+                if (0 == start_byte)
+                {
+                    // Shed the load: it's too late for these, don't let the server execute them.
+                    auto const now = std::chrono::steady_clock::now();
+                    while (!_send_buffer.empty() && _send_buffer.front().deadline <= now)
+                    {
+                        expired_callbacks.push_back(std::move(_send_buffer.front().expired_callback));
+                        _send_buffer_size -= _send_buffer.front().data.size();
+                        _send_buffer.pop_front();
+                    }
+                }
                 if (_send_buffer.empty())
                 {
+                    guard.unlock();
+                    call_expired_callbacks(expired_callbacks);
                     return;
                 }
-                std::string & first_message = _send_buffer.front();
+                std::string & first_message = _send_buffer.front().data;
                 std::size_t message_length = first_message.size() - start_byte;
 
-                _socket.async_write_some(boost::asio::buffer(&first_message[start_byte], message_length),
-                                         [this, start_byte, message_length] (boost::system::error_code const & error,
-                                                                             std::size_t bytes_transferred)
-                                         {
-                                             if (!connected())
-                                             {
-                                                 // do nothing
-                                                 return;
-                                             }
-                                             if (error)
-                                             {
-                                                 if (_disconnected_callback)
-                                                 {
-                                                     _disconnected_callback(error);
-                                                 }
-                                                 reconnect();
-                                                 return;
-                                             }
+                stream_write_some(boost::asio::buffer(&first_message[start_byte], message_length),
+                                  [this, start_byte, message_length] (boost::system::error_code const & error,
+                                                                      std::size_t bytes_transferred)
+                                  {
+                                      if (!connected() || ::boost::asio::error::operation_aborted == error)
+                                      {
+                                          // do nothing
+                                          return;
+                                      }
+                                      if (error)
+                                      {
+                                          if (_disconnected_callback)
+                                          {
+                                              _disconnected_callback(error);
+                                          }
+                                          reconnect();
+                                          return;
+                                      }
                                              
-                                             if (message_length != bytes_transferred)
-                                             {
-                                                 // Some bytes haven't sent but we are still connected
-                                                 // -> Resend the missing part
-                                                 try_to_send(start_byte+bytes_transferred);
-                                                 return;
-                                             }
-                                             // First message sent successfully
-                                             bool need_to_recall = false;
-                                             {
-                                                 std::unique_lock<std::mutex> guard(_send_buffer_mutex);
-                                                 _send_buffer_size -= _send_buffer.front().size();
-                                                 _send_buffer.pop_front();
-                                                 need_to_recall = !_send_buffer.empty();
-                                             }
-                                             if (need_to_recall)
-                                             {
-                                                 try_to_send();
-                                             }
-                                             return;
-                                         });
+                                      if (message_length != bytes_transferred)
+                                      {
+                                          // Some bytes haven't sent but we are still connected
+                                          // -> Resend the missing part
+                                          try_to_send(start_byte+bytes_transferred);
+                                          return;
+                                      }
+                                      // First message sent successfully
+                                      bool need_to_recall = false;
+                                      {
+                                          std::unique_lock<std::mutex> guard(_send_buffer_mutex);
+                                          _send_buffer_size -= _send_buffer.front().data.size();
+                                          _send_buffer.pop_front();
+                                          need_to_recall = !_send_buffer.empty();
+                                      }
+                                      if (need_to_recall)
+                                      {
+                                          try_to_send();
+                                      }
+                                      return;
+                                  });
+                // The callbacks may send, which needs the lock
+                guard.unlock();
+                call_expired_callbacks(expired_callbacks);
+            }
+
+
+            static void call_expired_callbacks(std::vector<std::function<void ()>> & callbacks)
+            {
+                for (auto & callback: callbacks)
+                {
+                    if (callback)
+                    {
+                        callback();
+                    }
+                }
             }
             
             
@@ -336,14 +927,34 @@ namespace nokia
                 }
                 try
                 {
-                    _socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
+                    _socket.shutdown(boost::asio::socket_base::shutdown_both);
                 }
                 catch (...)
                 {
                     // Doesn't matter
                 }
                 _socket.close();
+#ifdef WIREDIS_ENABLE_TLS
+                if (_tls_state)
+                {
+                    _tls_state->stream.reset();
+                }
+#endif
+                // Abandon the resolving and the connection attempts in progress
+                ++_generation;
+                _resolver.cancel();
+                close_attempts();
                 _ostate = ostate::DISCONNECTED;
+
+                if (end)
+                {
+                    // After the handlers already queued, e.g. the ones of the caller
+                    for (auto & waiter: _join_waiters)
+                    {
+                        _io_service.post(waiter);
+                    }
+                    _join_waiters.clear();
+                }
             }
             
 
@@ -369,8 +980,8 @@ namespace nokia
                 try
                 {
                     ::nokia::net::proto::char_buffer const & buffer = _parser.on_read(bytes_transferred, _read_callback);
-                    _socket.async_read_some(boost::asio::buffer(buffer.ptr, buffer.size),
-                                            std::bind(&tcp_connection::on_read, this, std::placeholders::_1, std::placeholders::_2));
+                    stream_read_some(boost::asio::buffer(buffer.ptr, buffer.size),
+                                     std::bind(&tcp_connection::on_read, this, std::placeholders::_1, std::placeholders::_2));
                 }
                 catch (parse_error const &)
                 {
@@ -385,7 +996,7 @@ namespace nokia
             }
 
 
-            void set_socket_options()
+            void set_socket_options(socket_type & socket)
             {
                 /*
                  * TCP_SYNCNT: Number of SYN retries.
@@ -401,7 +1012,7 @@ namespace nokia
                  *       See: https://lore.kernel.org/patchwork/patch/960970/
                  */
 
-                auto native_socket = _socket.native_handle();
+                auto native_socket = socket.native_handle();
                 int optval{2};
                 socklen_t optlen = sizeof(optval);
                 setsockopt(native_socket, IPPROTO_TCP, TCP_SYNCNT, &optval, optlen);
@@ -410,7 +1021,7 @@ namespace nokia
                 {
                     // turn on
                     boost::asio::socket_base::keep_alive keep_alive_option(true);
-                    _socket.set_option(keep_alive_option);
+                    socket.set_option(keep_alive_option);
                 
                     // set config (can't be done via boost::asio, it's posix standard, not portable)
                     optval = 2;
@@ -433,12 +1044,37 @@ namespace nokia
 
 
             boost::asio::io_service & _io_service;
-            boost::asio::ip::tcp::socket _socket;
-            astate _astate;
-            ostate _ostate;
-
-            std::string _ip;
+            boost::asio::generic::stream_protocol::socket _socket;
+            boost::asio::ip::tcp::resolver _resolver;
+            boost::asio::steady_timer _attempt_timer;
+            unsigned _generation;  // of the connecting, handlers of an abandoned one do nothing
+            bool _resolve;
             uint16_t _port;
+            std::chrono::seconds _dns_cache_ttl;
+            std::size_t _failed_attempts;
+            std::atomic<astate> _astate;  // read by connected() from any thread
+            std::atomic<ostate> _ostate;
+
+            std::string _host;
+            endpoint_type _endpoint;  // address literal or unix socket, not used for host names
+            std::vector<endpoint_type> _resolved;
+            std::chrono::steady_clock::time_point _resolved_at;
+            std::vector<endpoint_type> _attempt_endpoints;
+            std::vector<std::shared_ptr<socket_type>> _attempts;
+            // The layout doesn't depend on WIREDIS_ENABLE_TLS, only the code does.
+            struct tls_state;
+#ifdef WIREDIS_ENABLE_TLS
+            struct tls_state
+            {
+                typedef boost::asio::ssl::stream<socket_type &> stream_type;
+                std::shared_ptr<boost::asio::ssl::context> context;
+                std::shared_ptr<stream_type> stream;  // of the current connection
+                tls_session_cache session;
+            };
+#endif
+            std::shared_ptr<tls_state> _tls_state;  // nullptr if TLS is off
+            bool _tls_session_resumption;
+            std::atomic<bool> _tls_session_reused;
             std::function<void (boost::system::error_code const &)> _connected_callback;
             std::function<void (boost::system::error_code const &)> _disconnected_callback;
             std::function<void (typename parser::protocol_message_type &&)> _read_callback;
@@ -446,15 +1082,27 @@ namespace nokia
             bool _auto_reconnect;
             bool _tcp_keepalive_enabled;
             bool _tcp_user_timeout_enabled;
-            uint64_t _reconnect_wait; // Before automatic reconnect, wait this amount of seconds.
+            reconnect_policy _reconnect_policy;
+            std::function<void (unsigned, std::chrono::milliseconds)> _reconnect_hook;
+            std::chrono::steady_clock::time_point _connected_at;
 
             parser _parser;
 
-            boost::asio::steady_timer _timer;
+            boost::asio::steady_timer _timer;  // of reconnect
+            std::vector<std::function<void ()>> _join_waiters;
+
+            struct outgoing_message
+            {
+                uint64_t id;
+                std::string data;
+                std::chrono::steady_clock::time_point deadline;
+                std::function<void ()> expired_callback;
+            };
 
-            std::list<std::string> _send_buffer;
+            std::list<outgoing_message> _send_buffer;
             uint64_t _send_buffer_size;
             std::mutex _send_buffer_mutex;
+            uint64_t _next_message_id;
             
         };
     }
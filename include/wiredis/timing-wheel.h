@@ -0,0 +1,288 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/asio/basic_waitable_timer.hpp>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Hashed timing wheel for the request deadlines. There's one per io_service, shared by
+         * every connection (get it with boost::asio::use_service<timing_wheel>(io_service)), so
+         * a deadline costs a hash map insertion instead of an asio timer.
+         *
+         * Deadlines are rounded up to TICK. A single timer runs the wheel, and only while
+         * there's something scheduled. Handlers are called in the io_service thread, without lock.
+         */
+        template <typename Clock = std::chrono::steady_clock>
+        class basic_timing_wheel: public boost::asio::io_service::service
+        {
+        public:
+
+            typedef uint64_t handle;                    // 0 is never returned, it can mean "no deadline"
+
+            static boost::asio::io_service::id id;
+
+            static std::size_t const SLOTS = 512;
+            static constexpr std::chrono::milliseconds TICK{10};
+
+
+            explicit basic_timing_wheel(boost::asio::io_service & io_service):
+                boost::asio::io_service::service(io_service),
+                _timer(io_service),
+                _epoch(Clock::now()),
+                _slots(SLOTS),
+                _next_id(1),
+                _processed_tick(0),
+                _size(0),
+                _running(false)
+            {
+            }
+
+
+            /*
+             * Can be called from any thread.
+             * owner: the object used by the handler, see cancel_all()
+             */
+            handle schedule(std::chrono::milliseconds timeout, std::function<void ()> handler, void const * owner = nullptr)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                uint64_t ticks = (timeout.count() + TICK.count() - 1) / TICK.count();
+                // At least one full tick, the current one has partly gone.
+                uint64_t const target = current_tick() + ((0 == ticks) ? 1 : ticks) + 1;
+                handle const h = (_next_id++) * SLOTS + target % SLOTS;
+                _slots[h % SLOTS].emplace(h, entry{target, std::move(handler), owner});
+                ++_size;
+                if (!_running)
+                {
+                    _running = true;
+                    _processed_tick = current_tick();
+                    arm();
+                }
+                return h;
+            }
+
+
+            // False if the handler has already been called (or is being called) or cancelled.
+            bool cancel(handle h)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return erase(h);
+            }
+
+
+            /*
+             * Cancels every handler of the owner, and waits until those being called in other threads
+             * return. For the destructor of the owner; the caller must not hold any lock the handlers
+             * may need. It goes through every scheduled handler, so it isn't for the hot path.
+             */
+            void cancel_all(void const * owner)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                for (auto & slot: _slots)
+                {
+                    for (auto it = slot.begin(); slot.end() != it;)
+                    {
+                        if (owner == it->second.owner)
+                        {
+                            it = slot.erase(it);
+                            --_size;
+                        }
+                        else
+                        {
+                            ++it;
+                        }
+                    }
+                }
+                for (auto it = _due.begin(); _due.end() != it;)
+                {
+                    it = (owner == it->second.owner) ? _due.erase(it) : std::next(it);
+                }
+                _called.wait(guard,
+                             [this, owner] ()
+                             {
+                                 for (auto const & item: _calling)
+                                 {
+                                     // The handler itself may destroy its owner.
+                                     if (owner == item.second.owner && std::this_thread::get_id() != item.second.thread)
+                                     {
+                                         return false;
+                                     }
+                                 }
+                                 return true;
+                             });
+            }
+
+
+            // Number of scheduled handlers
+            std::size_t size()
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _size;
+            }
+
+
+        private:
+
+            struct entry
+            {
+                uint64_t tick;
+                std::function<void ()> handler;
+                void const * owner;
+            };
+
+
+            struct call
+            {
+                void const * owner;
+                std::thread::id thread;
+            };
+
+
+            // The caller holds _mutex.
+            bool erase(handle h)
+            {
+                if (0 != _slots[h % SLOTS].erase(h))
+                {
+                    --_size;
+                    return true;
+                }
+                // Expired, but not called yet
+                return 0 != _due.erase(h);
+            }
+
+
+            void shutdown() override
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _timer.cancel();
+                for (auto & slot: _slots)
+                {
+                    slot.clear();
+                }
+                _due.clear();
+                _size = 0;
+                _running = false;
+            }
+
+
+            uint64_t current_tick() const
+            {
+                return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - _epoch).count() / TICK.count();
+            }
+
+
+            void arm()
+            {
+                _timer.expires_at(_epoch + TICK * (_processed_tick + 1));
+                _timer.async_wait([this] (boost::system::error_code const & error)
+                                  {
+                                      if (boost::asio::error::operation_aborted != error)
+                                      {
+                                          on_tick();
+                                      }
+                                  });
+            }
+
+
+            void on_tick()
+            {
+                std::vector<handle> expired;
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    uint64_t const now = current_tick();
+                    // After a long stall every slot is visited once.
+                    uint64_t const first = (now - _processed_tick > SLOTS) ? now - SLOTS + 1 : _processed_tick + 1;
+                    for (uint64_t tick = first; tick <= now; ++tick)
+                    {
+                        auto & slot = _slots[tick % SLOTS];
+                        for (auto it = slot.begin(); slot.end() != it;)
+                        {
+                            if (it->second.tick <= now)
+                            {
+                                expired.push_back(it->first);
+                                _due.emplace(it->first, std::move(it->second));
+                                it = slot.erase(it);
+                                --_size;
+                            }
+                            else
+                            {
+                                ++it;
+                            }
+                        }
+                    }
+                    _processed_tick = now;
+                    _running = (0 != _size);
+                    if (_running)
+                    {
+                        arm();
+                    }
+                }
+                // One by one, so each can still be cancelled until it's called.
+                for (handle h: expired)
+                {
+                    std::function<void ()> handler;
+                    {
+                        std::unique_lock<std::mutex> guard(_mutex);
+                        auto it = _due.find(h);
+                        if (_due.end() == it)
+                        {
+                            continue;
+                        }
+                        handler = std::move(it->second.handler);
+                        _calling.emplace(h, call{it->second.owner, std::this_thread::get_id()});
+                        _due.erase(it);
+                    }
+                    handler();
+                    {
+                        std::unique_lock<std::mutex> guard(_mutex);
+                        _calling.erase(h);
+                    }
+                    _called.notify_all();
+                }
+            }
+
+
+            std::mutex _mutex;
+            boost::asio::basic_waitable_timer<Clock> _timer;
+            typename Clock::time_point const _epoch;
+            std::vector<std::unordered_map<handle, entry>> _slots;
+            std::unordered_map<handle, entry> _due;     // expired, not called yet
+            std::unordered_map<handle, call> _calling;  // being called
+            std::condition_variable _called;
+            uint64_t _next_id;
+            uint64_t _processed_tick;
+            std::size_t _size;
+            bool _running;
+        };
+
+
+        template <typename Clock>
+        boost::asio::io_service::id basic_timing_wheel<Clock>::id;
+
+        template <typename Clock>
+        constexpr std::chrono::milliseconds basic_timing_wheel<Clock>::TICK;
+
+
+        typedef basic_timing_wheel<> timing_wheel;
+
+    }
+}
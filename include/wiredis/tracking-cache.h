@@ -0,0 +1,530 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <wiredis/commands.h>
+#include <wiredis/redis-connection.h>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Local cache of read-mostly keys, kept valid by the server (CLIENT TRACKING).
+         *
+         * There are two connections: the data connection sends the reads with tracking on, the
+         * invalidation connection is subscribed to __redis__:invalidate and gets the tracking messages
+         * (RESP2 redirect mode). A key is dropped from the cache when the server reports it's changed.
+         *
+         * Nothing is cached while tracking isn't working (either connection is down), and the whole
+         * cache is flushed when either connection is lost: invalidations may have been missed.
+         *
+         * The cache is bounded by the number of keys and the bytes of keys and values; the least
+         * recently used key is evicted.
+         */
+        class tracking_cache
+        {
+        public:
+
+            tracking_cache(boost::asio::io_service & io_service,
+                           std::size_t max_keys = 10000,
+                           std::size_t max_bytes = 64 * 1024 * 1024):
+                _data(io_service),
+                _invalidation(io_service),
+                _max_keys(max_keys),
+                _max_bytes(max_bytes),
+                _data_connected(false),
+                _redirect_id(0),
+                _tracking(false),
+                _epoch(0),
+                _bytes(0),
+                _hits(0),
+                _misses(0)
+            {
+            }
+
+
+            /*
+             * Broadcasting mode (BCAST): the server reports the changes of every key with the given
+             * prefixes, not only of the keys read. Only the keys with these prefixes are cached then.
+             * Call it before connect().
+             */
+            void set_bcast_prefixes(std::vector<std::string> const & prefixes)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _prefixes = prefixes;
+            }
+
+
+            void set_log_callback(std::function<void (std::string const &)> cb)
+            {
+                _log_callback = cb;
+                _data.set_log_callback(cb);
+                _invalidation.set_log_callback(cb);
+            }
+
+
+            /*
+             * Parameters are the same as redis_connection::connect(), the callbacks belong to the data
+             * connection. Both connections reconnect automatically.
+             */
+            void connect(std::string const & ip,
+                         uint16_t port,
+                         std::function<void (boost::system::error_code const &)> connected_callback,
+                         std::function<void (boost::system::error_code const &)> disconnected_callback)
+            {
+                _invalidation.connect(ip,
+                                      port,
+                                      [this] (boost::system::error_code const & error)
+                                      {
+                                          if (!error)
+                                          {
+                                              on_invalidation_connected();
+                                          }
+                                      },
+                                      [this] (boost::system::error_code const &)
+                                      {
+                                          on_tracking_lost(true);
+                                      });
+                _data.connect(ip,
+                              port,
+                              [this, connected_callback] (boost::system::error_code const & error)
+                              {
+                                  if (!error)
+                                  {
+                                      {
+                                          std::unique_lock<std::mutex> guard(_mutex);
+                                          _data_connected = true;
+                                      }
+                                      on_tracking_lost(false);
+                                      enable_tracking();
+                                  }
+                                  if (connected_callback)
+                                  {
+                                      connected_callback(error);
+                                  }
+                              },
+                              [this, disconnected_callback] (boost::system::error_code const & error)
+                              {
+                                  {
+                                      std::unique_lock<std::mutex> guard(_mutex);
+                                      _data_connected = false;
+                                  }
+                                  on_tracking_lost(false);
+                                  if (disconnected_callback)
+                                  {
+                                      disconnected_callback(error);
+                                  }
+                              });
+            }
+
+
+            void disconnect()
+            {
+                _data.disconnect();
+                _invalidation.disconnect();
+                flush();
+            }
+
+
+            void sync_join()
+            {
+                _data.sync_join();
+                _invalidation.sync_join();
+            }
+
+
+            // True once the reads are tracked, i.e. they can be cached
+            bool tracking() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _tracking;
+            }
+
+
+            /*
+             * Deterministic read of a single key (command[1]), e.g. GET, HGET, HGETALL, STRLEN, LRANGE. A
+             * cached reply is passed to the callback right away, in the calling thread. Otherwise the command
+             * is sent on the data connection and the reply is cached, unless it's an error.
+             * Other commands (writes, several keys, random or time dependent reads like SRANDMEMBER or TTL,
+             * unknown ones) are sent uncached.
+             */
+            void execute_cached(std::function<void (::nokia::net::proto::redis::reply &&)> callback, std::vector<std::string> const & command)
+            {
+                if (!is_cacheable(command) || std::vector<std::size_t>{1} != key_indexes(command))
+                {
+                    _data.execute_command(std::move(callback), command);
+                    return;
+                }
+                std::string const & key = command[1];
+                std::string subkey = join(command);
+                uint64_t epoch{0};
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if (!_tracking || !cacheable(key))
+                    {
+                        guard.unlock();
+                        _data.execute_command(std::move(callback), command);
+                        return;
+                    }
+                    auto it = _entries.find(key);
+                    if (_entries.end() != it)
+                    {
+                        auto value = it->second.values.find(subkey);
+                        if (it->second.values.end() != value)
+                        {
+                            _lru.splice(_lru.begin(), _lru, it->second.position);
+                            ::nokia::net::proto::redis::reply reply = value->second;
+                            ++_hits;
+                            guard.unlock();
+                            callback(std::move(reply));
+                            return;
+                        }
+                    }
+                    ++_misses;
+                    ++_fetching[key].count;
+                    epoch = _epoch;
+                }
+                _data.execute_command([this, callback, key, subkey, epoch] (::nokia::net::proto::redis::reply && reply)
+                                      {
+                                          store(key, subkey, epoch, reply);
+                                          callback(std::move(reply));
+                                      },
+                                      command);
+            }
+
+
+            void get(std::function<void (::nokia::net::proto::redis::reply &&)> callback, std::string const & key)
+            {
+                execute_cached(std::move(callback), {"GET", key});
+            }
+
+
+            void hget(std::function<void (::nokia::net::proto::redis::reply &&)> callback, std::string const & key, std::string const & field)
+            {
+                execute_cached(std::move(callback), {"HGET", key, field});
+            }
+
+
+            // The data connection, e.g. for writes
+            redis_connection & connection()
+            {
+                return _data;
+            }
+
+
+            // Drops every cached key
+            void flush()
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                clear();
+            }
+
+
+            // Number of cached keys
+            std::size_t size() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _entries.size();
+            }
+
+
+            std::size_t bytes() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _bytes;
+            }
+
+
+            uint64_t hits() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _hits;
+            }
+
+
+            uint64_t misses() const
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                return _misses;
+            }
+
+
+        private:
+
+            struct entry
+            {
+                std::unordered_map<std::string, ::nokia::net::proto::redis::reply> values;     // by command
+                std::list<std::string>::iterator position;                                    // in _lru
+                std::size_t bytes;
+            };
+
+
+            // Reads of a key waiting for reply
+            struct fetching
+            {
+                unsigned count;
+                bool invalidated;                                                               // their replies may be stale
+            };
+
+
+            void on_invalidation_connected()
+            {
+                _invalidation.execute([this] (::nokia::net::proto::redis::reply && reply)
+                                      {
+                                          if (::nokia::net::proto::redis::reply::INTEGER != reply.type)
+                                          {
+                                              return;
+                                          }
+                                          int64_t const id = reply.integer;
+                                          _invalidation.subscribe("__redis__:invalidate",
+                                                                  [this, id] ()
+                                                                  {
+                                                                      {
+                                                                          std::unique_lock<std::mutex> guard(_mutex);
+                                                                          _redirect_id = id;
+                                                                      }
+                                                                      enable_tracking();
+                                                                  },
+                                                                  [this] (std::string const &, std::string const & key)
+                                                                  {
+                                                                      invalidate(key);
+                                                                  },
+                                                                  [] ()
+                                                                  {
+                                                                  });
+                                      },
+                                      "CLIENT", "ID");
+            }
+
+
+            // redirect: the invalidation connection is lost, the data connection has to be redirected again.
+            void on_tracking_lost(bool redirect)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                _tracking = false;
+                if (redirect)
+                {
+                    _redirect_id = 0;
+                }
+                clear();
+            }
+
+
+            // Turns tracking on once both connections are up. Called again after either reconnects.
+            void enable_tracking()
+            {
+                std::vector<std::string> command{"CLIENT", "TRACKING", "ON", "REDIRECT"};
+                int64_t id{0};
+                {
+                    std::unique_lock<std::mutex> guard(_mutex);
+                    if (!_data_connected || 0 == _redirect_id)
+                    {
+                        return;
+                    }
+                    id = _redirect_id;
+                    command.push_back(std::to_string(id));
+                    if (!_prefixes.empty())
+                    {
+                        command.push_back("BCAST");
+                        for (auto const & prefix: _prefixes)
+                        {
+                            command.push_back("PREFIX");
+                            command.push_back(prefix);
+                        }
+                    }
+                }
+                _data.execute_command([this, id] (::nokia::net::proto::redis::reply && reply)
+                                      {
+                                          if (::nokia::net::proto::redis::reply::ERROR == reply.type)
+                                          {
+                                              // Nothing is cached until the next reconnect
+                                              ferror("tracking-cache error: cannot turn tracking on. redirect=%1%, error=%2%", id, reply.str);
+                                              return;
+                                          }
+                                          std::unique_lock<std::mutex> guard(_mutex);
+                                          // Only the reads sent after this are tracked.
+                                          _tracking = (_data_connected && id == _redirect_id);
+                                      },
+                                      command);
+            }
+
+
+            // Empty key: every key is invalid (e.g. FLUSHALL)
+            void invalidate(std::string const & key)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                if (key.empty())
+                {
+                    clear();
+                    return;
+                }
+                auto fetch = _fetching.find(key);
+                if (_fetching.end() != fetch)
+                {
+                    fetch->second.invalidated = true;
+                }
+                auto it = _entries.find(key);
+                if (_entries.end() != it)
+                {
+                    erase(it);
+                }
+            }
+
+
+            void store(std::string const & key, std::string const & subkey, uint64_t epoch, ::nokia::net::proto::redis::reply const & reply)
+            {
+                std::unique_lock<std::mutex> guard(_mutex);
+                bool invalidated{true};
+                auto fetch = _fetching.find(key);
+                if (_fetching.end() != fetch)
+                {
+                    invalidated = fetch->second.invalidated;
+                    if (0 == --fetch->second.count)
+                    {
+                        _fetching.erase(fetch);
+                    }
+                }
+                // The invalidation may arrive on the other connection before the reply.
+                if (invalidated || epoch != _epoch || !_tracking || ::nokia::net::proto::redis::reply::ERROR == reply.type)
+                {
+                    return;
+                }
+                std::size_t const size = subkey.size() + size_of(reply);
+                auto it = _entries.find(key);
+                if (_entries.end() == it)
+                {
+                    _lru.push_front(key);
+                    it = _entries.emplace(key, entry{{}, _lru.begin(), key.size()}).first;
+                    _bytes += key.size();
+                }
+                else
+                {
+                    _lru.splice(_lru.begin(), _lru, it->second.position);
+                }
+                auto & values = it->second.values;
+                auto previous = values.find(subkey);
+                if (values.end() != previous)
+                {
+                    std::size_t const previous_size = subkey.size() + size_of(previous->second);
+                    it->second.bytes -= previous_size;
+                    _bytes -= previous_size;
+                }
+                values[subkey] = reply;
+                it->second.bytes += size;
+                _bytes += size;
+                while (!_lru.empty() && (_entries.size() > _max_keys || _bytes > _max_bytes))
+                {
+                    erase(_entries.find(_lru.back()));
+                }
+            }
+
+
+            void erase(std::unordered_map<std::string, entry>::iterator it)
+            {
+                _bytes -= it->second.bytes;
+                _lru.erase(it->second.position);
+                _entries.erase(it);
+            }
+
+
+            // Call it under lock. The replies on the way are not cached either.
+            void clear()
+            {
+                _entries.clear();
+                _lru.clear();
+                _bytes = 0;
+                ++_epoch;
+            }
+
+
+            bool cacheable(std::string const & key) const
+            {
+                if (_prefixes.empty())
+                {
+                    return true;
+                }
+                for (auto const & prefix: _prefixes)
+                {
+                    if (0 == key.compare(0, prefix.size(), prefix))
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+
+            static std::string join(std::vector<std::string> const & command)
+            {
+                std::string result;
+                for (auto const & argument: command)
+                {
+                    result += std::to_string(argument.size());
+                    result += ':';
+                    result += argument;
+                }
+                return result;
+            }
+
+
+            template <typename... Ts>
+            void ferror(Ts &&... ts)
+            {
+                std::string message = detail::concatenate(std::forward<Ts>(ts)...);
+                if (_log_callback)
+                {
+                    _log_callback(message);
+                }
+                else
+                {
+                    std::cerr << message << std::endl;
+                }
+            }
+
+
+            static std::size_t size_of(::nokia::net::proto::redis::reply const & reply)
+            {
+                std::size_t size = sizeof(reply) + reply.str.size();
+                for (auto const & element: reply.elements)
+                {
+                    size += size_of(element);
+                }
+                return size;
+            }
+
+
+            redis_connection _data;
+            redis_connection _invalidation;
+            std::size_t const _max_keys;
+            std::size_t const _max_bytes;
+            std::vector<std::string> _prefixes;
+            std::function<void (std::string const &)> _log_callback;
+
+            mutable std::mutex _mutex;
+            bool _data_connected;
+            int64_t _redirect_id;                   // client id of the invalidation connection, 0 if it's not subscribed
+            bool _tracking;
+            uint64_t _epoch;                        // incremented on flush
+            std::unordered_map<std::string, entry> _entries;
+            std::list<std::string> _lru;            // most recently used first
+            std::unordered_map<std::string, fetching> _fetching;
+            std::size_t _bytes;
+            uint64_t _hits;
+            uint64_t _misses;
+        };
+
+    }
+}
@@ -0,0 +1,65 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace nokia
+{
+    namespace net
+    {
+
+        /*
+         * Commands of a MULTI/EXEC transaction, see redis_connection::execute_transaction().
+         *
+         * transaction tx;
+         * tx.add("INCR", "counter").add("LPUSH", "log", "incremented");
+         */
+        class transaction
+        {
+        public:
+
+            template <typename... Ts>
+            transaction & add(Ts &&... ts)
+            {
+                _commands.push_back(std::vector<std::string>{std::string(std::forward<Ts>(ts))...});
+                return *this;
+            }
+
+
+            transaction & add_command(std::vector<std::string> command)
+            {
+                _commands.push_back(std::move(command));
+                return *this;
+            }
+
+
+            std::vector<std::vector<std::string>> const & commands() const
+            {
+                return _commands;
+            }
+
+
+            std::size_t size() const
+            {
+                return _commands.size();
+            }
+
+
+            bool empty() const
+            {
+                return _commands.empty();
+            }
+
+
+        private:
+
+            std::vector<std::vector<std::string>> _commands;
+        };
+
+    }
+}
@@ -0,0 +1,167 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <string>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <wiredis/connection-group.h>
+#include <wiredis/redis-pool.h>
+#include <common.h>
+
+namespace
+{
+    ::boost::asio::io_service ios;
+}
+
+
+TEST(connection_group, all_ready)
+{
+    ::nokia::net::redis_connection first(ios);
+    ::nokia::net::redis_connection second(ios);
+    ::nokia::net::redis_pool pool(ios, 4);
+    std::atomic<int> connected{0};
+
+    ::nokia::net::connection_group group(ios);
+    group.add("first", first, "127.0.0.1", 6379, {{"SELECT", "1"}, {"PING"}});
+    group.add("second",
+              second,
+              "127.0.0.1",
+              6379,
+              {},
+              [&] (boost::system::error_code const & error)
+              {
+                  if (!error)
+                  {
+                      ++connected;
+                  }
+              });
+    group.add("pool",
+              [&] (::nokia::net::connection_group::report_callback report)
+              {
+                  pool.connect("127.0.0.1",
+                               6379,
+                               [&, report] (boost::system::error_code const & error)
+                               {
+                                   if (pool.connected())
+                                   {
+                                       report("");
+                                   }
+                               },
+                               [] (boost::system::error_code const &)
+                               {
+                               });
+              });
+
+    bool all_ready{false};
+    auto const members = group.wait(std::chrono::milliseconds(5000), &all_ready);
+    ASSERT_TRUE(all_ready);
+    ASSERT_EQ(3, members.size());
+    ASSERT_EQ("first", members[0].name);
+    ASSERT_EQ("pool", members[2].name);
+    for (auto const & member: members)
+    {
+        ASSERT_TRUE(member.ready) << member.name;
+        ASSERT_TRUE(member.error.empty()) << member.name;
+        ASSERT_GT(5000, member.elapsed.count());
+    }
+    ASSERT_EQ(1, connected);
+    ASSERT_TRUE(first.connected());
+    ASSERT_TRUE(second.connected());
+
+    for (auto connection: {&first, &second})
+    {
+        connection->disconnect();
+        connection->sync_join();
+    }
+    pool.disconnect();
+    pool.sync_join();
+}
+
+
+TEST(connection_group, timeout_and_handshake_error)
+{
+    ::nokia::net::redis_connection good(ios);
+    ::nokia::net::redis_connection unreachable(ios);
+    ::nokia::net::redis_connection bad_handshake(ios);
+
+    ::nokia::net::connection_group group(ios);
+    group.add("good", good, "127.0.0.1", 6379, {{"PING"}});
+    group.add("unreachable", unreachable, "127.0.0.1", 6399);
+    group.add("bad_handshake", bad_handshake, "127.0.0.1", 6379, {{"PING"}, {"NO-SUCH-COMMAND"}});
+
+    std::atomic<bool> done{false};
+    std::vector<::nokia::net::connection_group::member_status> members;
+    bool all_ready{true};
+    auto const start = std::chrono::steady_clock::now();
+    group.start(std::chrono::milliseconds(1000),
+                [&] (bool ready, std::vector<::nokia::net::connection_group::member_status> const & result)
+                {
+                    all_ready = ready;
+                    members = result;
+                    done = true;
+                });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return done.load();
+                              },
+                              5000));
+    auto const elapsed = std::chrono::steady_clock::now() - start;
+    ASSERT_LE(std::chrono::milliseconds(1000), elapsed);
+    ASSERT_FALSE(all_ready);
+    ASSERT_TRUE(members[0].ready);
+    ASSERT_FALSE(members[1].ready);
+    ASSERT_FALSE(members[1].error.empty());
+    ASSERT_FALSE(members[2].ready);
+    ASSERT_NE(std::string::npos, members[2].error.find("ERR")) << members[2].error;
+
+    for (auto connection: {&good, &unreachable, &bad_handshake})
+    {
+        connection->disconnect();
+        connection->sync_join();
+    }
+}
+
+
+TEST(connection_group, empty)
+{
+    ::nokia::net::connection_group group(ios);
+    bool all_ready{false};
+    ASSERT_TRUE(group.wait(std::chrono::milliseconds(1000), &all_ready).empty());
+    ASSERT_TRUE(all_ready);
+}
+
+
+int main(int argc, char* argv[])
+{
+    stop_server();
+    start_server();
+
+    bool loop_condition = true;
+
+    int retval{0};
+    std::thread scheduler_thread(
+        [&]
+        {
+            while (loop_condition)
+            {
+                ios.reset();
+                ios.run();
+                msleep(10);
+            }
+        });
+
+    ::testing::InitGoogleTest(&argc, argv);
+
+    retval = RUN_ALL_TESTS();
+
+    loop_condition = false;
+    scheduler_thread.join();
+
+    return retval;
+}
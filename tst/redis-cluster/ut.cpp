@@ -0,0 +1,306 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <string>
+#include <iostream>
+#include <thread>
+#include <utility>
+
+#include <wiredis/redis-cluster.h>
+#include <common.h>
+
+namespace
+{
+    ::boost::asio::io_service ios;
+
+    std::vector<std::pair<std::string, uint16_t>> const seeds{{"127.0.0.1", 7000}, {"127.0.0.1", 7001}};
+
+
+    void start_cluster()
+    {
+        for (int port = 7000; port <= 7002; ++port)
+        {
+            std::string const port_str = std::to_string(port);
+            system(("rm -f /tmp/wiredis-nodes-" + port_str + ".conf").c_str());
+            system(("(redis-server --port " + port_str +
+                    " --cluster-enabled yes --cluster-config-file /tmp/wiredis-nodes-" + port_str + ".conf" +
+                    " --save '' --appendonly no &) &> /tmp/redis.cluster." + port_str + ".out").c_str());
+        }
+        msleep(1000);
+        system("redis-cli --cluster create 127.0.0.1:7000 127.0.0.1:7001 127.0.0.1:7002 --cluster-yes");
+        int result(1);
+        while (result)
+        {
+            result = system("redis-cli -p 7000 cluster info | grep -q cluster_state:ok");
+            if (result)
+            {
+                msleep(1000);
+            }
+        }
+        std::cout << "redis cluster is working well" << std::endl;
+    }
+
+
+    void connect(::nokia::net::redis_cluster & cluster)
+    {
+        cluster.connect(seeds,
+                        [&] (boost::system::error_code const & error)
+                        {
+                        },
+                        [&] (boost::system::error_code const & ec)
+                        {
+                            std::cout << "UT: Connection lost. error core: " << ec << std::endl;
+                        });
+        ASSERT_TRUE(wait_for_true([&] ()
+                                  {
+                                      return cluster.connected();
+                                  },
+                                  10000));
+    }
+}
+
+
+TEST(hash_slot, crc16)
+{
+    std::string const input{"123456789"};
+    ASSERT_EQ(0x31C3, ::nokia::net::crc16(input.data(), input.size()));
+}
+
+
+TEST(hash_slot, slot_of_key)
+{
+    ASSERT_EQ(12182, ::nokia::net::hash_slot("foo"));
+    ASSERT_EQ(5061, ::nokia::net::hash_slot("bar"));
+    ASSERT_EQ(::nokia::net::hash_slot("{user1000}.following"), ::nokia::net::hash_slot("{user1000}.followers"));
+    ASSERT_EQ(::nokia::net::hash_slot("user1000"), ::nokia::net::hash_slot("{user1000}.following"));
+}
+
+
+TEST(hash_slot, hash_tag)
+{
+    ASSERT_EQ("user1000", ::nokia::net::hash_tag("{user1000}.following"));
+    ASSERT_EQ("foo{}{bar}", ::nokia::net::hash_tag("foo{}{bar}"));
+    ASSERT_EQ("{bar", ::nokia::net::hash_tag("foo{{bar}}zap"));
+    ASSERT_EQ("bar", ::nokia::net::hash_tag("foo{bar}{zap}"));
+    ASSERT_EQ("foo{bar", ::nokia::net::hash_tag("foo{bar"));
+}
+
+
+TEST(commands, key_indexes)
+{
+    ASSERT_EQ(1, ::nokia::net::first_key_index({"GET", "key"}));
+    ASSERT_EQ(0, ::nokia::net::first_key_index({"PING"}));
+    ASSERT_EQ(3, ::nokia::net::first_key_index({"EVALSHA", "sha", "1", "key", "arg"}));
+    ASSERT_EQ(0, ::nokia::net::first_key_index({"EVALSHA", "sha", "0", "arg"}));
+    ASSERT_EQ((std::vector<std::size_t>{1, 3}), ::nokia::net::key_indexes({"MSET", "a", "1", "b", "2"}));
+    ASSERT_EQ((std::vector<std::size_t>{1, 2}), ::nokia::net::key_indexes({"del", "a", "b"}));
+}
+
+
+TEST(redis_cluster, keys_on_every_node)
+{
+    ::nokia::net::redis_cluster cluster(ios);
+    connect(cluster);
+
+    std::atomic<uint32_t> counter{0};
+    for (int i = 0; i < 100; ++i)
+    {
+        std::string const key = "cluster-key-" + std::to_string(i);
+        cluster.execute([&, key] (::nokia::net::proto::redis::reply && reply)
+                        {
+                            ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING) << reply.str;
+                            cluster.execute([&, key] (::nokia::net::proto::redis::reply && reply)
+                                            {
+                                                ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING) << reply.str;
+                                                ASSERT_EQ(reply.str, "value-" + key);
+                                                ++counter;
+                                            },
+                                            "GET", key);
+                        },
+                        "SET", key, "value-" + key);
+    }
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return counter == 100;
+                              },
+                              10000)) << "counter: " << counter;
+
+    cluster.disconnect();
+    cluster.sync_join();
+}
+
+
+TEST(redis_cluster, keyless_command)
+{
+    ::nokia::net::redis_cluster cluster(ios);
+    connect(cluster);
+
+    bool replied{false};
+    cluster.execute([&] (::nokia::net::proto::redis::reply && reply)
+                    {
+                        ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING);
+                        ASSERT_EQ(reply.str, "PONG");
+                        replied = true;
+                    },
+                    "PING");
+    ASSERT_TRUE(wait_for_true(replied, 10000));
+
+    cluster.disconnect();
+    cluster.sync_join();
+}
+
+
+TEST(redis_cluster, moved_slot_is_followed)
+{
+    ::nokia::net::redis_cluster cluster(ios);
+    connect(cluster);
+
+    // Move the slot of "foo" (12182) to the first node behind the back of the client
+    system("redis-cli -p 7002 cluster setslot 12182 node $(redis-cli -p 7000 cluster myid)");
+    system("redis-cli -p 7000 cluster setslot 12182 node $(redis-cli -p 7000 cluster myid)");
+    msleep(500);
+
+    bool replied{false};
+    cluster.execute([&] (::nokia::net::proto::redis::reply && reply)
+                    {
+                        ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING) << reply.str;
+                        replied = true;
+                    },
+                    "SET", "foo", "bar");
+    ASSERT_TRUE(wait_for_true(replied, 10000));
+
+    replied = false;
+    cluster.execute([&] (::nokia::net::proto::redis::reply && reply)
+                    {
+                        ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING) << reply.str;
+                        ASSERT_EQ(reply.str, "bar");
+                        replied = true;
+                    },
+                    "GET", "foo");
+    ASSERT_TRUE(wait_for_true(replied, 10000));
+
+    cluster.disconnect();
+    cluster.sync_join();
+}
+
+
+TEST(redis_cluster, cross_slot_commands)
+{
+    ::nokia::net::redis_cluster cluster(ios);
+    connect(cluster);
+
+    std::vector<std::string> mset{"MSET"};
+    std::vector<std::string> mget{"MGET"};
+    for (int i = 0; i < 20; ++i)
+    {
+        mset.push_back("cross-slot-key-" + std::to_string(i));
+        mset.push_back("value-" + std::to_string(i));
+        mget.push_back("cross-slot-key-" + std::to_string(i));
+    }
+    mget.push_back("cross-slot-non-existing-key");
+
+    bool replied{false};
+    cluster.execute_command([&] (::nokia::net::proto::redis::reply && reply)
+                            {
+                                ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING) << reply.str;
+                                ASSERT_EQ(reply.str, "OK");
+                                replied = true;
+                            },
+                            mset);
+    ASSERT_TRUE(wait_for_true(replied, 10000));
+
+    replied = false;
+    cluster.execute_command([&] (::nokia::net::proto::redis::reply && reply)
+                            {
+                                ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ARRAY) << reply.str;
+                                ASSERT_EQ(21, reply.elements.size());
+                                for (int i = 0; i < 20; ++i)
+                                {
+                                    ASSERT_EQ(reply.elements[i].type, ::nokia::net::proto::redis::reply::STRING);
+                                    ASSERT_EQ(reply.elements[i].str, "value-" + std::to_string(i));
+                                }
+                                ASSERT_EQ(reply.elements[20].type, ::nokia::net::proto::redis::reply::NIL);
+                                replied = true;
+                            },
+                            mget);
+    ASSERT_TRUE(wait_for_true(replied, 10000));
+
+    mget[0] = "EXISTS";
+    replied = false;
+    cluster.execute_command([&] (::nokia::net::proto::redis::reply && reply)
+                            {
+                                ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::INTEGER) << reply.str;
+                                ASSERT_EQ(20, reply.integer);
+                                replied = true;
+                            },
+                            mget);
+    ASSERT_TRUE(wait_for_true(replied, 10000));
+
+    mget[0] = "DEL";
+    replied = false;
+    cluster.execute_command([&] (::nokia::net::proto::redis::reply && reply)
+                            {
+                                ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::INTEGER) << reply.str;
+                                ASSERT_EQ(20, reply.integer);
+                                replied = true;
+                            },
+                            mget);
+    ASSERT_TRUE(wait_for_true(replied, 10000));
+
+    cluster.disconnect();
+    cluster.sync_join();
+}
+
+
+TEST(redis_cluster, not_ready)
+{
+    ::nokia::net::redis_cluster cluster(ios);
+
+    bool replied{false};
+    cluster.execute([&] (::nokia::net::proto::redis::reply && reply)
+                    {
+                        ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ERROR);
+                        ASSERT_EQ(reply.str, cluster.ERROR_CLUSTER_NOT_READY);
+                        replied = true;
+                    },
+                    "GET", "foo");
+    ASSERT_TRUE(replied);
+
+    cluster.disconnect();
+    cluster.sync_join();
+}
+
+
+int main(int argc, char* argv[])
+{
+    stop_server();
+    start_cluster();
+
+    bool loop_condition = true;
+
+    int retval{0};
+    std::thread scheduler_thread([&] ()
+                                 {
+                                     while (loop_condition)
+                                     {
+                                         ios.reset();
+                                         ios.run();
+                                         msleep(10);
+                                     }
+                                 });
+
+    ::testing::InitGoogleTest(&argc, argv);
+
+    retval = RUN_ALL_TESTS();
+
+    loop_condition = false;
+    scheduler_thread.join();
+
+    stop_server();
+
+    return retval;
+}
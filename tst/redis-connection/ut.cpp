@@ -4,12 +4,17 @@
  */
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <string>
 #include <iostream>
+#include <mutex>
+#include <set>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include <wiredis/redis-connection.h>
+#include <wiredis/scan.h>
 #include <common.h>
 
 namespace
@@ -106,6 +111,66 @@ TEST(redis_connection, some_basic_cases)
 }
 
 
+TEST(redis_connection, execute_from_multiple_threads)
+{
+    ::nokia::net::redis_connection con(ios);
+
+    con.connect("127.0.0.1",
+                6379,
+                [&] (boost::system::error_code const & error)
+                {
+                },
+                [&] (boost::system::error_code const & ec)
+                {
+                    std::cout << "UT: Connection lost. error core: " << ec << std::endl;
+                });
+
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return con.connected();
+                              },
+                              10000));
+
+    uint32_t const num_of_threads{4};
+    uint32_t const num_of_requests{1000};
+    std::atomic<uint32_t> counter{0};
+    std::atomic<uint32_t> mismatch{0};
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < num_of_threads; ++t)
+    {
+        threads.emplace_back([&, t] ()
+                             {
+                                 for (uint32_t i = 0; i < num_of_requests; ++i)
+                                 {
+                                     std::string const message = std::to_string(t) + "-" + std::to_string(i);
+                                     con.execute([&, message] (::nokia::net::proto::redis::reply && reply)
+                                                 {
+                                                     if (reply.str != message)
+                                                     {
+                                                         ++mismatch;
+                                                     }
+                                                     ++counter;
+                                                 },
+                                                 "PING", message);
+                                 }
+                             });
+    }
+    for (auto & thread: threads)
+    {
+        thread.join();
+    }
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return counter == num_of_threads * num_of_requests;
+                              },
+                              10000)) << "counter: " << counter;
+    ASSERT_EQ(0, mismatch);
+
+    con.disconnect();
+    con.sync_join();
+}
+
+
 
 
 TEST(redis_connection, sending_in_disconnected_state)
@@ -513,6 +578,1028 @@ TEST(redis_connection, subscribe_stress)
 
 
 
+TEST(redis_connection, unix_socket)
+{
+    auto const start_unix_server = [] ()
+        {
+            system("(redis-server --port 6390 --unixsocket /tmp/wiredis-ut.sock &) &> /tmp/redis.unix.out");
+            while (system("redis-cli -s /tmp/wiredis-ut.sock get dummy_key"))
+            {
+                msleep(500);
+            }
+        };
+    start_unix_server();
+    ::nokia::net::redis_connection con(ios);
+    uint32_t num_of_disconnection{0};
+    con.connect_unix("/tmp/wiredis-ut.sock",
+                     [&] (boost::system::error_code const & error)
+                     {
+                     },
+                     [&] (boost::system::error_code const & ec)
+                     {
+                         ++num_of_disconnection;
+                     });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return con.connected();
+                              },
+                              10000));
+
+    std::atomic<int> counter{0};
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING);
+                    ++counter;
+                },
+                "SET", "unix_key", "unix_value");
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING);
+                    ASSERT_EQ(reply.str, "unix_value");
+                    ++counter;
+                },
+                "GET", "unix_key");
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 2 == counter;
+                              },
+                              10000));
+
+    // Reconnects over the same socket path
+    system("pkill -f wiredis-ut.sock");
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return !con.connected();
+                              },
+                              10000));
+    start_unix_server();
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return con.connected();
+                              },
+                              10000));
+    ASSERT_EQ(1, num_of_disconnection);
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING);
+                    ++counter;
+                },
+                "PING");
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 3 == counter;
+                              },
+                              10000));
+
+    con.disconnect();
+    con.sync_join();
+    system("pkill -f wiredis-ut.sock");
+}
+
+
+TEST(redis_connection, request_timeout)
+{
+    ::nokia::net::redis_connection con(ios);
+    std::atomic<int> connections{0};
+    con.connect("127.0.0.1",
+                6379,
+                [&] (boost::system::error_code const & error)
+                {
+                    if (!error)
+                    {
+                        ++connections;
+                    }
+                },
+                [&] (boost::system::error_code const & ec)
+                {
+                });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return con.connected();
+                              },
+                              10000));
+
+    // Both expire while the server sleeps, the late replies are dropped, so the next reply goes to its own request.
+    std::atomic<int> timeouts{0};
+    std::atomic<int> counter{0};
+    auto const expect_timeout = [&] (::nokia::net::proto::redis::reply && reply)
+        {
+            ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ERROR);
+            ASSERT_EQ(reply.str, con.ERROR_REQUEST_TIMEOUT);
+            ++timeouts;
+        };
+    auto const start = std::chrono::steady_clock::now();
+    con.execute_with_timeout(std::chrono::milliseconds(200), expect_timeout, "DEBUG", "SLEEP", "1");
+    con.execute_command(expect_timeout, {"SET", "timeout_key", "timeout_value"}, std::chrono::milliseconds(100));
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING);
+                    ASSERT_EQ(reply.str, "timeout_value");
+                    ++counter;
+                },
+                "GET", "timeout_key");
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 2 == timeouts;
+                              },
+                              800,
+                              5));
+    ASSERT_GT(std::chrono::milliseconds(800), std::chrono::steady_clock::now() - start);
+    ASSERT_EQ(0, counter);
+    ASSERT_EQ(3, con.pending_requests());
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 1 == counter;
+                              },
+                              5000));
+    ASSERT_EQ(2, con.timed_out_requests());
+    ASSERT_EQ(0, con.pending_requests());
+
+    // Recycle the connection once two requests are stuck
+    con.set_timeout_recycle_threshold(2);
+    con.set_request_timeout(std::chrono::milliseconds(100));
+    con.execute(expect_timeout, "DEBUG", "SLEEP", "1");
+    con.execute(expect_timeout, "PING");
+    con.execute_with_timeout(std::chrono::milliseconds(0),
+                             [&] (::nokia::net::proto::redis::reply && reply)
+                             {
+                                 ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ERROR);
+                                 ASSERT_EQ(reply.str, con.ERROR_TCP_DISCONNECTED);
+                                 ++counter;
+                             },
+                             "PING");
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 4 == timeouts && 2 == counter;
+                              },
+                              1000,
+                              5));
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 2 == connections;
+                              },
+                              10000));
+    con.set_request_timeout(std::chrono::milliseconds(0));
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING);
+                    ++counter;
+                },
+                "PING");
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 3 == counter;
+                              },
+                              10000));
+    ASSERT_EQ(4, con.timed_out_requests());
+
+    con.disconnect();
+    con.sync_join();
+}
+
+
+
+TEST(redis_connection, cancel)
+{
+    ::nokia::net::redis_connection con(ios);
+    con.connect("127.0.0.1",
+                6379,
+                [&] (boost::system::error_code const & error)
+                {
+                },
+                [&] (boost::system::error_code const & ec)
+                {
+                });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return con.connected();
+                              },
+                              10000));
+
+    std::atomic<int> counter{0};
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    ++counter;
+                },
+                "DEL", "cancel_counter");
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    ++counter;
+                },
+                "DEBUG", "SLEEP", "0.5");
+    // Already sent: executed by the server, but the callback isn't called and the reply is dropped.
+    auto const id = con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                                {
+                                    FAIL() << "Cancelled request is called back";
+                                },
+                                "INCR", "cancel_counter");
+    ASSERT_NE(con.NO_REQUEST, id);
+    msleep(100);
+    ASSERT_TRUE(con.cancel(id));
+    ASSERT_FALSE(con.cancel(id));
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING);
+                    ASSERT_EQ(reply.str, "1");
+                    ++counter;
+                },
+                "GET", "cancel_counter");
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 3 == counter;
+                              },
+                              10000));
+    ASSERT_EQ(0, con.pending_requests());
+
+    // Called back already
+    auto const replied = con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                                     {
+                                         ++counter;
+                                     },
+                                     "PING");
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 4 == counter;
+                              },
+                              10000));
+    ASSERT_FALSE(con.cancel(replied));
+
+    con.disconnect();
+    con.sync_join();
+}
+
+
+
+TEST(redis_connection, health_probe)
+{
+    ::nokia::net::redis_connection con(ios);
+    std::atomic<int> connections{0};
+    con.connect("127.0.0.1",
+                6379,
+                [&] (boost::system::error_code const & error)
+                {
+                    if (!error)
+                    {
+                        ++connections;
+                    }
+                },
+                [&] (boost::system::error_code const & ec)
+                {
+                });
+    con.set_health_probe(std::chrono::milliseconds(100), std::chrono::milliseconds(300));
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 3 <= con.rtt().samples();
+                              },
+                              5000));
+    ASSERT_LT(0, con.rtt().average().count());
+    ASSERT_EQ(1, connections);
+    ASSERT_EQ(0, con.timed_out_requests());
+
+    // The server stalls, the probe isn't replied in time
+    system("(redis-cli debug sleep 2 > /dev/null &)");
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 2 <= connections;
+                              },
+                              1500,
+                              10));
+    ASSERT_LE(1, con.timed_out_requests());
+
+    con.disconnect();
+    con.sync_join();
+    msleep(2000);
+}
+
+
+
+TEST(timing_wheel, cancel_all)
+{
+    auto & wheel = boost::asio::use_service<::nokia::net::timing_wheel>(ios);
+    int const owner{0};
+    std::atomic<bool> started{false};
+    std::atomic<bool> finished{false};
+    std::atomic<bool> cancelled_called{false};
+    wheel.schedule(std::chrono::milliseconds(10),
+                   [&] ()
+                   {
+                       started = true;
+                       msleep(200);
+                       finished = true;
+                   },
+                   &owner);
+    wheel.schedule(std::chrono::milliseconds(5000),
+                   [&] ()
+                   {
+                       cancelled_called = true;
+                   },
+                   &owner);
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return started.load();
+                              },
+                              10000,
+                              1));
+    // Waits for the handler running in the io_service thread
+    wheel.cancel_all(&owner);
+    ASSERT_TRUE(finished);
+    ASSERT_EQ(0, wheel.size());
+    ASSERT_FALSE(cancelled_called);
+}
+
+
+TEST(circuit_breaker, states)
+{
+    ::nokia::net::circuit_breaker breaker(2, std::chrono::milliseconds(100));
+    ASSERT_TRUE(breaker.allow());
+    breaker.on_failure();
+    breaker.on_success();   // not in a row
+    breaker.on_failure();
+    ASSERT_EQ(::nokia::net::circuit_breaker::state::CLOSED, breaker.current());
+    breaker.on_failure();
+    ASSERT_EQ(::nokia::net::circuit_breaker::state::OPEN, breaker.current());
+    ASSERT_FALSE(breaker.allow());
+
+    // One trial at a time, its failure opens it again
+    msleep(150);
+    ASSERT_EQ(::nokia::net::circuit_breaker::state::HALF_OPEN, breaker.current());
+    ASSERT_TRUE(breaker.allow());
+    ASSERT_FALSE(breaker.allow());
+    breaker.on_failure();
+    ASSERT_EQ(::nokia::net::circuit_breaker::state::OPEN, breaker.current());
+
+    // An abandoned trial doesn't block the next one, a successful one closes it
+    msleep(150);
+    ASSERT_TRUE(breaker.allow());
+    breaker.on_abandoned();
+    ASSERT_TRUE(breaker.allow());
+    breaker.on_success();
+    ASSERT_EQ(::nokia::net::circuit_breaker::state::CLOSED, breaker.current());
+    ASSERT_TRUE(breaker.allow());
+    ASSERT_TRUE(breaker.allow());
+}
+
+
+TEST(concurrency_limiter, aimd)
+{
+    ::nokia::net::concurrency_limiter limiter(4, 2, 5);
+    for (int i = 0; i < 4; ++i)
+    {
+        ASSERT_TRUE(limiter.try_acquire());
+    }
+    ASSERT_FALSE(limiter.try_acquire());
+    ASSERT_EQ(4, limiter.in_flight());
+
+    // Additive increase while the latency is stable and the limit is used
+    for (int i = 0; i < 40; ++i)
+    {
+        limiter.release(std::chrono::microseconds(1000), false);
+        ASSERT_TRUE(limiter.try_acquire());
+    }
+    ASSERT_EQ(5, limiter.limit());
+
+    // Multiplicative decrease on a slow reply, then on a failure once the average round-trip has passed
+    limiter.release(std::chrono::microseconds(10000), false);
+    ASSERT_EQ(4, limiter.limit());
+    limiter.release(std::chrono::microseconds(10000), false);
+    ASSERT_EQ(4, limiter.limit());
+    msleep(10);
+    limiter.release(std::chrono::microseconds(0), true);
+    msleep(10);
+    limiter.release(std::chrono::microseconds(0), true);
+    ASSERT_EQ(3, limiter.limit());
+    ASSERT_EQ(0, limiter.in_flight());
+
+    // Given up without result
+    ASSERT_TRUE(limiter.try_acquire());
+    limiter.release();
+    ASSERT_EQ(0, limiter.in_flight());
+    ASSERT_EQ(3, limiter.limit());
+}
+
+
+TEST(redis_connection, admission_control)
+{
+    ::nokia::net::redis_connection con(ios);
+    auto breaker = std::make_shared<::nokia::net::circuit_breaker>(2, std::chrono::milliseconds(300));
+    con.set_circuit_breaker(breaker);
+
+    // Not connected yet: the failures open the breaker
+    std::vector<std::string> errors;
+    for (int i = 0; i < 3; ++i)
+    {
+        con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                    {
+                        ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ERROR);
+                        errors.push_back(reply.str);
+                    },
+                    "PING");
+    }
+    ASSERT_EQ(3, errors.size());
+    ASSERT_EQ(con.ERROR_TCP_CANNOT_SEND_MESSAGE, errors[1]);
+    ASSERT_EQ(con.ERROR_CIRCUIT_OPEN, errors[2]);
+
+    con.connect("127.0.0.1",
+                6379,
+                [&] (boost::system::error_code const & error)
+                {
+                },
+                [&] (boost::system::error_code const & ec)
+                {
+                });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return con.connected();
+                              },
+                              10000));
+    msleep(300);
+
+    // The trial closes the breaker
+    std::atomic<int> counter{0};
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING);
+                    ++counter;
+                },
+                "PING");
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 1 == counter;
+                              },
+                              10000));
+    ASSERT_EQ(::nokia::net::circuit_breaker::state::CLOSED, breaker->current());
+
+    // Over the limit while the server is busy
+    auto limiter = std::make_shared<::nokia::net::concurrency_limiter>(2, 1, 2);
+    con.set_concurrency_limiter(limiter);
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    ++counter;
+                },
+                "DEBUG", "SLEEP", "0.3");
+    auto const cancelled = con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                                       {
+                                       },
+                                       "PING");
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ERROR);
+                    ASSERT_EQ(reply.str, con.ERROR_CONCURRENCY_LIMIT);
+                    ++counter;
+                },
+                "PING");
+    ASSERT_EQ(2, counter);
+    ASSERT_EQ(2, limiter->in_flight());
+    // A cancelled request gives its place back
+    ASSERT_TRUE(con.cancel(cancelled));
+    ASSERT_EQ(1, limiter->in_flight());
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 3 == counter;
+                              },
+                              10000));
+    ASSERT_EQ(0, limiter->in_flight());
+
+    con.disconnect();
+    con.sync_join();
+}
+
+
+TEST(redis_connection, transaction)
+{
+    ::nokia::net::redis_connection con(ios);
+    ::nokia::net::redis_connection other(ios);
+    for (auto connection: {&con, &other})
+    {
+        connection->connect("127.0.0.1",
+                            6379,
+                            [&] (boost::system::error_code const & error)
+                            {
+                            },
+                            [&] (boost::system::error_code const & ec)
+                            {
+                            });
+    }
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return con.connected() && other.connected();
+                              },
+                              10000));
+
+    // One callback with the results in order
+    std::atomic<int> counter{0};
+    ::nokia::net::transaction tx;
+    tx.add("SET", "tx_key", "1").add("INCR", "tx_key").add("SET", "tx_text", "a").add("INCR", "tx_text").add_command({"GET", "tx_key"});
+    con.execute_transaction(tx,
+                            [&] (::nokia::net::proto::redis::reply && reply)
+                            {
+                                ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ARRAY);
+                                ASSERT_EQ(5, reply.elements.size());
+                                ASSERT_EQ(reply.elements[0].str, "OK");
+                                ASSERT_EQ(reply.elements[1].integer, 2);
+                                ASSERT_EQ(reply.elements[3].type, ::nokia::net::proto::redis::reply::ERROR);
+                                ASSERT_EQ(reply.elements[4].str, "2");
+                                ++counter;
+                            });
+
+    // A rejected command discards the transaction, its error is passed
+    ::nokia::net::transaction rejected;
+    rejected.add("INCR", "tx_key").add("NOSUCHCMD");
+    con.execute_transaction(rejected,
+                            [&] (::nokia::net::proto::redis::reply && reply)
+                            {
+                                ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ERROR);
+                                ASSERT_EQ(0, reply.str.find("ERR unknown command"));
+                                ++counter;
+                            });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 2 == counter;
+                              },
+                              10000));
+
+    // The first attempt meets a concurrent change, the second one succeeds
+    std::atomic<int> attempts{0};
+    con.execute_watched({"tx_key"},
+                        [&] (std::function<void (::nokia::net::transaction const &)> commit)
+                        {
+                            if (1 == ++attempts)
+                            {
+                                other.execute([&, commit] (::nokia::net::proto::redis::reply && reply)
+                                              {
+                                                  commit(::nokia::net::transaction().add("INCR", "tx_key"));
+                                              },
+                                              "SET", "tx_key", "10");
+                                return;
+                            }
+                            commit(::nokia::net::transaction().add("INCR", "tx_key"));
+                        },
+                        [&] (::nokia::net::proto::redis::reply && reply)
+                        {
+                            ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ARRAY);
+                            ASSERT_EQ(1, reply.elements.size());
+                            ASSERT_EQ(reply.elements[0].integer, 11);
+                            ++counter;
+                        });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 3 == counter;
+                              },
+                              10000));
+    ASSERT_EQ(2, attempts);
+
+    // Out of attempts
+    con.execute_watched({"tx_key"},
+                        [&] (std::function<void (::nokia::net::transaction const &)> commit)
+                        {
+                            other.execute([&, commit] (::nokia::net::proto::redis::reply && reply)
+                                          {
+                                              commit(::nokia::net::transaction().add("INCR", "tx_key"));
+                                          },
+                                          "SET", "tx_key", "10");
+                        },
+                        [&] (::nokia::net::proto::redis::reply && reply)
+                        {
+                            ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::NIL);
+                            ++counter;
+                        },
+                        2);
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 4 == counter;
+                              },
+                              10000));
+
+    // A watched transaction in progress doesn't affect the other transactions of the connection
+    std::mutex mutex;
+    std::function<void (::nokia::net::transaction const &)> pending_commit;
+    con.execute_watched({"tx_key"},
+                        [&] (std::function<void (::nokia::net::transaction const &)> commit)
+                        {
+                            std::unique_lock<std::mutex> guard(mutex);
+                            pending_commit = commit;
+                        },
+                        [&] (::nokia::net::proto::redis::reply && reply)
+                        {
+                            ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::NIL);
+                            ++counter;
+                        },
+                        1);
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  std::unique_lock<std::mutex> guard(mutex);
+                                  return nullptr != pending_commit;
+                              },
+                              10000));
+    other.execute([&] (::nokia::net::proto::redis::reply && reply)
+                  {
+                      con.execute_transaction(::nokia::net::transaction().add("SET", "tx_other", "1"),
+                                              [&] (::nokia::net::proto::redis::reply && reply)
+                                              {
+                                                  ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ARRAY);
+                                                  ++counter;
+                                              });
+                  },
+                  "SET", "tx_key", "20");
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 5 == counter;
+                              },
+                              10000));
+    {
+        std::unique_lock<std::mutex> guard(mutex);
+        pending_commit(::nokia::net::transaction().add("INCR", "tx_key"));
+        pending_commit = nullptr;
+    }
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 6 == counter;
+                              },
+                              10000));
+
+    // A body dropping commit() releases the keys
+    con.execute_watched({"tx_key"},
+                        [&] (std::function<void (::nokia::net::transaction const &)> commit)
+                        {
+                        },
+                        [&] (::nokia::net::proto::redis::reply && reply)
+                        {
+                            ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ERROR);
+                            ++counter;
+                        });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 7 == counter;
+                              },
+                              10000));
+
+    // An empty transaction releases the keys
+    con.execute_watched({"tx_key"},
+                        [&] (std::function<void (::nokia::net::transaction const &)> commit)
+                        {
+                            commit(::nokia::net::transaction());
+                        },
+                        [&] (::nokia::net::proto::redis::reply && reply)
+                        {
+                            ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ARRAY);
+                            ASSERT_TRUE(reply.elements.empty());
+                            ASSERT_TRUE(reply.str.empty());
+                            ++counter;
+                        });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 8 == counter;
+                              },
+                              10000));
+
+    // The watch connection has the request timeout of the connection, also if it's set later
+    con.set_request_timeout(std::chrono::milliseconds(200));
+    con.execute_watched({"tx_key"},
+                        [&] (std::function<void (::nokia::net::transaction const &)> commit)
+                        {
+                            commit(::nokia::net::transaction().add("DEBUG", "SLEEP", "1"));
+                        },
+                        [&] (::nokia::net::proto::redis::reply && reply)
+                        {
+                            ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ERROR);
+                            ASSERT_EQ(reply.str, con.ERROR_REQUEST_TIMEOUT);
+                            ++counter;
+                        });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 9 == counter;
+                              },
+                              10000));
+
+    con.disconnect();
+    con.sync_join();
+    other.disconnect();
+    other.sync_join();
+}
+
+
+
+TEST(redis_connection, pipeline)
+{
+    ::nokia::net::redis_connection con(ios);
+    ::nokia::net::pipeline batch(64 * 1024);
+    batch.add("PING");
+
+    // Not connected: every command gets the error
+    std::vector<::nokia::net::proto::redis::reply> replies;
+    con.execute_pipeline(batch,
+                         [&] (std::vector<::nokia::net::proto::redis::reply> && r)
+                         {
+                             replies = std::move(r);
+                         });
+    ASSERT_EQ(1, replies.size());
+    ASSERT_EQ(replies[0].type, ::nokia::net::proto::redis::reply::ERROR);
+    ASSERT_EQ(replies[0].str, con.ERROR_TCP_CANNOT_SEND_MESSAGE);
+
+    con.connect("127.0.0.1",
+                6379,
+                [&] (boost::system::error_code const & error)
+                {
+                },
+                [&] (boost::system::error_code const & ec)
+                {
+                });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return con.connected();
+                              },
+                              10000));
+
+    std::size_t const size{1000};
+    batch.clear();
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        batch.add("SET", "pipeline_" + std::to_string(i), std::to_string(i));
+    }
+    std::size_t const capacity = batch.buffer().capacity();
+    std::atomic<int> counter{0};
+    con.execute_pipeline(batch,
+                         [&] (std::vector<::nokia::net::proto::redis::reply> && r)
+                         {
+                             ASSERT_EQ(size, r.size());
+                             ++counter;
+                         });
+    // Reused, the replies keep the order of the commands, also with requests between the batches
+    batch.clear();
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        batch.add_command({"GET", "pipeline_" + std::to_string(i)});
+    }
+    ASSERT_EQ(capacity, batch.buffer().capacity());
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    ASSERT_EQ(reply.str, "between");
+                    ASSERT_EQ(1, counter);
+                    ++counter;
+                },
+                "PING", "between");
+    con.execute_pipeline(batch,
+                         [&] (std::vector<::nokia::net::proto::redis::reply> && r)
+                         {
+                             ASSERT_EQ(size, r.size());
+                             for (std::size_t i = 0; i < size; ++i)
+                             {
+                                 ASSERT_EQ(r[i].str, std::to_string(i));
+                             }
+                             ++counter;
+                         });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 3 == counter;
+                              },
+                              10000));
+
+    // A single command with a one-element ARRAY reply isn't unwrapped
+    batch.clear();
+    batch.add("MGET", "pipeline_7");
+    con.execute_pipeline(batch,
+                         [&] (std::vector<::nokia::net::proto::redis::reply> && r)
+                         {
+                             ASSERT_EQ(1, r.size());
+                             ASSERT_EQ(r[0].type, ::nokia::net::proto::redis::reply::ARRAY);
+                             ASSERT_EQ(1, r[0].elements.size());
+                             ASSERT_EQ(r[0].elements[0].str, "7");
+                             ++counter;
+                         });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 4 == counter;
+                              },
+                              10000));
+
+    con.disconnect();
+    con.sync_join();
+}
+
+
+TEST(redis_connection, script)
+{
+    ASSERT_EQ("e0e1f9fabfc9d4800c877a703b823ac0578ff8db", ::nokia::net::sha1_hex("return 1"));
+    ASSERT_EQ("da39a3ee5e6b4b0d3255bfef95601890afd80709", ::nokia::net::sha1_hex(""));
+
+    auto scripts = std::make_shared<::nokia::net::script_registry>();
+    auto lua = scripts->add("return redis.call('INCR', KEYS[1])");
+    ASSERT_EQ(lua, scripts->add("return redis.call('INCR', KEYS[1])"));
+    ASSERT_EQ("61636018f4e6b5817b89791bbed242f93fa089e3", lua->sha());
+
+    system("redis-cli script flush");
+    ::nokia::net::redis_connection con(ios);
+    con.set_scripts(scripts);
+    std::atomic<int> counter{0};
+    con.connect("127.0.0.1",
+                6379,
+                [&] (boost::system::error_code const & error)
+                {
+                    if (error)
+                    {
+                        return;
+                    }
+                    // Loaded before anything sent from the connected callback
+                    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                                {
+                                    ASSERT_NE(reply.type, ::nokia::net::proto::redis::reply::ERROR) << reply.str;
+                                    ++counter;
+                                },
+                                "EVALSHA", lua->sha(), "1", "script_key");
+                },
+                [&] (boost::system::error_code const & ec)
+                {
+                });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 1 == counter;
+                              },
+                              10000));
+
+    // NOSCRIPT: sent again by EVAL, that loads it too
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    ++counter;
+                },
+                "SCRIPT", "FLUSH");
+    ::nokia::net::execute_script(con,
+                                 lua,
+                                 {"script_key"},
+                                 {},
+                                 [&] (::nokia::net::proto::redis::reply && reply)
+                                 {
+                                     ASSERT_NE(reply.type, ::nokia::net::proto::redis::reply::ERROR) << reply.str;
+                                     ++counter;
+                                 });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 3 == counter;
+                              },
+                              10000));
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    ASSERT_NE(reply.type, ::nokia::net::proto::redis::reply::ERROR) << reply.str;
+                    ++counter;
+                },
+                "EVALSHA", lua->sha(), "1", "script_key");
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 4 == counter;
+                              },
+                              10000));
+
+    con.disconnect();
+    con.sync_join();
+}
+
+
+TEST(redis_connection, scan)
+{
+    for (int i = 0; i < 10; ++i)
+    {
+        system(("redis-cli set scan_key_" + std::to_string(i) + " value").c_str());
+    }
+    ::nokia::net::redis_connection con(ios);
+    con.connect("127.0.0.1",
+                6379,
+                [&] (boost::system::error_code const & error)
+                {
+                },
+                [&] (boost::system::error_code const & ec)
+                {
+                });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return con.connected();
+                              },
+                              10000));
+
+    std::mutex mutex;
+    std::set<std::string> keys;
+    std::atomic<int> pages{0};
+    std::atomic<bool> done{false};
+    std::string result{"not called"};
+    std::shared_ptr<::nokia::net::scan_iterator<::nokia::net::redis_connection>> iterator;
+    iterator = ::nokia::net::scan_iterator<::nokia::net::redis_connection>::start(con,
+                                                                                  {"SCAN"},
+                                                                                  {"MATCH", "scan_key_*", "COUNT", "1"},
+                                                                                  [&] (std::vector<std::string> && items)
+                                                                                  {
+                                                                                      std::unique_lock<std::mutex> guard(mutex);
+                                                                                      keys.insert(items.begin(), items.end());
+                                                                                      if (1 == ++pages)
+                                                                                      {
+                                                                                          // Backpressure: nothing delivered until resumed
+                                                                                          iterator->pause();
+                                                                                      }
+                                                                                  },
+                                                                                  [&] (std::string const & error)
+                                                                                  {
+                                                                                      result = error;
+                                                                                      done = true;
+                                                                                  },
+                                                                                  true);
+    // Started paused, the page callback refers to the iterator.
+    msleep(200);
+    ASSERT_EQ(0, pages);
+    iterator->resume();
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 1 == pages;
+                              },
+                              10000));
+    msleep(200);
+    ASSERT_EQ(1, pages);
+    ASSERT_FALSE(done);
+
+    iterator->resume();
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return done.load();
+                              },
+                              10000));
+    ASSERT_EQ("", result);
+    ASSERT_TRUE(iterator->done());
+    ASSERT_EQ(10, keys.size());
+    ASSERT_EQ(1, keys.count("scan_key_7"));
+
+    con.disconnect();
+    con.sync_join();
+}
+
+
+TEST(redis_connection, blocking_lanes)
+{
+    ASSERT_TRUE(::nokia::net::is_blocking({"BLPOP", "queue", "1"}));
+    ASSERT_TRUE(::nokia::net::is_blocking({"bzpopmin", "queue", "1"}));
+    ASSERT_TRUE(::nokia::net::is_blocking({"XREAD", "COUNT", "10", "BLOCK", "100", "STREAMS", "stream", "$"}));
+    ASSERT_FALSE(::nokia::net::is_blocking({"XREAD", "STREAMS", "block", "0"}));
+    ASSERT_FALSE(::nokia::net::is_blocking({"LPOP", "queue"}));
+    ASSERT_FALSE(::nokia::net::is_blocking({"WAIT", "1", "100"}));
+
+    ::nokia::net::redis_connection con(ios);
+    con.set_blocking_lanes(1);
+    con.connect("127.0.0.1",
+                6379,
+                [&] (boost::system::error_code const & error)
+                {
+                },
+                [&] (boost::system::error_code const & ec)
+                {
+                });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return con.connected();
+                              },
+                              10000));
+
+    // The request timeout doesn't apply to the lanes, the server holds them until the command's timeout.
+    con.set_request_timeout(std::chrono::milliseconds(200));
+    // The lanes get the health probe too, it doesn't disturb a blocking command in flight.
+    con.set_health_probe(std::chrono::milliseconds(50));
+
+    // Two blocking commands share the only lane, one after the other
+    std::atomic<int> popped{0};
+    for (int i = 0; i < 2; ++i)
+    {
+        con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                    {
+                        ASSERT_NE(reply.type, ::nokia::net::proto::redis::reply::ERROR) << reply.str;
+                        ++popped;
+                    },
+                    "BLPOP", "empty_queue", "1");
+    }
+
+    // Not held up by them
+    std::atomic<bool> replied{false};
+    auto const start = std::chrono::steady_clock::now();
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    replied = true;
+                },
+                "PING");
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return replied.load();
+                              },
+                              10000,
+                              10));
+    ASSERT_GT(std::chrono::milliseconds(500), std::chrono::steady_clock::now() - start);
+    ASSERT_EQ(0, popped);
+
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 2 == popped;
+                              },
+                              10000));
+    ASSERT_EQ(1, con.blocking_lanes());
+
+    con.disconnect();
+    ASSERT_EQ(0, con.blocking_lanes());
+    con.sync_join();
+}
+
+
 int main(int argc, char* argv[])
 {
     stop_server();
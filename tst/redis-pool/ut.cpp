@@ -0,0 +1,334 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <string>
+#include <iostream>
+#include <thread>
+#include <utility>
+
+#include <wiredis/redis-pool.h>
+#include <common.h>
+
+namespace
+{
+    ::boost::asio::io_service ios;
+    ::boost::asio::io_service second_ios;
+}
+
+
+TEST(redis_pool, execute_on_every_member)
+{
+    ::nokia::net::redis_pool pool(ios, 4);
+    ASSERT_EQ(4, pool.size());
+
+    uint32_t num_of_connected{0};
+    pool.connect("127.0.0.1",
+                 6379,
+                 [&] (boost::system::error_code const & error)
+                 {
+                     if (error)
+                     {
+                         std::cout << "UT: Could not connect, reconnecting." << std::endl;
+                         return;
+                     }
+                     ++num_of_connected;
+                 },
+                 [&] (boost::system::error_code const & ec)
+                 {
+                     std::cout << "UT: Connection lost. error core: " << ec << std::endl;
+                 });
+
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return num_of_connected == 4;
+                              },
+                              10000));
+    ASSERT_TRUE(pool.connected());
+
+    uint64_t counter{0};
+    for (int i = 0; i < 100; ++i)
+    {
+        pool.execute([&] (::nokia::net::proto::redis::reply && reply)
+                     {
+                         ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING);
+                         ASSERT_EQ(reply.str, "string_value");
+                         ++counter;
+                     },
+                     "GET", "string_key");
+    }
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return counter == 100;
+                              },
+                              10000)) << "counter: " << counter;
+
+    pool.disconnect();
+    pool.sync_join();
+}
+
+
+TEST(redis_pool, multiple_io_services)
+{
+    ::nokia::net::redis_pool pool({std::ref(ios), std::ref(second_ios)}, 2);
+
+    pool.connect("127.0.0.1",
+                 6379,
+                 [&] (boost::system::error_code const & error)
+                 {
+                 },
+                 [&] (boost::system::error_code const & ec)
+                 {
+                     std::cout << "UT: Connection lost. error core: " << ec << std::endl;
+                 });
+
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return pool.connected();
+                              },
+                              10000));
+
+    std::atomic<uint64_t> counter{0};
+    for (int i = 0; i < 10; ++i)
+    {
+        pool.execute([&] (::nokia::net::proto::redis::reply && reply)
+                     {
+                         ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::INTEGER);
+                         ++counter;
+                     },
+                     "INCR", "pool-integer-key");
+    }
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return counter == 10;
+                              },
+                              10000)) << "counter: " << counter;
+
+    pool.disconnect();
+    pool.sync_join();
+}
+
+
+TEST(redis_pool, no_connection)
+{
+    stop_server();
+    ::nokia::net::redis_pool pool(ios, 2);
+
+    pool.connect("127.0.0.1",
+                 6379,
+                 [&] (boost::system::error_code const & error)
+                 {
+                 },
+                 [&] (boost::system::error_code const & ec)
+                 {
+                 });
+
+    bool replied{false};
+    pool.execute([&] (::nokia::net::proto::redis::reply && reply)
+                 {
+                     ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ERROR);
+                     ASSERT_EQ(reply.str, pool.ERROR_NO_CONNECTION);
+                     replied = true;
+                 },
+                 "GET", "string_key");
+    ASSERT_TRUE(replied);
+
+    pool.disconnect();
+    pool.sync_join();
+    start_server();
+}
+
+
+TEST(redis_pool, replace_unhealthy_connection)
+{
+    ::nokia::net::redis_pool pool(ios, 2);
+    pool.set_health_check(std::chrono::milliseconds(100), std::chrono::milliseconds(500));
+
+    uint32_t num_of_connected{0};
+    pool.connect("127.0.0.1",
+                 6379,
+                 [&] (boost::system::error_code const & error)
+                 {
+                     if (!error)
+                     {
+                         ++num_of_connected;
+                     }
+                 },
+                 [&] (boost::system::error_code const & ec)
+                 {
+                 });
+
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return num_of_connected == 2;
+                              },
+                              10000));
+
+    // Block one member for longer than the limit, it has to be replaced
+    bool replied{false};
+    pool.execute([&] (::nokia::net::proto::redis::reply && reply)
+                 {
+                     ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ERROR);
+                     replied = true;
+                 },
+                 "BLPOP", "pool-non-existing-list", "0");
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return replied && num_of_connected == 3;
+                              },
+                              10000));
+
+    pool.disconnect();
+    pool.sync_join();
+}
+
+
+TEST(hedged_request, first_reply_wins)
+{
+    uint32_t replies{0};
+    std::string value;
+    auto request = std::make_shared<::nokia::net::hedged_request>(ios,
+                                                                 [&] (::nokia::net::proto::redis::reply && reply)
+                                                                 {
+                                                                     value = reply.str;
+                                                                     ++replies;
+                                                                 });
+    auto first = request->reply_handler();
+    std::function<void (::nokia::net::proto::redis::reply &&)> second;
+    std::atomic<bool> resent{false};
+    request->hedge_after(std::chrono::milliseconds(10),
+                         [&] ()
+                         {
+                             second = request->reply_handler();
+                             resent = true;
+                         });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return resent == true;
+                              },
+                              1000));
+
+    ::nokia::net::proto::redis::reply reply;
+    reply.type = ::nokia::net::proto::redis::reply::STRING;
+    reply.str = "second";
+    second(std::move(reply));
+    reply.str = "first";
+    first(std::move(reply));
+    ASSERT_EQ(1, replies);
+    ASSERT_EQ("second", value);
+    ASSERT_TRUE(request->done());
+}
+
+
+TEST(hedged_request, no_hedge_after_reply)
+{
+    bool replied{false};
+    auto request = std::make_shared<::nokia::net::hedged_request>(ios,
+                                                                 [&] (::nokia::net::proto::redis::reply && reply)
+                                                                 {
+                                                                     replied = true;
+                                                                 });
+    request->reply_handler()(::nokia::net::proto::redis::reply());
+    std::atomic<bool> resent{false};
+    request->hedge_after(std::chrono::milliseconds(10),
+                         [&] ()
+                         {
+                             resent = true;
+                         });
+    msleep(100);
+    ASSERT_TRUE(replied);
+    ASSERT_FALSE(resent);
+}
+
+
+TEST(redis_pool, hedged_reads)
+{
+    ::nokia::net::redis_pool pool(ios, 2);
+    pool.set_hedging(0.95, std::chrono::milliseconds(10));
+
+    uint32_t num_of_connected{0};
+    pool.connect("127.0.0.1",
+                 6379,
+                 [&] (boost::system::error_code const & error)
+                 {
+                     if (!error)
+                     {
+                         ++num_of_connected;
+                     }
+                 },
+                 [&] (boost::system::error_code const & ec)
+                 {
+                 });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return num_of_connected == 2;
+                              },
+                              10000));
+
+    bool replied{false};
+    pool.execute([&] (::nokia::net::proto::redis::reply && reply)
+                 {
+                     replied = true;
+                 },
+                 "SET", "pool-hedged-key", "pool-hedged-value");
+    ASSERT_TRUE(wait_for_true(replied, 10000));
+
+    std::atomic<uint32_t> counter{0};
+    for (int i = 0; i < 100; ++i)
+    {
+        pool.execute([&] (::nokia::net::proto::redis::reply && reply)
+                     {
+                         ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING);
+                         ASSERT_EQ(reply.str, "pool-hedged-value");
+                         ++counter;
+                     },
+                     "GET", "pool-hedged-key");
+    }
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return counter == 100;
+                              },
+                              10000)) << "counter: " << counter;
+
+    pool.disconnect();
+    pool.sync_join();
+}
+
+
+int main(int argc, char* argv[])
+{
+    stop_server();
+    start_server();
+
+    system("redis-cli set string_key string_value");
+    system("redis-cli del pool-integer-key");
+    system("redis-cli del pool-non-existing-list");
+
+    bool loop_condition = true;
+
+    int retval{0};
+    auto scheduler = [&] (::boost::asio::io_service & io_service)
+        {
+            while (loop_condition)
+            {
+                io_service.reset();
+                io_service.run();
+                msleep(10);
+            }
+        };
+    std::thread scheduler_thread(scheduler, std::ref(ios));
+    std::thread second_scheduler_thread(scheduler, std::ref(second_ios));
+
+    ::testing::InitGoogleTest(&argc, argv);
+
+    retval = RUN_ALL_TESTS();
+
+    loop_condition = false;
+    scheduler_thread.join();
+    second_scheduler_thread.join();
+
+    return retval;
+}
@@ -0,0 +1,239 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <string>
+#include <iostream>
+#include <thread>
+#include <utility>
+
+#include <wiredis/redis-replicas.h>
+#include <common.h>
+
+namespace
+{
+    ::boost::asio::io_service ios;
+
+
+    void start_replication()
+    {
+        // Primary: 6379, replicas: 6380, 6381
+        start_server();
+        system("(redis-server --port 6380 --replicaof 127.0.0.1 6379 &) &> /tmp/redis.replica.6380.out");
+        system("(redis-server --port 6381 --replicaof 127.0.0.1 6379 &) &> /tmp/redis.replica.6381.out");
+
+        int result(1);
+        while (result)
+        {
+            msleep(1000);
+            result = system("redis-cli wait 2 100 | grep -q 2");
+        }
+        std::cout << "redis replication is working well" << std::endl;
+    }
+
+
+    void connect(::nokia::net::redis_replicas & client)
+    {
+        std::atomic<uint32_t> num_of_connected{0};
+        client.connect({"127.0.0.1", 6379},
+                       {{"127.0.0.1", 6380}, {"127.0.0.1", 6381}},
+                       [&] (boost::system::error_code const & error)
+                       {
+                           if (!error)
+                           {
+                               ++num_of_connected;
+                           }
+                       },
+                       [&] (boost::system::error_code const & ec)
+                       {
+                           std::cout << "UT: Connection lost. error core: " << ec << std::endl;
+                       });
+        ASSERT_TRUE(wait_for_true([&] ()
+                                  {
+                                      return num_of_connected == 3;
+                                  },
+                                  10000));
+    }
+}
+
+
+TEST(commands, readonly)
+{
+    ASSERT_TRUE(::nokia::net::is_readonly({"GET", "key"}));
+    ASSERT_TRUE(::nokia::net::is_readonly({"hgetall", "key"}));
+    ASSERT_TRUE(::nokia::net::is_readonly({"ZRANGE", "key", "0", "-1"}));
+    ASSERT_TRUE(::nokia::net::is_readonly({"SCAN", "0"}));
+    ASSERT_FALSE(::nokia::net::is_readonly({"SET", "key", "value"}));
+    ASSERT_FALSE(::nokia::net::is_readonly({"EVAL", "return 1", "0"}));
+    ASSERT_FALSE(::nokia::net::is_readonly({"PING"}));
+}
+
+
+TEST(redis_replicas, reads_are_balanced)
+{
+    ::nokia::net::redis_replicas client(ios);
+    client.set_write_sync(2, std::chrono::milliseconds(1000));
+    connect(client);
+
+    bool replied{false};
+    client.execute([&] (::nokia::net::proto::redis::reply && reply)
+                   {
+                       // Replicas are read-only
+                       ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING) << reply.str;
+                       ASSERT_EQ(reply.str, "OK");
+                       replied = true;
+                   },
+                   "SET", "replicas-key", "replicas-value");
+    ASSERT_TRUE(wait_for_true(replied, 10000));
+
+    std::atomic<uint32_t> counter{0};
+    for (int i = 0; i < 100; ++i)
+    {
+        client.execute([&] (::nokia::net::proto::redis::reply && reply)
+                       {
+                           ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING) << reply.str;
+                           ASSERT_EQ(reply.str, "replicas-value");
+                           ++counter;
+                       },
+                       "GET", "replicas-key");
+    }
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return counter == 100;
+                              },
+                              10000)) << "counter: " << counter;
+
+    auto const replicas = client.replicas();
+    ASSERT_EQ(2, replicas.size());
+    for (auto const & replica: replicas)
+    {
+        ASSERT_TRUE(replica.connected);
+        ASSERT_LT(0, replica.rtt.count()) << replica.address;
+    }
+
+    client.disconnect();
+    client.sync_join();
+}
+
+
+TEST(redis_replicas, slow_replica_is_hedged)
+{
+    ::nokia::net::redis_replicas client(ios);
+    client.set_hedging(0.95, std::chrono::milliseconds(10));
+    connect(client);
+
+    system("(redis-cli -p 6380 debug sleep 2 &) &> /dev/null");
+    msleep(100);
+
+    std::atomic<uint32_t> counter{0};
+    for (int i = 0; i < 20; ++i)
+    {
+        client.execute([&] (::nokia::net::proto::redis::reply && reply)
+                       {
+                           ASSERT_NE(reply.type, ::nokia::net::proto::redis::reply::ERROR) << reply.str;
+                           ++counter;
+                       },
+                       "GET", "replicas-key");
+    }
+    // Much sooner than the replica wakes up
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return counter == 20;
+                              },
+                              1000)) << "counter: " << counter;
+    ASSERT_LT(0, client.hedged_requests());
+
+    client.disconnect();
+    client.sync_join();
+}
+
+
+TEST(redis_replicas, reads_fall_back_to_primary)
+{
+    ::nokia::net::redis_replicas client(ios);
+    client.connect({"127.0.0.1", 6379},
+                   {{"127.0.0.1", 6390}},
+                   [&] (boost::system::error_code const & error)
+                   {
+                   },
+                   [&] (boost::system::error_code const & ec)
+                   {
+                   });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return client.connected();
+                              },
+                              10000));
+
+    bool replied{false};
+    client.execute([&] (::nokia::net::proto::redis::reply && reply)
+                   {
+                       ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING) << reply.str;
+                       replied = true;
+                   },
+                   "GET", "replicas-key");
+    ASSERT_TRUE(wait_for_true(replied, 10000));
+
+    client.disconnect();
+    client.sync_join();
+}
+
+
+TEST(redis_replicas, probe_rtt_before_reads)
+{
+    ::nokia::net::redis_replicas client(ios);
+    client.set_health_probe(std::chrono::milliseconds(50));
+    connect(client);
+
+    // No read yet, the probes tell the round-trip times
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  for (auto const & replica: client.replicas())
+                                  {
+                                      if (0 == replica.rtt.count())
+                                      {
+                                          return false;
+                                      }
+                                  }
+                                  return true;
+                              },
+                              5000));
+
+    client.disconnect();
+    client.sync_join();
+}
+
+
+
+int main(int argc, char* argv[])
+{
+    stop_server();
+    start_replication();
+
+    bool loop_condition = true;
+
+    int retval{0};
+    std::thread scheduler_thread([&] ()
+                                 {
+                                     while (loop_condition)
+                                     {
+                                         ios.reset();
+                                         ios.run();
+                                         msleep(10);
+                                     }
+                                 });
+
+    ::testing::InitGoogleTest(&argc, argv);
+
+    retval = RUN_ALL_TESTS();
+
+    loop_condition = false;
+    scheduler_thread.join();
+
+    stop_server();
+
+    return retval;
+}
@@ -0,0 +1,157 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <string>
+#include <iostream>
+#include <thread>
+#include <utility>
+
+#include <wiredis/redis-sentinel.h>
+#include <common.h>
+
+namespace
+{
+    ::boost::asio::io_service ios;
+
+    std::vector<std::pair<std::string, uint16_t>> const sentinels{{"127.0.0.1", 26380}, {"127.0.0.1", 26379}};
+
+
+    void start_replication()
+    {
+        // Master: 6379, replica: 6380, sentinel: 26379 (26380 is not running)
+        start_server();
+        system("(redis-server --port 6380 --replicaof 127.0.0.1 6379 &) &> /tmp/redis.replica.out");
+
+        std::ofstream config("/tmp/wiredis-sentinel.conf");
+        config << "port 26379" << std::endl
+               << "sentinel monitor mymaster 127.0.0.1 6379 1" << std::endl
+               << "sentinel down-after-milliseconds mymaster 1000" << std::endl
+               << "sentinel failover-timeout mymaster 5000" << std::endl;
+        config.close();
+        system("(redis-server /tmp/wiredis-sentinel.conf --sentinel &) &> /tmp/redis.sentinel.out");
+
+        int result(1);
+        while (result)
+        {
+            msleep(1000);
+            result = system("redis-cli -p 26379 sentinel get-master-addr-by-name mymaster | grep -q 6379");
+        }
+        std::cout << "redis sentinel is working well" << std::endl;
+    }
+
+
+    bool set_value(::nokia::net::redis_sentinel & client)
+    {
+        bool replied{false};
+        bool succeeded{false};
+        client.execute([&] (::nokia::net::proto::redis::reply && reply)
+                       {
+                           succeeded = (::nokia::net::proto::redis::reply::STRING == reply.type);
+                           replied = true;
+                       },
+                       "SET", "sentinel-key", "value");
+        wait_for_true(replied, 5000);
+        return succeeded;
+    }
+}
+
+
+TEST(redis_sentinel, connect_to_master)
+{
+    ::nokia::net::redis_sentinel client(ios);
+
+    bool connected{false};
+    client.connect(sentinels,
+                   "mymaster",
+                   [&] (boost::system::error_code const & error)
+                   {
+                       connected = !error;
+                   },
+                   [&] (boost::system::error_code const & ec)
+                   {
+                       std::cout << "UT: Connection lost. error core: " << ec << std::endl;
+                   });
+
+    ASSERT_TRUE(wait_for_true(connected, 10000));
+    ASSERT_EQ(6379, client.master().second);
+    ASSERT_TRUE(set_value(client));
+
+    client.disconnect();
+    client.sync_join();
+}
+
+
+TEST(redis_sentinel, failover)
+{
+    ::nokia::net::redis_sentinel client(ios);
+
+    bool connected{false};
+    client.connect(sentinels,
+                   "mymaster",
+                   [&] (boost::system::error_code const & error)
+                   {
+                       connected = !error;
+                   },
+                   [&] (boost::system::error_code const & ec)
+                   {
+                   });
+    ASSERT_TRUE(wait_for_true(connected, 10000));
+    ASSERT_EQ(6379, client.master().second);
+
+    // The sentinel needs some time to discover the replica
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 0 == system("redis-cli -p 26379 sentinel failover mymaster | grep -q OK");
+                              },
+                              30000,
+                              1000));
+
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 6380 == client.master().second && client.connected();
+                              },
+                              30000));
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return set_value(client);
+                              },
+                              10000));
+
+    client.disconnect();
+    client.sync_join();
+}
+
+
+int main(int argc, char* argv[])
+{
+    stop_server();
+    start_replication();
+
+    bool loop_condition = true;
+
+    int retval{0};
+    std::thread scheduler_thread([&] ()
+                                 {
+                                     while (loop_condition)
+                                     {
+                                         ios.reset();
+                                         ios.run();
+                                         msleep(10);
+                                     }
+                                 });
+
+    ::testing::InitGoogleTest(&argc, argv);
+
+    retval = RUN_ALL_TESTS();
+
+    loop_condition = false;
+    scheduler_thread.join();
+
+    stop_server();
+
+    return retval;
+}
@@ -0,0 +1,309 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <iostream>
+#include <thread>
+#include <utility>
+
+#include <wiredis/redis-sharded.h>
+#include <wiredis/scan.h>
+#include <common.h>
+
+namespace
+{
+    ::boost::asio::io_service ios;
+
+    std::vector<std::pair<std::string, uint16_t>> const nodes{{"127.0.0.1", 6379}, {"127.0.0.1", 6380}, {"127.0.0.1", 6381}};
+
+
+    void start_servers()
+    {
+        start_server();
+        for (int port = 6380; port <= 6382; ++port)
+        {
+            std::string const port_str = std::to_string(port);
+            system(("(redis-server --port " + port_str + " --save '' --appendonly no &) &> /tmp/redis.shard." + port_str + ".out").c_str());
+        }
+        int result(1);
+        while (result)
+        {
+            msleep(500);
+            result = system("redis-cli -p 6382 ping | grep -q PONG");
+        }
+        std::cout << "redis servers are working well" << std::endl;
+    }
+
+
+    void connect(::nokia::net::redis_sharded & client)
+    {
+        client.connect(nodes,
+                       [&] (boost::system::error_code const & error)
+                       {
+                       },
+                       [&] (boost::system::error_code const & ec)
+                       {
+                           std::cout << "UT: Connection lost. error core: " << ec << std::endl;
+                       });
+        ASSERT_TRUE(wait_for_true([&] ()
+                                  {
+                                      return client.connected();
+                                  },
+                                  10000));
+    }
+
+
+    std::string hex(std::array<uint8_t, 16> const & digest)
+    {
+        static char const digits[] = "0123456789abcdef";
+        std::string result;
+        for (uint8_t byte: digest)
+        {
+            result += digits[byte >> 4];
+            result += digits[byte & 0xf];
+        }
+        return result;
+    }
+}
+
+
+TEST(md5, digest)
+{
+    ASSERT_EQ("d41d8cd98f00b204e9800998ecf8427e", hex(::nokia::net::md5("")));
+    ASSERT_EQ("900150983cd24fb0d6963f7d28e17f72", hex(::nokia::net::md5("abc")));
+    ASSERT_EQ("9e107d9d372bb6826bd81d3542a419d6", hex(::nokia::net::md5("The quick brown fox jumps over the lazy dog")));
+    ASSERT_EQ("57edf4a22be3c955ac49da2e2107b67a",
+              hex(::nokia::net::md5("12345678901234567890123456789012345678901234567890123456789012345678901234567890")));
+}
+
+
+TEST(redis_sharded, minimal_key_movement)
+{
+    ::nokia::net::redis_sharded client(ios);
+    connect(client);
+
+    std::map<std::string, std::string> before;
+    std::map<std::string, uint32_t> keys_per_node;
+    for (int i = 0; i < 3000; ++i)
+    {
+        std::string const key = "sharded-key-" + std::to_string(i);
+        before[key] = client.node_of(key);
+        ++keys_per_node[before[key]];
+    }
+    ASSERT_EQ(3, keys_per_node.size());
+    for (auto const & item: keys_per_node)
+    {
+        // Even distribution within 25%
+        ASSERT_LT(750, item.second) << item.first;
+        ASSERT_GT(1250, item.second) << item.first;
+    }
+
+    client.add_node("127.0.0.1", 6382);
+    uint32_t moved{0};
+    for (auto const & item: before)
+    {
+        std::string const node = client.node_of(item.first);
+        if (node != item.second)
+        {
+            ASSERT_EQ("127.0.0.1:6382", node);
+            ++moved;
+        }
+    }
+    ASSERT_LT(500, moved);
+    ASSERT_GT(1000, moved);
+
+    // Removing it gives back the original mapping
+    client.remove_node("127.0.0.1", 6382);
+    for (auto const & item: before)
+    {
+        ASSERT_EQ(item.second, client.node_of(item.first));
+    }
+    ASSERT_EQ(client.node_of("{user1000}.following"), client.node_of("{user1000}.followers"));
+
+    client.disconnect();
+    client.sync_join();
+}
+
+
+TEST(redis_sharded, keys_on_every_node)
+{
+    ::nokia::net::redis_sharded client(ios);
+    connect(client);
+
+    std::vector<std::string> mset{"MSET"};
+    std::vector<std::string> mget{"MGET"};
+    for (int i = 0; i < 20; ++i)
+    {
+        mset.push_back("sharded-key-" + std::to_string(i));
+        mset.push_back("value-" + std::to_string(i));
+        mget.push_back("sharded-key-" + std::to_string(i));
+    }
+
+    bool replied{false};
+    client.execute_command([&] (::nokia::net::proto::redis::reply && reply)
+                           {
+                               ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING) << reply.str;
+                               ASSERT_EQ(reply.str, "OK");
+                               replied = true;
+                           },
+                           mset);
+    ASSERT_TRUE(wait_for_true(replied, 10000));
+
+    std::atomic<uint32_t> counter{0};
+    for (int i = 0; i < 20; ++i)
+    {
+        client.execute([&, i] (::nokia::net::proto::redis::reply && reply)
+                       {
+                           ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING) << reply.str;
+                           ASSERT_EQ(reply.str, "value-" + std::to_string(i));
+                           ++counter;
+                       },
+                       "GET", "sharded-key-" + std::to_string(i));
+    }
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return counter == 20;
+                              },
+                              10000)) << "counter: " << counter;
+
+    replied = false;
+    client.execute_command([&] (::nokia::net::proto::redis::reply && reply)
+                           {
+                               ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ARRAY) << reply.str;
+                               ASSERT_EQ(20, reply.elements.size());
+                               for (int i = 0; i < 20; ++i)
+                               {
+                                   ASSERT_EQ(reply.elements[i].str, "value-" + std::to_string(i));
+                               }
+                               replied = true;
+                           },
+                           mget);
+    ASSERT_TRUE(wait_for_true(replied, 10000));
+
+    // Every server got some of the keys
+    for (auto const & node: nodes)
+    {
+        ASSERT_NE(0, system(("redis-cli -p " + std::to_string(node.second) + " dbsize | grep -qx 0").c_str()));
+    }
+
+    mget[0] = "DEL";
+    replied = false;
+    client.execute_command([&] (::nokia::net::proto::redis::reply && reply)
+                           {
+                               ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::INTEGER) << reply.str;
+                               ASSERT_EQ(20, reply.integer);
+                               replied = true;
+                           },
+                           mget);
+    ASSERT_TRUE(wait_for_true(replied, 10000));
+
+    client.disconnect();
+    client.sync_join();
+}
+
+
+TEST(redis_sharded, scan_parallel)
+{
+    ::nokia::net::redis_sharded client(ios);
+    connect(client);
+
+    std::vector<std::string> mset{"MSET"};
+    for (int i = 0; i < 20; ++i)
+    {
+        mset.push_back("scanned-key-" + std::to_string(i));
+        mset.push_back("value");
+    }
+    bool replied{false};
+    client.execute_command([&] (::nokia::net::proto::redis::reply && reply)
+                           {
+                               replied = true;
+                           },
+                           mset);
+    ASSERT_TRUE(wait_for_true(replied, 10000));
+
+    std::mutex mutex;
+    std::multiset<std::string> keys;
+    std::atomic<bool> done{false};
+    std::string result{"not called"};
+    auto iterators = ::nokia::net::scan_parallel(client.connections(),
+                                                 {"MATCH", "scanned-key-*", "COUNT", "2"},
+                                                 [&] (std::vector<std::string> && items)
+                                                 {
+                                                     std::unique_lock<std::mutex> guard(mutex);
+                                                     keys.insert(items.begin(), items.end());
+                                                 },
+                                                 [&] (std::string const & error)
+                                                 {
+                                                     result = error;
+                                                     done = true;
+                                                 });
+    ASSERT_EQ(nodes.size(), iterators.size());
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return done.load();
+                              },
+                              10000));
+    ASSERT_EQ("", result);
+    // Every key once, from its own server
+    ASSERT_EQ(20, keys.size());
+    ASSERT_EQ(20, std::set<std::string>(keys.begin(), keys.end()).size());
+
+    client.disconnect();
+    client.sync_join();
+}
+
+
+TEST(redis_sharded, no_node)
+{
+    ::nokia::net::redis_sharded client(ios);
+
+    bool replied{false};
+    client.execute([&] (::nokia::net::proto::redis::reply && reply)
+                   {
+                       ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::ERROR);
+                       ASSERT_EQ(reply.str, client.ERROR_NO_NODE);
+                       replied = true;
+                   },
+                   "GET", "foo");
+    ASSERT_TRUE(replied);
+
+    client.sync_join();
+}
+
+
+int main(int argc, char* argv[])
+{
+    stop_server();
+    start_servers();
+
+    bool loop_condition = true;
+
+    int retval{0};
+    std::thread scheduler_thread([&] ()
+                                 {
+                                     while (loop_condition)
+                                     {
+                                         ios.reset();
+                                         ios.run();
+                                         msleep(10);
+                                     }
+                                 });
+
+    ::testing::InitGoogleTest(&argc, argv);
+
+    retval = RUN_ALL_TESTS();
+
+    loop_condition = false;
+    scheduler_thread.join();
+
+    stop_server();
+
+    return retval;
+}
@@ -0,0 +1,187 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <iostream>
+#include <thread>
+
+#include <wiredis/redis-connection.h>
+#include <common.h>
+
+namespace
+{
+    ::boost::asio::io_service ios;
+
+    uint16_t const TLS_PORT{6392};
+    char const * const CERT{"/tmp/wiredis-tls.crt"};
+
+
+    std::shared_ptr<boost::asio::ssl::context> make_context(bool verify = true)
+    {
+        auto context = std::make_shared<boost::asio::ssl::context>(boost::asio::ssl::context::tls_client);
+        if (verify)
+        {
+            context->set_verify_mode(boost::asio::ssl::verify_peer);
+            context->load_verify_file(CERT);
+        }
+        return context;
+    }
+
+
+    void connect(::nokia::net::redis_connection & con, std::atomic<int> & errors, std::atomic<int> & disconnections)
+    {
+        con.connect("localhost",
+                    TLS_PORT,
+                    [&] (boost::system::error_code const & error)
+                    {
+                        if (error)
+                        {
+                            std::cout << "UT: Could not connect: " << error.message() << std::endl;
+                            ++errors;
+                        }
+                    },
+                    [&] (boost::system::error_code const & ec)
+                    {
+                        std::cout << "UT: Connection lost. error core: " << ec << std::endl;
+                        ++disconnections;
+                    });
+    }
+}
+
+
+TEST(redis_tls, some_basic_cases)
+{
+    ::nokia::net::redis_connection con(ios);
+    con.set_tls(make_context());
+    std::atomic<int> errors{0};
+    std::atomic<int> disconnections{0};
+    connect(con, errors, disconnections);
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return con.connected();
+                              },
+                              10000));
+    ASSERT_FALSE(con.tls_session_reused());
+
+    std::atomic<int> counter{0};
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::STRING);
+                    ++counter;
+                },
+                "SET", "tls_key", std::string(100000, 'x')); // several TLS records
+    con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                {
+                    ASSERT_EQ(reply.type, ::nokia::net::proto::redis::reply::INTEGER);
+                    ASSERT_EQ(reply.integer, 100000);
+                    ++counter;
+                },
+                "STRLEN", "tls_key");
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 2 == counter;
+                              },
+                              10000));
+    ASSERT_EQ(0, errors);
+    ASSERT_EQ(0, disconnections);
+
+    con.disconnect();
+    con.sync_join();
+}
+
+
+TEST(redis_tls, session_resumption)
+{
+    for (bool resumption: {true, false})
+    {
+        ::nokia::net::redis_connection con(ios);
+        con.set_tls(make_context(), resumption);
+        std::atomic<int> errors{0};
+        std::atomic<int> disconnections{0};
+        connect(con, errors, disconnections);
+        ASSERT_TRUE(wait_for_true([&] ()
+                                  {
+                                      return con.connected();
+                                  },
+                                  10000));
+        ASSERT_FALSE(con.tls_session_reused());
+
+        // The server closes the connection, the client reconnects with the ticket got on the first one
+        con.execute([&] (::nokia::net::proto::redis::reply && reply)
+                    {
+                    },
+                    "QUIT");
+        ASSERT_TRUE(wait_for_true([&] ()
+                                  {
+                                      return 1 == disconnections && con.connected();
+                                  },
+                                  10000));
+        ASSERT_EQ(resumption, con.tls_session_reused());
+        ASSERT_EQ(0, errors);
+
+        con.disconnect();
+        con.sync_join();
+    }
+}
+
+
+TEST(redis_tls, untrusted_certificate)
+{
+    ::nokia::net::redis_connection con(ios);
+    auto context = std::make_shared<boost::asio::ssl::context>(boost::asio::ssl::context::tls_client);
+    context->set_verify_mode(boost::asio::ssl::verify_peer);
+    con.set_tls(context);
+    std::atomic<int> errors{0};
+    std::atomic<int> disconnections{0};
+    connect(con, errors, disconnections);
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 0 < errors;
+                              },
+                              10000));
+    ASSERT_FALSE(con.connected());
+
+    con.disconnect();
+    con.sync_join();
+}
+
+
+int main(int argc, char* argv[])
+{
+    stop_server();
+    MUST_BE_ZERO(system("openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost "
+                        "-addext subjectAltName=DNS:localhost,IP:127.0.0.1 "
+                        "-keyout /tmp/wiredis-tls.key -out /tmp/wiredis-tls.crt 2> /dev/null"));
+    system("(redis-server --port 0 --tls-port 6392 --tls-cert-file /tmp/wiredis-tls.crt --tls-key-file /tmp/wiredis-tls.key "
+           "--tls-ca-cert-file /tmp/wiredis-tls.crt --tls-auth-clients no &) &> /tmp/redis.tls.out");
+    msleep(1000);
+
+    bool loop_condition = true;
+
+    int retval{0};
+    std::thread scheduler_thread(
+        [&]
+        {
+            while (loop_condition)
+            {
+                ios.reset();
+                ios.run();
+                msleep(10);
+            }
+        });
+
+    ::testing::InitGoogleTest(&argc, argv);
+
+    retval = RUN_ALL_TESTS();
+
+    loop_condition = false;
+    scheduler_thread.join();
+    stop_server();
+
+    return retval;
+}
@@ -4,10 +4,13 @@
  */
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <mutex>
 #include <string>
 #include <iostream>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include <common.h>
 #include <wiredis/tcp-connection.h>
@@ -338,6 +341,374 @@ TEST(tcp_connection, disconnect_during_connecting)
 
 
 
+TEST(reconnect_policy, delays)
+{
+    ::nokia::net::reconnect_policy policy(std::chrono::milliseconds(100), std::chrono::milliseconds(1000));
+    ASSERT_EQ(0, policy.next_delay().count());
+    int64_t previous{100};
+    for (int i = 0; i < 20; ++i)
+    {
+        int64_t const delay = policy.next_delay().count();
+        ASSERT_LE(100, delay);
+        ASSERT_GE(std::min<int64_t>(1000, std::max<int64_t>(100, 3 * previous)), delay);
+        previous = delay;
+    }
+    ASSERT_EQ(21, policy.attempts());
+
+    policy.reset();
+    ASSERT_EQ(0, policy.attempts());
+    ASSERT_EQ(0, policy.next_delay().count());
+
+    auto fixed = ::nokia::net::reconnect_policy::fixed(std::chrono::milliseconds(2000));
+    ASSERT_EQ(2000, fixed.next_delay().count());
+    ASSERT_EQ(2000, fixed.next_delay().count());
+}
+
+
+TEST(tcp_connection, immediate_reconnect_after_restart)
+{
+    stop_server();
+    start_server();
+    ::nokia::net::tcp_connection<> con(ios, 100);
+
+    std::mutex mutex;
+    std::vector<std::pair<unsigned, int64_t>> attempts;
+    con.set_reconnect_hook([&] (unsigned attempt, std::chrono::milliseconds delay)
+                           {
+                               std::unique_lock<std::mutex> guard(mutex);
+                               attempts.emplace_back(attempt, delay.count());
+                           });
+    con.connect("127.0.0.1",
+                6379,
+                [&] (boost::system::error_code const & error)
+                {
+                },
+                [&] (boost::system::error_code const & ec)
+                {
+                },
+                [&] (::nokia::net::proto::char_buffer && reply)
+                {
+                });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return con.connected();
+                              },
+                              10000));
+
+    stop_server();
+    start_server();
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return con.connected();
+                              },
+                              10000));
+    {
+        std::unique_lock<std::mutex> guard(mutex);
+        ASSERT_FALSE(attempts.empty());
+        ASSERT_EQ(1, attempts.front().first);
+        ASSERT_EQ(0, attempts.front().second);
+        for (std::size_t i = 1; i < attempts.size(); ++i)
+        {
+            ASSERT_EQ(i + 1, attempts[i].first);
+            ASSERT_LE(100, attempts[i].second);
+            ASSERT_GE(2000, attempts[i].second);
+        }
+    }
+
+    con.disconnect();
+    con.sync_join();
+}
+
+
+TEST(tcp_connection, host_name_and_ipv6)
+{
+    stop_server();
+    start_server();
+    for (auto const & host: {"localhost", "::1"})
+    {
+        ::nokia::net::tcp_connection<> con(ios, 100);
+        con.connect(host,
+                    6379,
+                    [&] (boost::system::error_code const & error)
+                    {
+                    },
+                    [&] (boost::system::error_code const & ec)
+                    {
+                    },
+                    [&] (::nokia::net::proto::char_buffer && reply)
+                    {
+                    });
+        ASSERT_TRUE(wait_for_true([&] ()
+                                  {
+                                      return con.connected();
+                                  },
+                                  10000)) << host;
+        con.disconnect();
+        con.sync_join();
+    }
+
+    // Unknown host: reported to the connected callback like a refused connection
+    ::nokia::net::tcp_connection<> con(ios, 100);
+    std::atomic<bool> failed{false};
+    con.connect("no-such-host.invalid",
+                6379,
+                [&] (boost::system::error_code const & error)
+                {
+                    if (error)
+                    {
+                        failed = true;
+                    }
+                },
+                [&] (boost::system::error_code const & ec)
+                {
+                },
+                [&] (::nokia::net::proto::char_buffer && reply)
+                {
+                });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return failed.load();
+                              },
+                              10000));
+    ASSERT_FALSE(con.connected());
+    con.disconnect();
+    con.sync_join();
+}
+
+
+TEST(tcp_connection, simultaneous_connection_attempts)
+{
+    // Needs a host name of both address families
+    boost::asio::io_service io;
+    boost::asio::ip::tcp::resolver resolver(io);
+    boost::system::error_code error;
+    auto const results = resolver.resolve("localhost", "", error);
+    std::vector<boost::asio::ip::address> addresses;
+    for (auto const & entry: results)
+    {
+        auto const address = entry.endpoint().address();
+        if (addresses.empty() || address.is_v6() != addresses.front().is_v6())
+        {
+            addresses.push_back(address);
+        }
+    }
+    if (addresses.size() < 2)
+    {
+        GTEST_SKIP() << "localhost has one address family only";
+    }
+
+    // The accept queues are full, the SYNs of both attempts are dropped and retransmitted later.
+    uint16_t const port{16380};
+    std::vector<std::unique_ptr<boost::asio::ip::tcp::acceptor>> listeners;
+    std::vector<std::unique_ptr<boost::asio::ip::tcp::socket>> fillers;
+    for (auto const & address: addresses)
+    {
+        boost::asio::ip::tcp::endpoint const endpoint(address, port);
+        listeners.emplace_back(new boost::asio::ip::tcp::acceptor(io));
+        listeners.back()->open(endpoint.protocol());
+        listeners.back()->set_option(boost::asio::socket_base::reuse_address(true));
+        if (address.is_v6())
+        {
+            listeners.back()->set_option(boost::asio::ip::v6_only(true));
+        }
+        listeners.back()->bind(endpoint);
+        listeners.back()->listen(0);
+        fillers.emplace_back(new boost::asio::ip::tcp::socket(io));
+        fillers.back()->connect(endpoint);
+    }
+
+    ::nokia::net::tcp_connection<> con(io, 100);
+    std::atomic<int> connected_calls{0};
+    con.connect("localhost",
+                port,
+                [&] (boost::system::error_code const & error)
+                {
+                    if (!error)
+                    {
+                        ++connected_calls;
+                    }
+                },
+                [&] (boost::system::error_code const & ec)
+                {
+                },
+                [&] (::nokia::net::proto::char_buffer && reply)
+                {
+                });
+    // Resolved, both attempts started (the second one after 250 ms)
+    io.reset();
+    io.run_for(std::chrono::milliseconds(600));
+    ASSERT_EQ(0, connected_calls);
+
+    // Both SYN retransmits are accepted while the io_service isn't running, so both attempts
+    // complete in the same loop iteration.
+    std::vector<std::unique_ptr<boost::asio::ip::tcp::socket>> peers;
+    for (auto & listener: listeners)
+    {
+        peers.emplace_back(new boost::asio::ip::tcp::socket(io));
+        listener->accept(*peers.back());
+    }
+    msleep(2500);
+    io.reset();
+    io.run_for(std::chrono::milliseconds(100));
+    ASSERT_EQ(1, connected_calls);
+    ASSERT_TRUE(con.connected());
+
+    // The winning socket is in use, the other one is closed.
+    for (auto & listener: listeners)
+    {
+        peers.emplace_back(new boost::asio::ip::tcp::socket(io));
+        listener->accept(*peers.back());
+    }
+    con.send("hello");
+    io.reset();
+    io.run_for(std::chrono::milliseconds(100));
+    int received{0};
+    int closed{0};
+    for (std::size_t i = listeners.size(); i < peers.size(); ++i)
+    {
+        char buffer[16];
+        boost::system::error_code ec;
+        std::size_t const size = peers[i]->read_some(boost::asio::buffer(buffer), ec);
+        if (!ec && "hello" == std::string(buffer, size))
+        {
+            ++received;
+        }
+        else if (boost::asio::error::eof == ec)
+        {
+            ++closed;
+        }
+    }
+    ASSERT_EQ(1, received);
+    ASSERT_EQ(1, closed);
+    ASSERT_EQ(1, connected_calls);
+
+    con.disconnect();
+    bool joined{false};
+    con.join([&] ()
+             {
+                 joined = true;
+             });
+    while (!joined)
+    {
+        io.reset();
+    io.run_for(std::chrono::milliseconds(10));
+    }
+}
+
+
+
+TEST(tcp_connection, join_while_reconnecting)
+{
+    stop_server();
+    ::nokia::net::tcp_connection<> con(ios, 100);
+    con.connect("127.0.0.1",
+                6379,
+                [&] (boost::system::error_code const & error)
+                {
+                },
+                [&] (boost::system::error_code const & ec)
+                {
+                },
+                [&] (::nokia::net::proto::char_buffer && reply)
+                {
+                });
+
+    // The waiter is completed by disconnect() only, and it doesn't disturb reconnecting.
+    std::atomic<bool> joined{false};
+    con.join([&] ()
+             {
+                 joined = true;
+             });
+    start_server();
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return con.connected();
+                              },
+                              10000));
+    ASSERT_FALSE(joined);
+
+    con.disconnect();
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return joined.load();
+                              },
+                              1000,
+                              1));
+    con.sync_join();
+}
+
+
+
+TEST(tcp_connection, expired_or_cancelled_message_is_not_sent)
+{
+    // The peer doesn't read for a while, so the messages back up in the send buffer.
+    boost::asio::ip::tcp::acceptor acceptor(ios);
+    boost::asio::ip::tcp::endpoint const endpoint(boost::asio::ip::address_v4::loopback(), 0);
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(boost::asio::socket_base::receive_buffer_size(4096));
+    acceptor.bind(endpoint);
+    acceptor.listen();
+    boost::asio::ip::tcp::socket peer(ios);
+    std::atomic<bool> accepted{false};
+    acceptor.async_accept(peer,
+                          [&] (boost::system::error_code const & error)
+                          {
+                              accepted = !error;
+                          });
+
+    ::nokia::net::tcp_connection<> con(ios, 100);
+    con.connect("127.0.0.1",
+                acceptor.local_endpoint().port(),
+                [&] (boost::system::error_code const & error)
+                {
+                },
+                [&] (boost::system::error_code const & ec)
+                {
+                },
+                [&] (::nokia::net::proto::char_buffer && reply)
+                {
+                });
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return con.connected() && accepted;
+                              },
+                              10000));
+
+    std::size_t const big_size = 8 * 1024 * 1024;
+    std::atomic<int> expired{0};
+    uint64_t const big = con.send(std::string(big_size, 'x'));
+    uint64_t const cancelled = con.send("cancelled");
+    con.send("late",
+             std::chrono::steady_clock::now() + std::chrono::milliseconds(100),
+             [&] ()
+             {
+                 ++expired;
+             });
+    con.send("in time");
+    msleep(300);
+    ASSERT_LT(0, con.send_buffer_size());
+    ASSERT_EQ(0, expired);
+    ASSERT_FALSE(con.cancel(big));  // being written
+    ASSERT_TRUE(con.cancel(cancelled));
+    ASSERT_FALSE(con.cancel(cancelled));
+
+    std::string received;
+    std::vector<char> buffer(65536);
+    while (received.size() < big_size + 7)
+    {
+        std::size_t const size = peer.read_some(boost::asio::buffer(buffer));
+        received.append(buffer.data(), size);
+    }
+    ASSERT_EQ(big_size + 7, received.size());
+    ASSERT_EQ("in time", received.substr(big_size));
+    ASSERT_EQ(1, expired);
+
+    con.disconnect();
+    con.sync_join();
+}
+
+
+
 int main(int argc, char* argv[])
 {
     stop_server();
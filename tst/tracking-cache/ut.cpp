@@ -0,0 +1,197 @@
+/*
+ * Licensed under BSD-3-Clause License
+ * © 2018 Nokia
+ */
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <string>
+#include <iostream>
+#include <thread>
+
+#include <wiredis/tracking-cache.h>
+#include <common.h>
+
+namespace
+{
+    ::boost::asio::io_service ios;
+
+
+    void connect(::nokia::net::tracking_cache & cache)
+    {
+        cache.connect("127.0.0.1",
+                      6379,
+                      [] (boost::system::error_code const & error)
+                      {
+                      },
+                      [] (boost::system::error_code const & ec)
+                      {
+                      });
+        ASSERT_TRUE(wait_for_true([&] ()
+                                  {
+                                      return cache.tracking();
+                                  },
+                                  10000));
+    }
+
+
+    std::string get(::nokia::net::tracking_cache & cache, std::string const & key)
+    {
+        std::atomic<bool> done{false};
+        std::string value;
+        cache.get([&] (::nokia::net::proto::redis::reply && reply)
+                  {
+                      value = reply.str;
+                      done = true;
+                  },
+                  key);
+        wait_for_true([&] ()
+                      {
+                          return done.load();
+                      },
+                      10000,
+                      10);
+        return value;
+    }
+}
+
+
+TEST(tracking_cache, invalidation)
+{
+    system("redis-cli set tracked_key 1");
+    ::nokia::net::tracking_cache cache(ios);
+    connect(cache);
+
+    ASSERT_EQ("1", get(cache, "tracked_key"));
+    ASSERT_EQ(1, cache.misses());
+    ASSERT_EQ(1, cache.size());
+
+    // Served locally, in the calling thread
+    bool hit{false};
+    cache.get([&] (::nokia::net::proto::redis::reply && reply)
+              {
+                  ASSERT_EQ("1", reply.str);
+                  hit = true;
+              },
+              "tracked_key");
+    ASSERT_TRUE(hit);
+    ASSERT_EQ(1, cache.hits());
+
+    // Changed by an other client: the server invalidates it
+    system("redis-cli set tracked_key 2");
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 0 == cache.size();
+                              },
+                              10000,
+                              10));
+    ASSERT_EQ("2", get(cache, "tracked_key"));
+    ASSERT_EQ(2, cache.misses());
+
+    // Only read-only commands of a single key are cached
+    std::atomic<int> counter{0};
+    for (std::vector<std::string> const & command: std::vector<std::vector<std::string>>{{"MGET", "tracked_key", "other_key"},
+                                                                                         {"INCR", "tracked_counter"}})
+    {
+        cache.execute_cached([&] (::nokia::net::proto::redis::reply && reply)
+                             {
+                                 ASSERT_NE(reply.type, ::nokia::net::proto::redis::reply::ERROR);
+                                 ++counter;
+                             },
+                             command);
+    }
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 2 == counter;
+                              },
+                              10000));
+    ASSERT_EQ(2, cache.misses());
+    ASSERT_EQ(1, cache.size());
+
+    // Random and time dependent reads are never served from the cache
+    counter = 0;
+    for (int i = 0; i < 2; ++i)
+    {
+        for (std::vector<std::string> const & command: std::vector<std::vector<std::string>>{{"TTL", "tracked_key"},
+                                                                                             {"SRANDMEMBER", "tracked_set"}})
+        {
+            cache.execute_cached([&] (::nokia::net::proto::redis::reply && reply)
+                                 {
+                                     ++counter;
+                                 },
+                                 command);
+        }
+    }
+    ASSERT_TRUE(wait_for_true([&] ()
+                              {
+                                  return 4 == counter;
+                              },
+                              10000));
+    ASSERT_EQ(1, cache.hits());
+    ASSERT_EQ(2, cache.misses());
+    ASSERT_EQ(1, cache.size());
+
+    cache.disconnect();
+    cache.sync_join();
+}
+
+
+TEST(tracking_cache, lru_eviction)
+{
+    ::nokia::net::tracking_cache cache(ios, 2);
+    connect(cache);
+
+    for (auto key: {"lru_1", "lru_2"})
+    {
+        system((std::string("redis-cli set ") + key + " value").c_str());
+        get(cache, key);
+    }
+    ASSERT_EQ(2, cache.size());
+    // lru_1 is used again, so lru_2 is the least recently used one
+    get(cache, "lru_1");
+    ASSERT_EQ(1, cache.hits());
+    get(cache, "lru_3");
+    ASSERT_EQ(2, cache.size());
+    get(cache, "lru_1");
+    ASSERT_EQ(2, cache.hits());
+    get(cache, "lru_2");
+    ASSERT_EQ(2, cache.hits());
+
+    // Flushed on disconnect
+    cache.disconnect();
+    cache.sync_join();
+    ASSERT_EQ(0, cache.size());
+    ASSERT_EQ(0, cache.bytes());
+}
+
+
+
+int main(int argc, char* argv[])
+{
+    stop_server();
+    start_server();
+
+    bool loop_condition = true;
+
+    int retval{0};
+    std::thread scheduler_thread([&] ()
+                                 {
+                                     while (loop_condition)
+                                     {
+                                         ios.reset();
+                                         ios.run();
+                                         msleep(10);
+                                     }
+                                 });
+
+    ::testing::InitGoogleTest(&argc, argv);
+
+    retval = RUN_ALL_TESTS();
+
+    loop_condition = false;
+    scheduler_thread.join();
+
+    stop_server();
+
+    return retval;
+}